@@ -0,0 +1,357 @@
+#include <valve/bsp/hl1bsptypes.h>
+#include <valve/hlpalette.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <print>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace valve;
+
+// Times ExpandPalette() and ResamplePalette() against their scalar table loops, the
+// kernels without the SSE2 and AVX2 paths, and checks that both give the same
+// texels. Runs on generated textures, and on every miptex of the wads given:
+//
+//   palettebench [path/to/halflife.wad path/to/liquids.wad ...]
+//
+// Configure with CONSTRUCT_AVX2=ON to time the AVX2 paths.
+
+const int Repeats = 7;
+const size_t MinTexels = size_t(1) << 22; // every timed pass covers at least this many
+
+typedef struct sIndexedTexture
+{
+    std::string name;
+    int width;
+    int height;
+    std::vector<unsigned char> indices;
+    std::vector<unsigned char> palette; // 256 RGB triplets
+
+} tIndexedTexture;
+
+// The table the kernels look texels up in, see BuildPaletteTable() in hlpalette.cpp
+static void BuildTable(
+    const unsigned char *palette,
+    int transparentIndex,
+    uint32_t table[256])
+{
+    for (int i = 0; i < 256; i++)
+    {
+        unsigned char texel[4] = {palette[i * 3 + 0], palette[i * 3 + 1], palette[i * 3 + 2], 255};
+
+        if (i == transparentIndex)
+        {
+            texel[0] = texel[1] = texel[2] = texel[3] = 0;
+        }
+
+        std::memcpy(&table[i], texel, sizeof(uint32_t));
+    }
+}
+
+// The scalar loops of the kernels, what a build without SSE2 runs
+static void ExpandPaletteReference(
+    const unsigned char *indices,
+    size_t count,
+    const unsigned char *palette,
+    unsigned char *rgba,
+    int transparentIndex)
+{
+    uint32_t table[256];
+    BuildTable(palette, transparentIndex, table);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        std::memcpy(rgba + i * 4, &table[indices[i]], sizeof(uint32_t));
+    }
+}
+
+static void ResamplePaletteReference(
+    const unsigned char *indices,
+    int inWidth,
+    int inHeight,
+    const unsigned char *palette,
+    unsigned char *rgba,
+    int outWidth,
+    int outHeight)
+{
+    uint32_t table[256];
+    BuildTable(palette, -1, table);
+
+    std::vector<int> col1(outWidth), col2(outWidth);
+
+    for (int k = 0; k < outWidth; k++)
+    {
+        col1[k] = int((k + 0.25f) * (float(inWidth) / float(outWidth)));
+        col2[k] = int((k + 0.75f) * (float(inWidth) / float(outWidth)));
+    }
+
+    for (int k = 0; k < outHeight; k++)
+    {
+        auto top = indices + int((k + 0.25f) * (float(inHeight) / float(outHeight))) * inWidth;
+        auto bottom = indices + int((k + 0.75f) * (float(inHeight) / float(outHeight))) * inWidth;
+        auto out = rgba + size_t(k) * size_t(outWidth) * 4;
+
+        for (int j = 0; j < outWidth; j++)
+        {
+            auto pix1 = reinterpret_cast<const unsigned char *>(&table[top[col1[j]]]);
+            auto pix2 = reinterpret_cast<const unsigned char *>(&table[top[col2[j]]]);
+            auto pix3 = reinterpret_cast<const unsigned char *>(&table[bottom[col1[j]]]);
+            auto pix4 = reinterpret_cast<const unsigned char *>(&table[bottom[col2[j]]]);
+
+            for (int c = 0; c < 4; c++)
+            {
+                out[j * 4 + c] = (pix1[c] + pix2[c] + pix3[c] + pix4[c]) >> 2;
+            }
+        }
+    }
+}
+
+// Level 0 of every miptex lump with its palette
+static std::vector<tIndexedTexture> LoadWadTextures(
+    const std::string &filename)
+{
+    std::vector<tIndexedTexture> textures;
+
+    std::ifstream file(filename, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (data.size() < sizeof(hl1::tWADHeader))
+    {
+        return textures;
+    }
+
+    // Lumps are not always 4 byte aligned, the headers are copied out
+    hl1::tWADHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    if (std::string(header.signature, 4) != HL1_WAD_SIGNATURE || header.lumpsCount < 0 || header.lumpsOffset < 0 ||
+        size_t(header.lumpsOffset) + size_t(header.lumpsCount) * sizeof(hl1::tWADLump) > data.size())
+    {
+        return textures;
+    }
+
+    for (int l = 0; l < header.lumpsCount; l++)
+    {
+        hl1::tWADLump lump;
+        std::memcpy(&lump, data.data() + header.lumpsOffset + size_t(l) * sizeof(lump), sizeof(lump));
+
+        if (lump.type != 0x43 || lump.compression != 0 || lump.offset < 0 || lump.size < int(sizeof(hl1::tBSPMipTexHeader)) ||
+            size_t(lump.offset) + size_t(lump.size) > data.size())
+        {
+            continue;
+        }
+
+        auto lumpData = data.data() + lump.offset;
+
+        hl1::tBSPMipTexHeader miptex;
+        std::memcpy(&miptex, lumpData, sizeof(miptex));
+
+        if (miptex.width == 0 || miptex.height == 0 || miptex.width > 4096 || miptex.height > 4096)
+        {
+            continue;
+        }
+
+        size_t s = size_t(miptex.width) * size_t(miptex.height);
+        size_t paletteOffset = size_t(miptex.offsets[0]) + s + (s / 4) + (s / 16) + (s / 64) + sizeof(short);
+
+        if (size_t(miptex.offsets[0]) + s > size_t(lump.size) || paletteOffset + 256 * 3 > size_t(lump.size))
+        {
+            continue;
+        }
+
+        tIndexedTexture texture;
+        texture.name = std::string(miptex.name, strnlen(miptex.name, sizeof(miptex.name)));
+        texture.width = int(miptex.width);
+        texture.height = int(miptex.height);
+        texture.indices.assign(lumpData + miptex.offsets[0], lumpData + miptex.offsets[0] + s);
+        texture.palette.assign(lumpData + paletteOffset, lumpData + paletteOffset + 256 * 3);
+
+        textures.push_back(std::move(texture));
+    }
+
+    return textures;
+}
+
+// Runs of a few neighbouring indices like the dithered wad textures, in the sizes
+// they come in
+static std::vector<tIndexedTexture> GenerateTextures(
+    unsigned int seed)
+{
+    const int sizes[][2] = {{16, 16}, {32, 64}, {64, 64}, {128, 128}, {256, 128}, {256, 256}};
+
+    std::mt19937 random(seed);
+    std::vector<tIndexedTexture> textures;
+
+    for (auto &size : sizes)
+    {
+        tIndexedTexture texture;
+        texture.name = std::format("generated {}x{}", size[0], size[1]);
+        texture.width = size[0];
+        texture.height = size[1];
+        texture.palette.resize(256 * 3);
+
+        for (auto &c : texture.palette)
+        {
+            c = (unsigned char)(random() & 255);
+        }
+
+        unsigned char index = 0;
+
+        for (int i = 0; i < size[0] * size[1]; i++)
+        {
+            if (random() % 4 == 0)
+            {
+                index = (unsigned char)(index + random() % 9 - 4);
+            }
+
+            texture.indices.push_back(index);
+        }
+
+        textures.push_back(std::move(texture));
+    }
+
+    return textures;
+}
+
+// The power of two size, at most 256, the studio model loader resamples to
+static int ResampledSize(
+    int size)
+{
+    int out = 1;
+
+    while (out < size && out < 256)
+    {
+        out <<= 1;
+    }
+
+    return out;
+}
+
+template <class Run>
+static double Time(
+    size_t texels,
+    Run run)
+{
+    auto passes = std::max(MinTexels / std::max(texels, size_t(1)), size_t(1));
+    double best = 1e30;
+
+    for (int repeat = 0; repeat < Repeats; repeat++)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t pass = 0; pass < passes; pass++)
+        {
+            run();
+        }
+
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        best = std::min(best, elapsed / double(passes * texels));
+    }
+
+    return best;
+}
+
+static bool Run(
+    const std::string &name,
+    const std::vector<tIndexedTexture> &textures)
+{
+    size_t texels = 0;
+    size_t resampledTexels = 0;
+
+    for (auto &texture : textures)
+    {
+        texels += texture.indices.size();
+        resampledTexels += size_t(ResampledSize(texture.width)) * size_t(ResampledSize(texture.height));
+    }
+
+    std::vector<unsigned char> rgba(texels * 4);
+    std::vector<unsigned char> reference(texels * 4);
+    std::vector<unsigned char> resampled(resampledTexels * 4);
+    std::vector<unsigned char> resampledReference(resampledTexels * 4);
+
+    auto expand = [&](auto kernel, std::vector<unsigned char> &out) {
+        size_t offset = 0;
+
+        for (auto &texture : textures)
+        {
+            // The '{' textures key out index 255 the way the bsp loader does
+            kernel(texture.indices.data(), texture.indices.size(), texture.palette.data(), out.data() + offset * 4, texture.name[0] == '{' ? 255 : -1);
+            offset += texture.indices.size();
+        }
+    };
+
+    auto resample = [&](auto kernel, std::vector<unsigned char> &out) {
+        size_t offset = 0;
+
+        for (auto &texture : textures)
+        {
+            auto width = ResampledSize(texture.width);
+            auto height = ResampledSize(texture.height);
+
+            kernel(texture.indices.data(), texture.width, texture.height, texture.palette.data(), out.data() + offset * 4, width, height);
+            offset += size_t(width) * size_t(height);
+        }
+    };
+
+    auto expandPalette = [](const unsigned char *indices, size_t count, const unsigned char *palette, unsigned char *out, int transparentIndex) {
+        ExpandPalette(indices, count, palette, out, transparentIndex);
+    };
+
+    expand(ExpandPaletteReference, reference);
+    expand(expandPalette, rgba);
+    resample(ResamplePaletteReference, resampledReference);
+    resample(ResamplePalette, resampled);
+
+    auto success = true;
+
+    if (rgba != reference || resampled != resampledReference)
+    {
+        std::println("[ERR] {}: the kernels give other texels than the reference", name);
+
+        success = false;
+    }
+
+    auto expandReferenceTime = Time(texels, [&]() { expand(ExpandPaletteReference, reference); });
+    auto expandTime = Time(texels, [&]() { expand(expandPalette, rgba); });
+    auto resampleReferenceTime = Time(resampledTexels, [&]() { resample(ResamplePaletteReference, resampledReference); });
+    auto resampleTime = Time(resampledTexels, [&]() { resample(ResamplePalette, resampled); });
+
+    std::println("[INF] {} ({} textures, {} texels): ExpandPalette {:.2f} ns per texel, reference {:.2f} ns (x{:.2f})",
+                 name, textures.size(), texels, expandTime, expandReferenceTime, expandReferenceTime / expandTime);
+
+    std::println("[INF] {} ({} textures, {} texels): ResamplePalette {:.2f} ns per texel, reference {:.2f} ns (x{:.2f})",
+                 name, textures.size(), resampledTexels, resampleTime, resampleReferenceTime, resampleReferenceTime / resampleTime);
+
+    return success;
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    auto success = Run("generated", GenerateTextures(5));
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto textures = LoadWadTextures(argv[i]);
+
+        if (textures.empty())
+        {
+            std::println("[ERR] no miptex found in {}", argv[i]);
+
+            return 1;
+        }
+
+        success = Run(argv[i], textures) && success;
+    }
+
+    return success ? 0 : 1;
+}
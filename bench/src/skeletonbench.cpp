@@ -0,0 +1,424 @@
+#include <valve/hl1filesystem.h>
+#include <valve/mdl/hl1mdlinstance.h>
+#include <valve/mdl/hl1mdlpose.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
+#include <print>
+#include <span>
+#include <string>
+#include <vector>
+
+using namespace valve::hl1;
+
+// Times BuildSkeleton() against BuildSkeletonReference(), the one bone at a time glm
+// path it replaced, and checks that both give the same bones, from the compressed runs
+// and from the decoded tracks alike. Runs on a generated skeleton, and on every
+// sequence of the models given, the stock ones for example:
+//
+//   skeletonbench [path/to/scientist.mdl path/to/barney.mdl ...]
+
+const int Repeats = 5;
+const size_t PoseCount = 2048;
+
+// The most a bone may differ between the two paths, the nlerp correction in the pose
+// kernels is within a thousandth of a radian of glm::slerp per blend
+const float MaxDifference = 5e-3f;
+
+// The compressed runs and the decoded tracks must give the same bones, up to the order
+// the positions are scaled and interpolated in
+const float MaxTrackDifference = 1e-5f;
+
+// A skeleton of chains hanging off a root bone, about the size of the HL1 characters,
+// with a sequence for each of the 1, 2 and 4 blend cases
+class GeneratedModel
+{
+public:
+    explicit GeneratedModel(
+        int boneCount)
+        : _asset(nullptr)
+    {
+        const int blendCounts[] = {1, 2, 4};
+
+        _data.resize(sizeof(tMDLHeader));
+
+        for (int b = 0; b < boneCount; b++)
+        {
+            tMDLBone bone = {};
+
+            std::snprintf(bone.name, sizeof(bone.name), "Bone%02d", b);
+            bone.parent = b == 0 ? -1 : (b % ChainLength == 1 ? 0 : b - 1);
+
+            for (int j = 0; j < 6; j++)
+            {
+                bone.bonecontroller[j] = -1;
+                bone.value[j] = j < 3 ? float((b * 7 + j * 3) % 11) : 0.1f * float((b + j) % 7);
+                bone.scale[j] = j < 3 ? 0.01f : 0.0005f;
+            }
+
+            _asset._boneData.push_back(bone);
+        }
+
+        for (auto blends : blendCounts)
+        {
+            tMDLSequenceDescription sequence = {};
+
+            std::snprintf(sequence.label, sizeof(sequence.label), "blend%d", blends);
+            sequence.fps = 30.0f;
+            sequence.numframes = FrameCount;
+            sequence.numblends = blends;
+            sequence.animindex = int(_data.size());
+
+            AddAnimations(boneCount, blends);
+
+            _asset._sequenceData.push_back(sequence);
+        }
+
+        _asset._sequenceGroupData.push_back(tMDLSequenceGroup{});
+        _asset._header = reinterpret_cast<tMDLHeader *>(_data.data());
+    }
+
+    MdlAsset &Asset() { return _asset; }
+
+private:
+    static const int ChainLength = 6;
+    static const int FrameCount = 20;
+
+    MdlAsset _asset;
+    std::vector<valve::byte> _data;
+
+    // The tMDLAnimation of every bone of every blend and then their runs, which have
+    // to stay within the 16 bit offsets. Every other channel is split in runs that
+    // repeat their last value or end on it, the cases where the compressed runs and the
+    // decoded tracks could part.
+    void AddAnimations(
+        int boneCount,
+        int blends)
+    {
+        const int split[][2] = {{5, 8}, {4, 4}, {2, 3}, {5, 5}}; // valid and total frames
+        const int whole[][2] = {{FrameCount, FrameCount}};
+
+        auto first = _data.size();
+        auto animationCount = size_t(blends) * size_t(boneCount);
+        auto valuesSize = size_t(FrameCount + 1) * sizeof(tMDLAnimationValue);
+
+        _data.resize(first + animationCount * (sizeof(tMDLAnimation) + 6 * valuesSize));
+
+        for (size_t a = 0; a < animationCount; a++)
+        {
+            auto blend = int(a) / boneCount;
+            auto b = int(a) % boneCount;
+            auto animationOffset = first + a * sizeof(tMDLAnimation);
+            tMDLAnimation animation = {};
+
+            for (int j = 0; j < 6; j++)
+            {
+                auto valuesOffset = first + animationCount * sizeof(tMDLAnimation) + (a * 6 + size_t(j)) * valuesSize;
+                animation.offset[j] = (unsigned short)(valuesOffset - animationOffset);
+
+                auto runs = (b + j) % 2 ? std::span<const int[2]>(split) : std::span<const int[2]>(whole);
+
+                tMDLAnimationValue values[FrameCount + 1] = {};
+                int frame = 0;
+                int value = 0;
+
+                for (auto &run : runs)
+                {
+                    values[value].num.valid = (unsigned char)run[0];
+                    values[value].num.total = (unsigned char)run[1];
+
+                    // The blends are the same motion turned further, like aiming up or down.
+                    // Blends half a turn apart would make both paths flip at random.
+                    for (int f = 0; f < run[0]; f++)
+                    {
+                        values[value + 1 + f].value = short(std::lround(800.0 * std::sin(0.3 * (frame + f) + 0.7 * b + 1.3 * j) + 300.0 * blend));
+                    }
+
+                    frame += run[1];
+                    value += run[0] + 1;
+                }
+
+                std::memcpy(_data.data() + valuesOffset, values, valuesSize);
+            }
+
+            std::memcpy(_data.data() + animationOffset, &animation, sizeof(animation));
+        }
+    }
+};
+
+// The same pose as BuildSkeleton(), blended with glm::slerp and built one bone at a time
+// the way it was before the pose kernels
+static void BuildSkeletonReference(
+    const MdlAsset *asset,
+    const tMDLPoseParams &pose,
+    std::span<glm::mat4> bones)
+{
+    tMDLBonePose local[4][MAX_MDL_BONES];
+
+    std::fill(bones.begin(), bones.end(), glm::mat4(1.0f));
+
+    auto boneCount = asset != nullptr ? std::min({asset->_boneData.size(), bones.size(), size_t(MAX_MDL_BONES)}) : 0;
+    auto blends = SamplePoseBlends(asset, pose, boneCount, local);
+
+    if (blends == 0)
+    {
+        return;
+    }
+
+    auto slerpBones = [boneCount](tMDLBonePose a[], const tMDLBonePose b[], float s) {
+        s = std::clamp(s, 0.0f, 1.0f);
+
+        for (size_t i = 0; i < boneCount; i++)
+        {
+            a[i].rotation = glm::slerp(a[i].rotation, b[i].rotation, s);
+            a[i].position = a[i].position * (1.0f - s) + b[i].position * s;
+        }
+    };
+
+    if (blends > 1)
+    {
+        slerpBones(local[0], local[1], pose.blending[0] / 255.0f);
+    }
+
+    if (blends == 4)
+    {
+        slerpBones(local[2], local[3], pose.blending[0] / 255.0f);
+        slerpBones(local[0], local[2], pose.blending[1] / 255.0f);
+    }
+
+    for (size_t i = 0; i < boneCount; i++)
+    {
+        glm::mat4 m = glm::translate(glm::mat4(1.0f), local[0][i].position) * glm::toMat4(local[0][i].rotation);
+        auto parent = asset->_boneData[i].parent;
+
+        bones[i] = parent < 0 || size_t(parent) >= i ? m : bones[parent] * m;
+    }
+}
+
+// The largest difference of a rotation element, or of a translation relative to the
+// size of the skeleton, as a rotation error grows with the length of the bones below it
+static float Difference(
+    std::span<const glm::mat4> a,
+    std::span<const glm::mat4> b)
+{
+    float extent = 1.0f;
+
+    for (auto &bone : b)
+    {
+        extent = std::max(extent, glm::length(glm::vec3(bone[3])));
+    }
+
+    float difference = 0.0f;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            for (int r = 0; r < 3; r++)
+            {
+                difference = std::max(difference, std::fabs(a[i][c][r] - b[i][c][r]) / (c == 3 ? extent : 1.0f));
+            }
+        }
+    }
+
+    return difference;
+}
+
+// Poses over every frame of the sequences with this many blends, with the blending
+// sweeping its range
+static std::vector<tMDLPoseParams> Poses(
+    const MdlAsset &asset,
+    int blends)
+{
+    std::vector<tMDLPoseParams> poses;
+
+    for (size_t s = 0; s < asset._sequenceData.size(); s++)
+    {
+        auto numblends = asset._sequenceData[s].numblends;
+
+        if ((numblends == 4 ? 4 : (numblends > 1 ? 2 : 1)) != blends)
+        {
+            continue;
+        }
+
+        auto frames = std::max(asset._sequenceData[s].numframes, 1);
+
+        for (float frame = 0.0f; frame < float(frames); frame += 0.37f)
+        {
+            tMDLPoseParams pose;
+            pose.sequence = s;
+            pose.frame = frame;
+            pose.blending[0] = short(poses.size() * 37 % 256);
+            pose.blending[1] = short(poses.size() * 91 % 256);
+
+            poses.push_back(pose);
+        }
+    }
+
+    return poses;
+}
+
+// The largest difference between the bones built from the compressed runs and from the
+// decoded tracks, which only round differently
+static float TrackDifference(
+    MdlAsset &asset,
+    const std::vector<tMDLPoseParams> &poses)
+{
+    std::vector<glm::mat4> compressed(asset._boneData.size() * poses.size());
+    std::vector<glm::mat4> decoded(asset._boneData.size());
+
+    asset.ClearAnimationTracks();
+
+    for (size_t p = 0; p < poses.size(); p++)
+    {
+        BuildSkeleton(&asset, poses[p], decoded);
+
+        std::copy(decoded.begin(), decoded.end(), compressed.begin() + p * decoded.size());
+    }
+
+    asset.DecodeAnimationTracks();
+
+    float difference = 0.0f;
+
+    for (size_t p = 0; p < poses.size(); p++)
+    {
+        BuildSkeleton(&asset, poses[p], decoded);
+
+        difference = std::max(difference, Difference(std::span(compressed).subspan(p * decoded.size(), decoded.size()), decoded));
+    }
+
+    return difference;
+}
+
+template <class Build>
+static double Time(
+    const MdlAsset &asset,
+    const std::vector<tMDLPoseParams> &poses,
+    std::vector<glm::mat4> &bones,
+    Build build)
+{
+    double best = 1e30;
+
+    for (int repeat = 0; repeat < Repeats; repeat++)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t p = 0; p < PoseCount; p++)
+        {
+            build(&asset, poses[p % poses.size()], bones);
+        }
+
+        auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        best = std::min(best, elapsed / double(PoseCount));
+    }
+
+    return best;
+}
+
+static bool Run(
+    const std::string &name,
+    MdlAsset &asset)
+{
+    const int blendCases[] = {1, 2, 4};
+
+    auto success = true;
+    std::vector<glm::mat4> bones(asset._boneData.size());
+    std::vector<glm::mat4> reference(asset._boneData.size());
+
+    for (int decoded = 0; decoded < 2; decoded++)
+    {
+        if (decoded)
+        {
+            asset.DecodeAnimationTracks();
+        }
+        else
+        {
+            asset.ClearAnimationTracks();
+        }
+
+        for (auto blends : blendCases)
+        {
+            auto poses = Poses(asset, blends);
+
+            if (poses.empty())
+            {
+                continue;
+            }
+
+            float difference = 0.0f;
+
+            for (auto &pose : poses)
+            {
+                BuildSkeleton(&asset, pose, bones);
+                BuildSkeletonReference(&asset, pose, reference);
+
+                difference = std::max(difference, Difference(bones, reference));
+            }
+
+            auto referenceTime = Time(asset, poses, reference, [](const MdlAsset *a, const tMDLPoseParams &p, std::vector<glm::mat4> &b) {
+                BuildSkeletonReference(a, p, b);
+            });
+
+            auto kernelTime = Time(asset, poses, bones, [](const MdlAsset *a, const tMDLPoseParams &p, std::vector<glm::mat4> &b) {
+                BuildSkeleton(a, p, b);
+            });
+
+            std::println("[INF] {} ({} bones, {} blends, {}): reference {:.2f} us, BuildSkeleton {:.2f} us per pose (x{:.2f}), difference {:.1e}",
+                         name, asset._boneData.size(), blends, decoded ? "decoded tracks" : "compressed",
+                         referenceTime, kernelTime, referenceTime / kernelTime, difference);
+
+            if (difference > MaxDifference)
+            {
+                std::println("[ERR] {} poses differ by {:.1e}, more than {:.1e}", name, difference, MaxDifference);
+
+                success = false;
+            }
+        }
+    }
+
+    for (auto blends : blendCases)
+    {
+        auto difference = TrackDifference(asset, Poses(asset, blends));
+
+        if (difference > MaxTrackDifference)
+        {
+            std::println("[ERR] {} ({} blends): the compressed runs and the decoded tracks differ by {:.1e}", name, blends, difference);
+
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    GeneratedModel generated(52);
+
+    auto success = Run("generated", generated.Asset());
+
+    for (int i = 1; i < argc; i++)
+    {
+        FileSystem fs;
+        fs.FindRootFromFilePath(argv[i]);
+
+        MdlAsset asset(&fs);
+
+        if (!asset.Load(argv[i]))
+        {
+            std::println("[ERR] failed to load {}", argv[i]);
+
+            return 1;
+        }
+
+        success = Run(argv[i], asset) && success;
+    }
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,300 @@
+#include <valve/bsp/hl1bspasset.h>
+#include <valve/hl1filesystem.h>
+
+#include <chrono>
+#include <cstring>
+#include <print>
+#include <random>
+#include <vector>
+
+using namespace valve::hl1;
+
+// Times BspCollisionModel::TraceBatch() against the same traces done one at a time
+// with Trace(), and checks that both give the same results. Runs on a generated
+// hull, and on the hulls of a map when one is given:
+//
+//   tracebench [path/to/map.bsp]
+//
+// Only AVX builds (CONSTRUCT_AVX2) walk packets, others time two plain loops.
+
+const int Repeats = 5;
+const size_t RayCount = 1 << 16;
+
+// A random kd-tree of mostly axial planes, about as deep as the clip hulls of a map
+class GeneratedHull
+{
+public:
+    explicit GeneratedHull(
+        unsigned int seed)
+        : _random(seed)
+    {
+        Build(0, glm::vec3(-Extent), glm::vec3(Extent));
+
+        tBSPModel model = {};
+        model.mins = glm::vec3(-Extent);
+        model.maxs = glm::vec3(Extent);
+        model.headnode[1] = 0;
+        _models.push_back(model);
+
+        _collision.Attach(_planes, {}, {}, _clipNodes, _models);
+    }
+
+    const BspCollisionModel &Collision() const { return _collision; }
+    const tBSPModel &World() const { return _models[0]; }
+
+private:
+    static constexpr float Extent = 2048.0f;
+    static constexpr int MaxDepth = 14;
+
+    std::mt19937 _random;
+    std::vector<tBSPPlane> _planes;
+    std::vector<tBSPClipNode> _clipNodes;
+    std::vector<tBSPModel> _models;
+    BspCollisionModel _collision;
+
+    float Random(
+        float from,
+        float to)
+    {
+        return std::uniform_real_distribution<float>(from, to)(_random);
+    }
+
+    short Build(
+        int depth,
+        glm::vec3 mins,
+        glm::vec3 maxs)
+    {
+        if (depth == MaxDepth || (depth > 4 && Random(0.0f, 1.0f) < 0.12f))
+        {
+            auto r = Random(0.0f, 1.0f);
+
+            return short(r < 0.3f ? CONTENTS_SOLID : (r < 0.35f ? CONTENTS_WATER : CONTENTS_EMPTY));
+        }
+
+        tBSPPlane plane = {};
+
+        if (Random(0.0f, 1.0f) < 0.8f)
+        {
+            auto axis = int(Random(0.0f, 3.0f)) % 3;
+            auto size = maxs[axis] - mins[axis];
+
+            plane.type = axis;
+            plane.normal[axis] = 1.0f;
+            plane.distance = Random(mins[axis] + size * 0.2f, maxs[axis] - size * 0.2f);
+        }
+        else
+        {
+            plane.type = 3;
+            plane.normal = glm::normalize(glm::vec3(Random(-1.0f, 1.0f), Random(-1.0f, 1.0f), Random(-1.0f, 1.0f)));
+            plane.distance = glm::dot(plane.normal, (mins + maxs) * 0.5f);
+        }
+
+        auto index = int(_clipNodes.size());
+
+        _clipNodes.push_back({int(_planes.size()), {0, 0}});
+        _planes.push_back(plane);
+
+        auto frontMins = mins;
+        auto backMaxs = maxs;
+
+        if (plane.type < 3)
+        {
+            frontMins[plane.type] = plane.distance;
+            backMaxs[plane.type] = plane.distance;
+        }
+
+        auto front = Build(depth + 1, frontMins, maxs);
+        auto back = Build(depth + 1, mins, backMaxs);
+
+        _clipNodes[index].children[0] = front;
+        _clipNodes[index].children[1] = back;
+
+        return short(index);
+    }
+};
+
+typedef struct sRaySet
+{
+    const char *name;
+    std::vector<glm::vec3> starts;
+    std::vector<glm::vec3> ends;
+
+} tRaySet;
+
+// Bundles of rays that share an origin like a shotgun blast, fans from one point
+// like line of sight checks, short moves like players and projectiles make, and
+// long rays between random points
+static std::vector<tRaySet> GenerateRays(
+    const tBSPModel &world,
+    unsigned int seed)
+{
+    std::mt19937 random(seed);
+
+    auto point = [&]() {
+        return glm::vec3(
+            std::uniform_real_distribution<float>(world.mins.x, world.maxs.x)(random),
+            std::uniform_real_distribution<float>(world.mins.y, world.maxs.y)(random),
+            std::uniform_real_distribution<float>(world.mins.z, world.maxs.z)(random));
+    };
+
+    auto direction = [&](float spread) {
+        std::uniform_real_distribution<float> d(-spread, spread);
+
+        return glm::normalize(glm::vec3(d(random), d(random), d(random)));
+    };
+
+    std::vector<tRaySet> sets(4);
+
+    sets[0].name = "bundles of 8, 2 degrees apart";
+    sets[1].name = "fans of 8 to random points";
+    sets[2].name = "short moves of 16 units";
+    sets[3].name = "random long rays";
+
+    for (size_t i = 0; i < RayCount; i += 8)
+    {
+        auto origin = point();
+        auto forward = direction(1.0f);
+
+        for (int r = 0; r < 8; r++)
+        {
+            sets[0].starts.push_back(origin);
+            sets[0].ends.push_back(origin + glm::normalize(forward + direction(1.0f) * 0.035f) * 1024.0f);
+        }
+    }
+
+    for (size_t i = 0; i < RayCount; i += 8)
+    {
+        auto origin = point();
+
+        for (int r = 0; r < 8; r++)
+        {
+            sets[1].starts.push_back(origin);
+            sets[1].ends.push_back(point());
+        }
+    }
+
+    for (size_t i = 0; i < RayCount; i++)
+    {
+        auto origin = point();
+
+        sets[2].starts.push_back(origin);
+        sets[2].ends.push_back(origin + direction(1.0f) * 16.0f);
+
+        sets[3].starts.push_back(point());
+        sets[3].ends.push_back(point());
+    }
+
+    return sets;
+}
+
+static bool SameTrace(
+    const BspCollisionModel::tTraceResult &a,
+    const BspCollisionModel::tTraceResult &b)
+{
+    return a.allSolid == b.allSolid &&
+           a.startSolid == b.startSolid &&
+           memcmp(&a.fraction, &b.fraction, sizeof(float)) == 0 &&
+           a.endPosition == b.endPosition &&
+           a.planeNormal == b.planeNormal &&
+           a.planeDistance == b.planeDistance &&
+           a.contents == b.contents;
+}
+
+static bool Run(
+    const char *name,
+    const BspCollisionModel &collision,
+    const tBSPModel &world,
+    int hull)
+{
+    auto success = true;
+
+    for (auto &set : GenerateRays(world, 1234))
+    {
+        std::vector<BspCollisionModel::tTraceResult> single(set.starts.size());
+        std::vector<BspCollisionModel::tTraceResult> batch(set.starts.size());
+
+        auto bestSingle = std::chrono::nanoseconds::max();
+        auto bestBatch = std::chrono::nanoseconds::max();
+
+        for (int r = 0; r < Repeats; r++)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            for (size_t i = 0; i < set.starts.size(); i++)
+            {
+                single[i] = collision.Trace(set.starts[i], set.ends[i], hull);
+            }
+
+            auto middle = std::chrono::steady_clock::now();
+
+            collision.TraceBatch(set.starts, set.ends, batch, hull);
+
+            auto end = std::chrono::steady_clock::now();
+
+            bestSingle = std::min(bestSingle, std::chrono::duration_cast<std::chrono::nanoseconds>(middle - start));
+            bestBatch = std::min(bestBatch, std::chrono::duration_cast<std::chrono::nanoseconds>(end - middle));
+        }
+
+        size_t mismatches = 0;
+
+        for (size_t i = 0; i < single.size(); i++)
+        {
+            if (!SameTrace(single[i], batch[i]))
+            {
+                mismatches++;
+            }
+        }
+
+        auto perSingle = double(bestSingle.count()) / double(set.starts.size());
+        auto perBatch = double(bestBatch.count()) / double(set.starts.size());
+
+        std::println(
+            "[INF] {} hull {}, {}: Trace {:.1f} ns, TraceBatch {:.1f} ns, x{:.2f}",
+            name,
+            hull,
+            set.name,
+            perSingle,
+            perBatch,
+            perSingle / perBatch);
+
+        if (mismatches > 0)
+        {
+            std::println("[ERR] {} of {} batched traces differ from Trace()", mismatches, single.size());
+
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    GeneratedHull generated(7);
+
+    auto success = Run("generated", generated.Collision(), generated.World(), 1);
+
+    if (argc > 1)
+    {
+        FileSystem fs;
+        fs.FindRootFromFilePath(argv[1]);
+
+        BspAsset asset(&fs);
+
+        if (!asset.Load(argv[1]))
+        {
+            std::println("[ERR] failed to load {}", argv[1]);
+
+            return 1;
+        }
+
+        for (int hull = 0; hull < 4; hull++)
+        {
+            success = Run(argv[1], asset._collision, asset._bspFile->_modelData[0], hull) && success;
+        }
+    }
+
+    return success ? 0 : 1;
+}
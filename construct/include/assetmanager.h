@@ -4,6 +4,7 @@
 #include <iassetmanager.hpp>
 #include <map>
 #include <string>
+#include <valve/bsp/hl1wadlibrary.h>
 
 class AssetManager : public IAssetManager
 {
@@ -19,8 +20,13 @@ public:
     valve::Asset *GetAsset(
         long id);
 
+    void SetTextureCompression(
+        bool compressTextures);
+
 private:
     std::map<std::string, std::unique_ptr<valve::Asset>> _loadedAssets;
+    valve::hl1::WadLibrary _wadLibrary; // shared by every bsp so the wads stay open between maps
+    bool _compressTextures = true;
 };
 
 #endif // ASSETMANAGER_H
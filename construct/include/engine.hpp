@@ -3,15 +3,20 @@
 
 #include "camera.h"
 #include "entitycomponents.h"
+#include "frustum.h"
 
 #include <entt/entt.hpp>
+#include <future>
 #include <glbuffer.h>
 #include <iassetmanager.hpp>
 #include <inputstate.h>
 #include <iphysicsservice.hpp>
 #include <irenderer.hpp>
+#include <unordered_map>
 #include <valve/bsp/hl1bspasset.h>
+#include <valve/bsp/hl1bsplightgrid.h>
 #include <valve/mdl/hl1mdlasset.h>
+#include <valve/mdl/hl1mdlinstance.h>
 #include <valve/spr/hl1sprasset.h>
 
 enum SkyTextures
@@ -25,6 +30,52 @@ enum SkyTextures
     Count,
 };
 
+struct CullingStats
+{
+    int VisitedNodes = 0;
+    int CulledNodes = 0;
+    int VisitedLeafs = 0;
+    int CulledLeafs = 0;
+    int VisitedEntities = 0;
+    int CulledEntities = 0;
+};
+
+const int AnimationLodCount = 4;
+
+// What the posing of the studio models did in the last rendered frame
+struct AnimationStats
+{
+    int PosedModels = 0;                   // studio models in view
+    int CulledModels = 0;                  // out of view, only their frame moved on
+    int LodModels[AnimationLodCount] = {}; // the models in view by LOD
+    int PoseCacheHits = 0;                 // models that got the pose of an earlier one in the same state
+    int PoseCacheMisses = 0;               // skeletons built
+    int DeferredPoses = 0;                 // reduced rate poses the budget moved to a later frame
+    int BlendedPoses = 0;                  // reduced rate models blended between their last two poses, about a skeleton build each
+    int PoseBudget = 0;                    // see Engine::SetAnimationBudget()
+};
+
+enum class LoadStages
+{
+    Idle,
+    Decoding,  // the asset is read and decoded on a worker
+    Lightmaps, // one lightmap page per step
+    Textures,  // one texture per step
+    WorldMesh,
+    Entities, // one entity per step
+    Finishing,
+    Done,
+    Failed,
+};
+
+struct LoadProgress
+{
+    LoadStages Stage = LoadStages::Idle;
+    size_t Done = 0; // steps taken in this stage
+    size_t Total = 0;
+    float Fraction = 0.0f; // of the whole load
+};
+
 class Engine
 {
 public:
@@ -38,9 +89,24 @@ public:
     void SetProjectionMatrix(
         const glm::mat4 &projectionMatrix);
 
+    // Loads asset in one go, the same as BeginLoad() and ContinueLoad() without a budget
     bool Load(
         const std::string &asset);
 
+    // Starts loading asset in stages. Call ContinueLoad() every frame until it returns
+    // false, Update() keeps running meanwhile and Render() draws nothing.
+    bool BeginLoad(
+        const std::string &asset);
+
+    // Does load work on this thread for about budget, at least one step. True while
+    // the load is not done yet.
+    bool ContinueLoad(
+        std::chrono::microseconds budget);
+
+    bool IsLoading() const;
+
+    const LoadProgress &GetLoadProgress() const;
+
     void Update(
         std::chrono::microseconds time,
         const struct InputState &inputState);
@@ -48,6 +114,45 @@ public:
     bool Render(
         std::chrono::microseconds time);
 
+    // Both are on by default, with both off every face and entity is drawn
+    void SetCulling(
+        bool usePvs,
+        bool useFrustum);
+
+    // What the culling of the last rendered frame did
+    const CullingStats &GetCullingStats() const;
+
+    const AnimationStats &GetAnimationStats() const;
+
+    // The most bytes the world textures may take on the GPU, 0 is no limit. When they
+    // do not fit, the largest mip levels are left out. Used by the next Load().
+    void SetTextureBudget(
+        size_t bytes);
+
+    // On by default, textures with blocks go to the GPU compressed when the renderer
+    // supports it. Used by the next Load().
+    void SetTextureCompression(
+        bool useCompression);
+
+    // Studio models further than distance from the camera are posed every 2nd frame,
+    // each doubling of the distance halves the rate again down to every 8th frame.
+    // 0 poses every model in view every frame.
+    void SetAnimationLodDistance(
+        float distance);
+
+    // The most skeletons built per frame for models past LOD 0, the ones over it keep
+    // their last pose a while longer. Models at LOD 0 are always posed. 0 is no limit.
+    // The blend every model past LOD 0 gets each frame is not limited, it shows up in
+    // AnimationStats::BlendedPoses.
+    void SetAnimationBudget(
+        int poses);
+
+    // The most bytes the decoded animation tracks of one studio model may take, models
+    // that need more sample the compressed animation. 0 turns decoding off. Used by
+    // the next Load().
+    void SetAnimationTrackBudget(
+        size_t bytes);
+
 private:
     IRenderer *_renderer;
     IPhysicsService *_physicsService;
@@ -63,23 +168,152 @@ private:
     // Render data
     BufferType _vertexBuffer;
     std::unique_ptr<IShader> _defaultShader;
-    std::vector<valve::tFace> _faces;
+    int _firstWorldIndex = 0; // where the bsp mesh starts in the index buffer
+    std::vector<int> _batchFirstIndices;
+    std::vector<int> _batchIndexCounts;
     std::vector<unsigned int> _textureIndices;
     std::vector<unsigned int> _lightmapIndices;
     int _firstSkyVertex = 0;
     unsigned int _skyTextureIndices[6] = {0, 0, 0, 0, 0, 0};
     unsigned int _emptyWhiteTexture = 0;
+    size_t _textureBudget = 0;
+    bool _useTextureCompression = true;
+    size_t _animationTrackBudget = 8 * 1024 * 1024;
+    valve::hl1::BspLightGrid _lightGrid;
+    valve::hl1::BspLightStyles _lightStyles;
+    std::vector<valve::hl1::BspAsset::tLightmapRegion> _dirtyLightmaps;
+
+    // Visibility, a world face or entity is drawn when its frame matches _visFrame.
+    // Leafs and nodes in the PVS of the camera leaf are marked with _pvsFrame.
+    bool _usePvs = true;
+    bool _useFrustumCulling = true;
+    Frustum _frustum;
+    CullingStats _cullingStats;
+    int _viewLeaf = -1;
+    valve::hl1::BspCollisionModel::tPointCache _viewLeafCache;
+    int _pvsFrame = 0;
+    int _visFrame = 0;
+    std::vector<int> _faceVisFrames;
+    std::vector<int> _leafPvsFrames;
+    std::vector<int> _nodePvsFrames;
+    std::vector<int> _leafParents;
+    std::vector<int> _nodeParents;
+    std::vector<std::pair<int, int>> _nodeStack;
+
+    // Animation, the pose parameters of the studio models in view and the bones they
+    // are posed into, rebuilt every frame
+    struct StudioPose
+    {
+        const valve::hl1::MdlAsset *Asset;
+        valve::hl1::tMDLPoseParams Params;
+        size_t FirstBone; // into _studioBones
+    };
+
+    std::vector<StudioPose> _studioPoses;
+    std::vector<glm::mat4> _studioBones;
+
+    // Models in the same state share one pose, the frame is rounded down to a step so
+    // instances that are nearly in sync share it too
+    struct StudioPoseKey
+    {
+        const valve::hl1::MdlAsset *Asset;
+        size_t Sequence;
+        int FrameStep;
+        short Controller[4];
+        short Mouth;
+        short Blending[2];
+
+        bool operator==(
+            const StudioPoseKey &other) const = default;
+    };
+
+    struct StudioPoseKeyHash
+    {
+        size_t operator()(
+            const StudioPoseKey &key) const;
+    };
+
+    std::unordered_map<StudioPoseKey, size_t, StudioPoseKeyHash> _studioPoseCache; // to the first bone
+
+    // The models past LOD 0 in view, blended into their own range of _studioBones
+    // once the poses are built
+    struct StudioLodBlend
+    {
+        entt::entity Entity;
+        StudioLodComponent *Lod;
+        const valve::hl1::MdlAsset *Asset;
+        size_t BoneCount;
+        size_t FirstBone; // where the blend goes
+        size_t PosedBone; // the pose built this frame, or -1 when it keeps its last one
+    };
+
+    struct StudioLodUpdate
+    {
+        const valve::hl1::MdlAsset *Asset;
+        valve::hl1::tMDLPoseParams Params;
+        int FramesSincePose;
+        size_t Blend; // into _studioLodBlends
+    };
+
+    std::vector<StudioLodBlend> _studioLodBlends;
+    std::vector<StudioLodUpdate> _studioLodUpdates;
+    float _animationLodDistance = 512.0f;
+    int _animationBudget = 0;
+    AnimationStats _animationStats;
 
     // Game logic
     PhysicsComponent _character;
 
+    // Staged loading, the asset is only set above once it is completely set up
+    std::string _loadName;
+    std::future<valve::Asset *> _loadDecode;
+    valve::Asset *_loadAsset = nullptr;
+    LoadProgress _loadProgress;
+    int _loadMipSkip = 0;
+    valve::hl1::BspMesh::tCollisionMesh _loadCollision;
+
     // For Load()
-    bool SetupBsp(
-        valve::hl1::BspAsset *bspAsset);
+    void EnterLoadStage(
+        LoadStages stage,
+        size_t total);
+
+    void UpdateLoadProgress();
+
+    // Frees everything the last asset set up, the next one starts from nothing
+    void UnloadLevel();
+
+    bool LoadStep();
+
+    bool FinishLoad();
+
+    void SetupSprite(
+        valve::hl1::SprAsset *sprAsset);
+
+    void SetupStudio(
+        valve::hl1::MdlAsset *mdlAsset);
+
+    void SpawnCharacter();
+
+    void LoadWorldLightmap(
+        valve::hl1::BspAsset *bspAsset,
+        size_t index);
+
+    void LoadWorldTexture(
+        valve::hl1::BspAsset *bspAsset,
+        size_t index,
+        int mipSkip);
 
-    bool SetupEntities(
+    void SetupWorldMesh(
         valve::hl1::BspAsset *bspAsset);
 
+    void SetupEntity(
+        valve::hl1::BspAsset *bspAsset,
+        valve::hl1::tBSPEntity &bspEntity,
+        valve::hl1::BspMesh::tCollisionMesh &collision);
+
+    void FinishEntities(
+        valve::hl1::BspMesh::tCollisionMesh &collision);
+
     StudioComponent BuildStudioComponent(
         valve::hl1::MdlAsset *mdlAsset,
         float scale = 1.0f);
@@ -91,13 +325,31 @@ private:
     OriginComponent BuildOriginComponent(
         valve::hl1::tBSPEntity &bspEntity);
 
+    void SetupBoundsComponent(
+        const entt::entity &entity,
+        valve::hl1::BspAsset *bspAsset);
+
     void SetupSky(
         valve::hl1::BspAsset *bspAsset);
 
+    int TextureMipSkip(
+        valve::hl1::BspAsset *bspAsset) const;
+
+    bool UseCompressedTexture(
+        const valve::Texture *tex) const;
+
+    // Uploads the texture from mip level mipSkip on, compressed when possible
+    unsigned int UploadTexture(
+        valve::Texture *tex,
+        int mipSkip = 0);
+
+    void SetupLightStyles(
+        valve::hl1::BspAsset *bspAsset);
+
     void GrabTriangles(
         valve::hl1::BspAsset *bspAsset,
         int moddelIndex,
-        std::vector<glm::vec3> &triangles);
+        valve::hl1::BspMesh::tCollisionMesh &collision);
 
     // For Update()
     void HandleBspInput(
@@ -114,6 +366,22 @@ private:
 
     void RenderSky();
 
+    void AnimateLightStyles(
+        valve::hl1::BspAsset *bspAsset,
+        std::chrono::microseconds time);
+
+    void MarkVisibleFaces(
+        valve::hl1::BspAsset *bspAsset);
+
+    void MarkPvs(
+        valve::hl1::BspAsset *bspAsset);
+
+    void CullEntities();
+
+    // True when one of the leafs under the bounds is in the PVS of the camera leaf
+    bool InPvs(
+        const BoundsComponent &bounds) const;
+
     void RenderBsp(
         valve::hl1::BspAsset *bspAsset,
         std::chrono::microseconds time);
@@ -127,17 +395,41 @@ private:
         valve::hl1::BspAsset *bspAsset,
         RenderModes mode);
 
-    void RenderStudioModelsByRenderMode(
-        RenderModes mode,
+    void RenderModelBatch(
+        size_t texture,
+        unsigned int lightmap,
+        size_t &boundTexture,
+        unsigned int &boundLightmap);
+
+    // Advances and poses the studio models in view, before any of them is drawn
+    void PoseStudioModels(
         std::chrono::microseconds time);
 
+    int AnimationLod(
+        const entt::entity &entity);
+
+    // Looks the pose up in the cache of this frame, or queues a job for it when build
+    // is set. Returns the first bone of the pose, or -1 when it was not built.
+    size_t RequestPose(
+        const valve::hl1::MdlAsset *asset,
+        valve::hl1::tMDLPoseParams params,
+        bool build);
+
+    void RenderStudioModelsByRenderMode(
+        RenderModes mode);
+
     void RenderSpritesByRenderMode(
         RenderModes mode,
         std::chrono::microseconds time);
 
+    bool IsInView(
+        const entt::entity &entity);
+
+    // light scales the color of the render mode
     bool SetupRenderComponent(
         const entt::entity &entity,
-        RenderModes mode);
+        RenderModes mode,
+        const glm::vec3 &light = glm::vec3(1.0f));
 
     bool SetupOriginComponent(
         const entt::entity &entity,
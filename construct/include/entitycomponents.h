@@ -1,8 +1,11 @@
 #ifndef ENTITYCOMPONENTS_H
 #define ENTITYCOMPONENTS_H
 
+#include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 #include <string>
+#include <valve/mdl/hl1mdlinstance.h>
+#include <vector>
 
 struct BallComponent
 {
@@ -15,6 +18,15 @@ struct OriginComponent
     glm::vec3 Angles;
 };
 
+// World space bounds, set up with the entity and tested against the view each frame
+struct BoundsComponent
+{
+    glm::vec3 Mins;
+    glm::vec3 Maxs;
+    int VisibleFrame = 0;   // the last frame the bounds were in view
+    std::vector<int> Leafs; // the world leafs under the bounds, tested against the PVS
+};
+
 struct PlayerStartComponent
 {
     std::string className;
@@ -54,6 +66,18 @@ struct StudioComponent
     short Controller[4] = {0, 0, 0, 0}; // bone controllers
     short Blending[2] = {0, 0};         // animation blending
     short Mouth = 0;                    // mouth position
+    size_t FirstBone = 0;               // where the bones of this frame's pose start
+};
+
+// The animation LOD of a studio model. Past LOD 0 the model is posed every few frames
+// and drawn with a blend from the pose before the last one to the last one.
+struct StudioLodComponent
+{
+    int Lod = 0;
+    int FramesSincePose = 0;
+    bool HasPose = false;                           // Previous and Current hold poses of the asset
+    std::vector<valve::hl1::tMDLBonePose> Previous; // the local bones of the pose before the last one
+    std::vector<valve::hl1::tMDLBonePose> Current;  // the local bones of the last pose
 };
 
 enum RenderModes
@@ -0,0 +1,32 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// The six planes of a view frustum, with the normals pointing inwards.
+class Frustum
+{
+public:
+    static const int AllPlanes = 0x3F;
+
+    // Extracts the planes from a projection * view matrix
+    void Update(
+        const glm::mat4 &viewProjection);
+
+    // True when the box is completely outside one of the planes in planeMask. The
+    // planes the box is completely inside of are cleared from planeMask, so the
+    // children of a node only have to be tested against the planes its box crosses.
+    bool CullBox(
+        const glm::vec3 &mins,
+        const glm::vec3 &maxs,
+        int &planeMask) const;
+
+    bool CullBox(
+        const glm::vec3 &mins,
+        const glm::vec3 &maxs) const;
+
+private:
+    glm::vec4 _planes[6];
+};
+
+#endif // FRUSTUM_H
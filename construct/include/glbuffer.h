@@ -58,22 +58,34 @@ public:
     BufferType &bone(
         int bone);
 
+    // Indices are uploaded with the vertices and stay bound to the vertex array
+    BufferType &index(
+        unsigned int index);
+
+    int indexCount() const;
+
     bool upload();
 
     void bind();
 
     void unbind();
 
+    // Frees the GPU objects and drops all vertices and indices, for building a new buffer
     void cleanup();
 
 private:
     int _vertexCount = 0;
     std::vector<VertexType> _verts;
+    int _indexCount = 0;
+    std::vector<unsigned int> _indices;
     glm::vec4 _nextUvs;
     glm::vec3 _nextCol = glm::vec3(1.0f, 1.0f, 1.0f);
     int _nextBone = -1;
     unsigned int _vertexArrayId = 0;
     unsigned int _vertexBufferId = 0;
+    unsigned int _indexBufferId = 0;
+
+    void DeleteObjects();
 };
 
 #endif // GLBUFFER_H
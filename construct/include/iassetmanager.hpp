@@ -23,6 +23,10 @@ public:
     virtual valve::Asset *GetAsset(
         long id) = 0;
 
+    // Whether the world textures of the next bsp loaded get blocks, on by default
+    virtual void SetTextureCompression(
+        bool compressTextures) = 0;
+
     template <typename T>
     T *GetAsset(
         long id)
@@ -2,6 +2,7 @@
 #define IPHYSICSSERVICE_H
 
 #include <chrono>
+#include <cstdint>
 #include <entities.hpp>
 #include <glm/glm.hpp>
 #include <tuple>
@@ -16,8 +17,13 @@ public:
     virtual void Step(
         std::chrono::microseconds diff) = 0;
 
+    // Removes every body, the components handed out before are no longer valid
+    virtual void Clear() = 0;
+
+    // An indexed triangle mesh, three indices into vertices per triangle
     virtual PhysicsComponent AddStatic(
-        const std::vector<glm::vec3> &t) = 0;
+        const std::vector<glm::vec3> &vertices,
+        const std::vector<uint32_t> &indices) = 0;
 
     virtual PhysicsComponent AddCharacter(
         float mass,
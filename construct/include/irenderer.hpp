@@ -3,6 +3,7 @@
 
 #include <glm/glm.hpp>
 #include <memory>
+#include <span>
 #include <string>
 
 class IShader
@@ -33,6 +34,30 @@ public:
     virtual void UnbindBones() = 0;
 };
 
+// One level of a mip chain, the first level is the full size image
+struct TextureLevel
+{
+    int width;
+    int height;
+    const unsigned char *data;
+};
+
+// The block compressed texture formats, both are S3TC
+enum class CompressedFormats
+{
+    BC1, // DXT1, opaque
+    BC3, // DXT5, with alpha
+};
+
+// One level of a block compressed mip chain, size is in bytes
+struct CompressedTextureLevel
+{
+    int width;
+    int height;
+    size_t size;
+    const unsigned char *data;
+};
+
 class IRenderer
 {
 public:
@@ -49,6 +74,21 @@ public:
         bool repeat,
         unsigned char *data) = 0;
 
+    // Uploads the levels as they are, no mipmaps are generated on the driver
+    virtual unsigned int LoadTexture(
+        int bpp,
+        bool repeat,
+        std::span<const TextureLevel> levels) = 0;
+
+    // False when LoadCompressedTexture() can not be used, upload the raw texels then
+    virtual bool SupportsCompressedTextures() const = 0;
+
+    // Uploads the blocks as they are, the texture stays compressed in video memory
+    virtual unsigned int LoadCompressedTexture(
+        CompressedFormats format,
+        bool repeat,
+        std::span<const CompressedTextureLevel> levels) = 0;
+
     virtual unsigned int LoadLightmap(
         int width,
         int height,
@@ -56,6 +96,22 @@ public:
         bool repeat,
         unsigned char *data) = 0;
 
+    // Replaces a rectangle of a lightmap, data points at its top-left texel and rows
+    // are pitch bytes apart
+    virtual void UpdateLightmap(
+        unsigned int index,
+        int x,
+        int y,
+        int width,
+        int height,
+        int bpp,
+        int pitch,
+        const unsigned char *data) = 0;
+
+    // Frees textures and lightmaps from any of the loaders above, 0 is skipped
+    virtual void UnloadTextures(
+        std::span<const unsigned int> indices) = 0;
+
     virtual std::unique_ptr<IShader> LoadShader(
         const std::string &shaderName) = 0;
 
@@ -72,6 +128,11 @@ public:
     virtual void RenderTriangleFans(
         int start,
         int count) = 0;
+
+    // Draws ranges of the bound index buffer as triangle lists, all ranges in one call
+    virtual void RenderIndexedTriangles(
+        std::span<const int> firstIndices,
+        std::span<const int> indexCounts) = 0;
 };
 
 #endif // IRENDERER_H
@@ -0,0 +1,49 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+// Read-only memory mapping of a whole file. The mapping stays valid until
+// Close() is called or the MappedFile is destroyed, so views handed out by
+// View() must not outlive it.
+class MappedFile
+{
+public:
+    MappedFile();
+
+    MappedFile(
+        const MappedFile &) = delete;
+
+    MappedFile &operator=(
+        const MappedFile &) = delete;
+
+    virtual ~MappedFile();
+
+    bool Open(
+        const std::filesystem::path &path);
+
+    void Close();
+
+    bool IsOpen() const;
+
+    const unsigned char *Data() const;
+
+    size_t Size() const;
+
+    // Returns an empty span when the requested range is not within the mapping
+    std::span<const unsigned char> View(
+        size_t offset,
+        size_t count) const;
+
+private:
+    const unsigned char *_data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void *_fileHandle = nullptr;
+    void *_mappingHandle = nullptr;
+#endif
+};
+
+#endif // MAPPEDFILE_H
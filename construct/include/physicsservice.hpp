@@ -19,8 +19,11 @@ public:
     virtual void Step(
         std::chrono::microseconds diff);
 
+    virtual void Clear();
+
     virtual PhysicsComponent AddStatic(
-        const std::vector<glm::vec3> &t);
+        const std::vector<glm::vec3> &vertices,
+        const std::vector<uint32_t> &indices);
 
     virtual PhysicsComponent AddCharacter(
         float mass,
@@ -2,10 +2,18 @@
 #define _HL1BSPASSET_H_
 
 #include "../hltexture.h"
+#include "hl1bspcollision.h"
+#include "hl1bsplightstyles.h"
+#include "hl1bspmesh.h"
 #include "hl1bsptypes.h"
+#include "hl1bspvisibility.h"
 #include "hl1wadasset.h"
+#include "hl1wadlibrary.h"
 
+#include <mappedfile.h>
+#include <memory>
 #include <set>
+#include <span>
 #include <string>
 
 namespace valve
@@ -14,37 +22,67 @@ namespace valve
     namespace hl1
     {
 
+        // Keeps the whole bsp file in a single buffer and exposes every lump as a
+        // typed view into it. The buffer is either owned by the BspFile, a memory
+        // mapping of the file, or borrowed from a mapping kept alive by the caller.
         class BspFile
         {
         public:
-            BspFile(byte *data);
-
-            std::vector<byte> _entityData;
-            std::vector<tBSPPlane> _planes;
-            std::vector<unsigned char> _textureData;
-            std::vector<tBSPVertex> _verticesData;
-            std::vector<byte> _visData;
-            std::vector<tBSPNode> _nodeData;
-            std::vector<tBSPTexInfo> _texinfoData;
-            std::vector<tBSPFace> _faceData;
-            std::vector<byte> _lightingData;
-            std::vector<tBSPClipNode> _clipnodeData;
-            std::vector<tBSPLeaf> _leafData;
-            std::vector<unsigned short> _marksurfaceData;
-            std::vector<tBSPEdge> _edgeData;
-            std::vector<int> _surfedgeData;
-            std::vector<tBSPModel> _modelData;
+            explicit BspFile(
+                std::vector<byte> &&data);
+
+            explicit BspFile(
+                std::unique_ptr<MappedFile> &&mappedFile);
+
+            explicit BspFile(
+                std::span<const byte> data);
+
+            // False when the header or one of the lumps does not fit the buffer
+            bool IsValid() const;
+
+            // The whole file
+            std::span<const byte> Data() const;
+
+            std::span<const byte> _entityData;
+            std::span<const tBSPPlane> _planes;
+            std::span<const unsigned char> _textureData;
+            std::span<const tBSPVertex> _verticesData;
+            std::span<const byte> _visData;
+            std::span<const tBSPNode> _nodeData;
+            std::span<const tBSPTexInfo> _texinfoData;
+            std::span<const tBSPFace> _faceData;
+            std::span<const byte> _lightingData;
+            std::span<const tBSPClipNode> _clipnodeData;
+            std::span<const tBSPLeaf> _leafData;
+            std::span<const unsigned short> _marksurfaceData;
+            std::span<const tBSPEdge> _edgeData;
+            std::span<const int> _surfedgeData;
+            std::span<const tBSPModel> _modelData;
 
         private:
+            std::vector<byte> _ownedData;
+            std::unique_ptr<MappedFile> _mappedFile;
+            std::span<const byte> _data;
+            bool _valid = false;
+
+            void MapLumps();
+
             template <class T, int L>
-            std::vector<T> LoadLump(byte *data)
+            std::span<const T> LoadLump(
+                const tBSPHeader &header)
             {
-                auto header = reinterpret_cast<tBSPHeader *>(data);
+                auto &lump = header.lumps[L];
+
+                if (lump.offset < 0 || lump.size < 0 || size_t(lump.offset) + size_t(lump.size) > _data.size())
+                {
+                    _valid = false;
 
-                auto offsetPtr = data + header->lumps[L].offset;
-                auto typePtr = reinterpret_cast<T *>(offsetPtr);
+                    return {};
+                }
 
-                return std::vector<T>(typePtr, typePtr + (header->lumps[L].size / sizeof(T)));
+                auto typePtr = reinterpret_cast<const T *>(_data.data() + lump.offset);
+
+                return std::span<const T>(typePtr, lump.size / sizeof(T));
             }
         };
 
@@ -57,6 +95,8 @@ namespace valve
                 glm::vec3 position;
                 int firstFace;
                 int faceCount;
+                int firstTriangle; // into _mesh, counted in triangles
+                int triangleCount;
 
                 int rendermode;        // "Render Mode" [ 0: "Normal" 1: "Color" 2: "Texture" 3: "Glow" 4: "Solid" 5: "Additive" ]
                 char renderamt;        // "FX Amount (1 - 255)"
@@ -64,9 +104,33 @@ namespace valve
 
             } tModel;
 
+            // Where the lightmap of a face ended up in the lightmap atlas
+            typedef struct sLightmapRegion
+            {
+                int page;   // index into _lightMaps
+                int x, y;   // top-left of the lightmap, excluding the 1 texel border
+                int width;  // lightmap size in texels
+                int height;
+
+            } tLightmapRegion;
+
+            // The lightmap color (0-255) under a point for each light style of the face
+            typedef struct sLightSample
+            {
+                unsigned char styles[HL1_BSP_MAX_LIGHT_MAPS]; // 255 ends them, maps[0] is not styled when styles[0] is 255
+                glm::vec3 maps[HL1_BSP_MAX_LIGHT_MAPS];
+
+            } tLightSample;
+
+            typedef BspCollisionModel::tTraceResult tTraceResult;
+
         public:
+            // Without a wad library the wads are opened for this load only. The world
+            // textures only get blocks when compressTextures is set.
             BspAsset(
-                IFileSystem *fs);
+                IFileSystem *fs,
+                WadLibrary *wadLibrary = nullptr,
+                bool compressTextures = true);
             virtual ~BspAsset();
 
             virtual bool Load(
@@ -77,49 +141,110 @@ namespace valve
             tBSPEntity *FindEntityByClassname(
                 const std::string &classname);
 
-            tBSPMipTexHeader *GetMiptex(
+            const tBSPMipTexHeader *GetMiptex(
                 int index);
 
             int FaceFlags(
                 size_t index);
 
-            glm::vec3 Trace(
-                const glm::vec3 &from,
-                const glm::vec3 &to,
-                int clipNodeIndex = -1);
-
-            int restartCount = 0;
-            bool IsInContents(
-                const glm::vec3 &from,
-                const glm::vec3 &to,
-                glm::vec3 &target,
-                int clipNodeIndex);
+            // The leaf of the world node tree that holds point, 0 is the solid leaf
+            int PointInLeaf(
+                const glm::vec3 &point) const;
+
+            int PointContents(
+                const glm::vec3 &point,
+                int hull = 0,
+                int model = 0,
+                const glm::vec3 &offset = glm::vec3(0.0f)) const;
+
+            // The lightmap samples where the segment from start to end first crosses a
+            // lit world face, false when it crosses none. The styles are kept apart so
+            // the sample stays valid while they change, see StyleLight().
+            bool LightPoint(
+                const glm::vec3 &start,
+                const glm::vec3 &end,
+                tLightSample &sample) const;
+
+            // The color (0-255) of a sample, its styles weighted by the scales last given
+            // to UpdateLightStyles() like the lightmaps are
+            glm::vec3 StyleLight(
+                const tLightSample &sample) const;
+
+            // Recomposites the lightmaps of the faces that use one of the changed styles
+            // into their atlas pages. dirtyRegions gets the rectangles that changed,
+            // borders included, ready for a sub upload.
+            void UpdateLightStyles(
+                const BspLightStyles &styles,
+                uint64_t changedStyles,
+                std::vector<tLightmapRegion> &dirtyRegions);
+
+            // See BspCollisionModel, which can also be queried directly from other threads
+            tTraceResult Trace(
+                const glm::vec3 &start,
+                const glm::vec3 &end,
+                int hull = 0,
+                int model = 0,
+                const glm::vec3 &offset = glm::vec3(0.0f)) const;
+
+            void TraceBatch(
+                std::span<const glm::vec3> starts,
+                std::span<const glm::vec3> ends,
+                std::span<tTraceResult> results,
+                int hull = 0,
+                int model = 0,
+                const glm::vec3 &offset = glm::vec3(0.0f)) const;
 
             // These are mapped from the input file data
             std::unique_ptr<BspFile> _bspFile;
+            BspVisibility _visibility;
+            BspCollisionModel _collision;
             tBSPEntity _worldspawn;
 
             // These are parsed from the mapped data
             std::vector<tBSPEntity> _entities;
-            std::vector<tBSPVisLeaf> _visLeafs;
             std::vector<tModel> _models;
             std::vector<Texture *> _textures;
-            std::vector<Texture *> _lightMaps;
-            std::vector<tVertex> _vertices;
-            std::vector<tFace> _faces;
+            std::vector<Texture *> _lightMaps; // atlas pages, see _lightmapRegions
+            std::vector<tLightmapRegion> _lightmapRegions;
+            std::vector<tFace> _faces; // firstVertex and vertexCount are only valid while loading, see _mesh
+            BspMesh _mesh;
             valve::Texture *_skytextures[6] = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
 
         private:
+            WadLibrary *_wadLibrary = nullptr;
+            bool _compressTextures = true;
+            std::vector<std::vector<int>> _styleFaces; // the lit faces by light style
+            std::vector<uint64_t> _styleFaceStamps;
+            uint64_t _styleStamp = 0;
+            float _styleScales[HL1_BSP_MAX_LIGHTSTYLES] = {};
+
+            void IndexLightStyles();
+
+            bool SampleFaceLight(
+                const tBSPFace &face,
+                const glm::vec3 &point,
+                tLightSample &sample) const;
+
             void CalculateSurfaceExtents(
                 const tBSPFace &in,
                 float min[2],
                 float max[2]) const;
 
+            static void CalculateLightmapSize(
+                const float min[2],
+                const float max[2],
+                int size[2]);
+
+            bool PackLightmaps(
+                const std::vector<glm::ivec2> &sizes,
+                std::vector<tLightmapRegion> &regions,
+                std::vector<Texture *> &pages);
+
             bool LoadLightmap(
                 const tBSPFace &in,
-                Texture &out,
-                float min[2],
-                float max[2]);
+                Texture &page,
+                const tLightmapRegion &region,
+                const BspLightStyles &styles);
 
             bool LoadFacesWithLightmaps(
                 std::vector<tFace> &faces,
@@ -130,14 +255,19 @@ namespace valve
 
             bool LoadTextures(
                 std::vector<Texture *> &textures,
+                WadLibrary &wadLibrary,
                 const std::vector<WadAsset *> &wads);
 
+            static void DecodeMiptex(
+                const unsigned char *textureData,
+                Texture &texture);
+
             bool LoadModels();
 
-            static std::vector<sBSPEntity> LoadEntities(
-                std::unique_ptr<BspFile> &bspFile);
+            void BuildMesh(
+                const std::vector<tVertex> &fanVertices);
 
-            static std::vector<tBSPVisLeaf> LoadVisLeafs(
+            static std::vector<sBSPEntity> LoadEntities(
                 std::unique_ptr<BspFile> &bspFile);
         };
 
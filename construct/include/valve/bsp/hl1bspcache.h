@@ -0,0 +1,69 @@
+#ifndef _HL1BSPCACHE_H_
+#define _HL1BSPCACHE_H_
+
+#include "../hltypes.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+#define HL1_BSPCACHE_SIGNATURE "HLBC"
+#define HL1_BSPCACHE_VERSION 5
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        class BspAsset;
+
+        typedef struct sBspCacheHeader
+        {
+            char signature[4];
+            int version;
+            uint64_t contentHash; // hash of the bsp file the cache was baked from
+            uint64_t payloadSize; // bytes following this header
+
+            // Layout of the structs stored as raw arrays, a cache written by a
+            // build with different packing is rejected instead of misread
+            int vertexSize;
+            int faceSize;
+            int modelSize;
+            int regionSize;
+
+        } tBspCacheHeader;
+
+        // On-disk snapshot of everything BspAsset::Load derives from a bsp file:
+        // the entity table, decoded textures and sky, lightmap atlas pages, faces,
+        // vertices and the collision triangles. The file is memory mapped on read
+        // and only accepted when its version, struct layout and content hash match.
+        // Textures coming from wad files are baked in as well, a changed wad is not
+        // noticed until the bsp itself changes or the cache file is removed.
+        class BspCache
+        {
+        public:
+            static uint64_t Hash(
+                std::span<const byte> data);
+
+            // Where the cache for a bsp, found by LocateFile() at location, is kept
+            static std::filesystem::path CachePath(
+                const std::filesystem::path &location,
+                const std::string &filename);
+
+            static bool Read(
+                const std::filesystem::path &path,
+                uint64_t contentHash,
+                BspAsset &asset);
+
+            static bool Write(
+                const std::filesystem::path &path,
+                uint64_t contentHash,
+                BspAsset &asset);
+        };
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif /* _HL1BSPCACHE_H_ */
@@ -0,0 +1,171 @@
+#ifndef _HL1BSPCOLLISION_H_
+#define _HL1BSPCOLLISION_H_
+
+#include "hl1bsptypes.h"
+
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        // The clip hulls of a bsp, for point and trace queries. After Attach() nothing
+        // is written anymore, so any number of threads can query it at the same time.
+        class BspCollisionModel
+        {
+        public:
+            typedef struct sTraceResult
+            {
+                bool allSolid;         // the trace never left solid
+                bool startSolid;       // the trace started in solid
+                float fraction;        // 1.0 when nothing was hit
+                glm::vec3 endPosition; // where the trace stopped
+                glm::vec3 planeNormal; // of the plane that was hit
+                float planeDistance;
+                int contents; // CONTENTS_SOLID on a hit, otherwise the contents the trace started in
+
+            } tTraceResult;
+
+            // Remembers the last leaf a moving point was found in, see PointInLeaf()
+            typedef struct sPointCache
+            {
+                glm::vec3 origin;
+                float clearance = -1.0f; // distance from origin to the nearest plane above the leaf
+                int leaf = 0;
+
+            } tPointCache;
+
+            // The spans must stay valid for as long as the model is queried
+            void Attach(
+                std::span<const tBSPPlane> planes,
+                std::span<const tBSPNode> nodes,
+                std::span<const tBSPLeaf> leafs,
+                std::span<const tBSPClipNode> clipNodes,
+                std::span<const tBSPModel> models);
+
+            // The leaf of the world node tree that holds point, 0 is the solid leaf
+            int PointInLeaf(
+                const glm::vec3 &point) const;
+
+            // Same as above, but skips the descent while point is closer to the cached
+            // origin than any plane that bounds the cached leaf. One cache per mover.
+            int PointInLeaf(
+                const glm::vec3 &point,
+                tPointCache &cache) const;
+
+            // Appends the non-solid leafs of the world node tree that the box touches
+            void BoxLeafs(
+                const glm::vec3 &mins,
+                const glm::vec3 &maxs,
+                std::vector<int> &leafs) const;
+
+            // The contents of a leaf of the world node tree
+            int LeafContents(
+                int leaf) const;
+
+            // The contents (CONTENTS_EMPTY, CONTENTS_WATER, ...) at point in a clip hull of a
+            // model placed at offset
+            int PointContents(
+                const glm::vec3 &point,
+                int hull = 0,
+                int model = 0,
+                const glm::vec3 &offset = glm::vec3(0.0f)) const;
+
+            // The world contents at point, through the leaf cache
+            int PointContents(
+                const glm::vec3 &point,
+                tPointCache &cache) const;
+
+            // Moves a box from start to end through a clip hull (0 point, 1 standing,
+            // 2 large, 3 crouching) of a model placed at offset, until it hits solid
+            tTraceResult Trace(
+                const glm::vec3 &start,
+                const glm::vec3 &end,
+                int hull = 0,
+                int model = 0,
+                const glm::vec3 &offset = glm::vec3(0.0f)) const;
+
+            // Trace() for every start/end pair, results are the same as single traces. In
+            // AVX builds (CONSTRUCT_AVX2) rays that start and end close together walk the
+            // hull in 8 lanes and only split up where they take different sides of a node,
+            // other rays are traced one by one. Only bundles gain: bench/tracebench measured
+            // x1.1-1.2 for them and x0.96-1.03 for spread out rays. Other builds always
+            // trace one by one, 4 SSE2 lanes did not gain.
+            void TraceBatch(
+                std::span<const glm::vec3> starts,
+                std::span<const glm::vec3> ends,
+                std::span<tTraceResult> results,
+                int hull = 0,
+                int model = 0,
+                const glm::vec3 &offset = glm::vec3(0.0f)) const;
+
+        private:
+            typedef struct sHull
+            {
+                std::span<const tBSPClipNode> clipNodes;
+                int firstClipNode;
+
+            } tHull;
+
+            std::span<const tBSPPlane> _planes;
+            std::span<const tBSPNode> _nodes;
+            std::span<const tBSPLeaf> _leafs;
+            std::span<const tBSPClipNode> _clipNodes;
+            std::span<const tBSPModel> _models;
+            std::vector<tBSPClipNode> _hull0ClipNodes; // hull 0 is the node tree
+
+            bool GetHull(
+                int hull,
+                int model,
+                tHull &result) const;
+
+            tTraceResult TraceHull(
+                const tHull &hull,
+                int num,
+                const glm::vec3 &p1,
+                const glm::vec3 &p2,
+                const glm::vec3 &offset) const;
+
+            // The walk of TraceHull() below num, for the part of the trace from p1f to p2f.
+            // False when the trace hit something there, or stopped in a broken tree.
+            bool TraceWalk(
+                const tHull &hull,
+                int num,
+                float p1f,
+                float p2f,
+                const glm::vec3 &p1,
+                const glm::vec3 &p2,
+                const glm::vec3 &offset,
+                tTraceResult &trace,
+                bool &firstLeaf,
+                bool &stopped) const;
+
+            // Fills in the hit on the plane of the node the trace could not get past
+            void TraceImpact(
+                const tHull &hull,
+                const tBSPPlane &plane,
+                int side,
+                float p1f,
+                float p2f,
+                const glm::vec3 &p1,
+                const glm::vec3 &p2,
+                float midf,
+                glm::vec3 mid,
+                const glm::vec3 &offset,
+                tTraceResult &trace) const;
+
+            int HullPointContents(
+                const tHull &hull,
+                int num,
+                const glm::vec3 &point) const;
+        };
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif // _HL1BSPCOLLISION_H_
@@ -0,0 +1,56 @@
+#ifndef _HL1BSPLIGHTGRID_H_
+#define _HL1BSPLIGHTGRID_H_
+
+#include "hl1bspasset.h"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <unordered_map>
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        // Light for models, taken from the lightmap of the world face below them. The
+        // world is split in cubic cells and every cell is sampled only once for each leaf
+        // it has models in, so any number of models can be lit each frame for a leaf
+        // lookup and a hash lookup. The cells keep every light style apart and follow
+        // the scales given to BspAsset::UpdateLightStyles(). Not thread safe.
+        class BspLightGrid
+        {
+        public:
+            explicit BspLightGrid(
+                float cellSize = 32.0f);
+
+            // Drops all cells, asset may be nullptr
+            void Attach(
+                const BspAsset *asset);
+
+            // The lightmap color (0-255) of the cell that holds point
+            glm::vec3 LightAt(
+                const glm::vec3 &point);
+
+            size_t CellCount() const { return _cells.size(); }
+
+            uint64_t CacheHits() const { return _hits; }
+
+            uint64_t CacheMisses() const { return _misses; }
+
+        private:
+            const BspAsset *_asset = nullptr;
+            float _cellSize;
+            std::unordered_map<uint64_t, BspAsset::tLightSample> _cells;
+            uint64_t _hits = 0;
+            uint64_t _misses = 0;
+
+            BspAsset::tLightSample Sample(
+                const glm::vec3 &point) const;
+        };
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif // _HL1BSPLIGHTGRID_H_
@@ -0,0 +1,51 @@
+#ifndef _HL1BSPLIGHTSTYLES_H_
+#define _HL1BSPLIGHTSTYLES_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#define HL1_BSP_MAX_LIGHTSTYLES 64
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        // The brightness of the 64 light styles over time. A style is a pattern of
+        // letters played at 10 per second, 'a' is dark, 'm' normal and 'z' double bright.
+        // Styles 0-12 are the stock patterns, 32 and up are switchable lights.
+        class BspLightStyles
+        {
+        public:
+            BspLightStyles();
+
+            void SetPattern(
+                int style,
+                const std::string &pattern);
+
+            // Moves the time forward, returns a bit per style whose scale changed since
+            // the last call, including changes made by SetPattern
+            uint64_t Advance(
+                std::chrono::microseconds elapsed);
+
+            // 1.0 for 'm'
+            float Scale(
+                int style) const;
+
+        private:
+            std::string _patterns[HL1_BSP_MAX_LIGHTSTYLES];
+            float _scales[HL1_BSP_MAX_LIGHTSTYLES];
+            std::chrono::microseconds _time = std::chrono::microseconds(0);
+            uint64_t _changed = 0;
+
+            float ScaleAt(
+                int style) const;
+        };
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif // _HL1BSPLIGHTSTYLES_H_
@@ -0,0 +1,80 @@
+#ifndef _HL1BSPMESH_H_
+#define _HL1BSPMESH_H_
+
+#include "../hltypes.h"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        // Indexed triangle lists of the bsp faces, shared by rendering and collision.
+        // Corners with the same position, texture uv and lightmap uv are welded into a
+        // single vertex. Every face has its own lightmap uvs, so this only welds the
+        // corners within a face and never across faces, a box brush keeps 24 of its 36
+        // soup corners. Collision does not need the uvs, it gets the positions welded
+        // across faces from AddCollisionTriangles(), 8 for the box. The faces of a
+        // model are laid out sorted by texture and lightmap page, so faces that share
+        // both are next to each other in the index list and can go out in one draw.
+        class BspMesh
+        {
+        public:
+            typedef struct sFaceRange
+            {
+                int firstIndex; // into _indices, three per triangle
+                int indexCount;
+
+            } tFaceRange;
+
+            // Positions only, three indices per triangle
+            typedef struct sCollisionMesh
+            {
+                std::vector<glm::vec3> positions;
+                std::vector<uint32_t> indices;
+
+            } tCollisionMesh;
+
+            void Clear();
+
+            // Adds the faces [firstFace, firstFace + faceCount), which are triangle fans
+            // in fanVertices. Add the faces of one model in one call, their triangles
+            // end up in one range. Returns the first triangle of that range.
+            int AddFaces(
+                std::span<const tVertex> fanVertices,
+                std::span<const tFace> faces,
+                int firstFace,
+                int faceCount);
+
+            int TriangleCount() const { return int(_indices.size() / 3); }
+
+            // Appends the triangles [firstTriangle, firstTriangle + triangleCount) to
+            // collision, with the corners welded on position alone
+            void AddCollisionTriangles(
+                int firstTriangle,
+                int triangleCount,
+                tCollisionMesh &collision) const;
+
+            // The three corners of a triangle
+            const glm::vec3 &Corner(
+                int triangle,
+                int corner) const
+            {
+                return _vertices[_indices[size_t(triangle) * 3 + size_t(corner)]].position;
+            }
+
+            std::vector<tVertex> _vertices;
+            std::vector<uint32_t> _indices;
+            std::vector<tFaceRange> _faceRanges; // by face
+            std::vector<int> _drawOrder;         // the faces of each model, by texture and lightmap page
+        };
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif // _HL1BSPMESH_H_
@@ -0,0 +1,51 @@
+#ifndef _HL1BSPTRACESERVICE_H_
+#define _HL1BSPTRACESERVICE_H_
+
+#include "hl1bspcollision.h"
+
+#include <cstdint>
+#include <span>
+#include <workerpool.h>
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        // Runs large sets of traces against a collision model on a worker pool. The
+        // calls block until every trace is done and the calling thread helps out.
+        class BspTraceService
+        {
+        public:
+            explicit BspTraceService(
+                const BspCollisionModel &collision,
+                WorkerPool &pool = WorkerPool::Shared(),
+                size_t batchSize = 256);
+
+            // results[i] is the trace from starts[i] to ends[i]
+            void Trace(
+                std::span<const glm::vec3> starts,
+                std::span<const glm::vec3> ends,
+                std::span<BspCollisionModel::tTraceResult> results,
+                int hull = 0,
+                int model = 0,
+                const glm::vec3 &offset = glm::vec3(0.0f)) const;
+
+            // visible[i * n + j] is 1 when the world does not block the line between
+            // points[i] and points[j], where n is the number of points
+            void LineOfSight(
+                std::span<const glm::vec3> points,
+                std::span<uint8_t> visible) const;
+
+        private:
+            const BspCollisionModel &_collision;
+            WorkerPool &_pool;
+            size_t _batchSize;
+        };
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif // _HL1BSPTRACESERVICE_H_
@@ -27,6 +27,7 @@
 #define HL1_BSP_MAX_MAP_HULLS 4
 #define HL1_BSP_MAX_LIGHT_MAPS 4
 #define HL1_BSP_MAX_AMBIENTS 4
+#define HL1_BSP_MIPLEVELS 4
 
 #define HL1_WAD_SIGNATURE "WAD3"
 
@@ -82,7 +83,7 @@ namespace valve
             char name[16];
             unsigned int width;
             unsigned int height;
-            unsigned int offsets[4];
+            unsigned int offsets[HL1_BSP_MIPLEVELS];
 
         } tBSPMipTexHeader;
 
@@ -181,13 +182,6 @@ namespace valve
 
         } tBSPEntity;
 
-        typedef struct sBSPVisLeaf
-        {
-            int leafCount;
-            int *leafs;
-
-        } tBSPVisLeaf;
-
         /* WAD */
         typedef struct sWADHeader
         {
@@ -0,0 +1,82 @@
+#ifndef _HL1BSPVISIBILITY_H_
+#define _HL1BSPVISIBILITY_H_
+
+#include "../hltypes.h"
+#include "hl1bsptypes.h"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        // Potentially visible set of a bsp. The run length encoded vis lump is kept as
+        // it is and a leaf's row is only expanded to a bitset when it is asked for. The
+        // last few rows stay around in a small LRU, so a camera moving between a
+        // handful of leafs does not decompress anything. Not thread safe.
+        class BspVisibility
+        {
+        public:
+            // One bit per leaf, bit n is leaf n. Leaf 0 is the solid leaf and never set.
+            typedef struct sRow
+            {
+                int leaf = -1;
+                uint64_t lastUse = 0;
+                std::vector<uint64_t> bits;
+
+                bool IsSet(
+                    int leaf) const
+                {
+                    return (bits[size_t(leaf) >> 6] >> (leaf & 63)) & 1;
+                }
+
+            } tRow;
+
+            explicit BspVisibility(
+                size_t cacheSize = 8);
+
+            // The spans must stay valid for as long as rows are requested
+            void Attach(
+                std::span<const byte> visData,
+                std::span<const tBSPLeaf> leafs,
+                int visLeafCount);
+
+            // The leafs a row covers, including the solid leaf 0
+            int LeafCount() const;
+
+            // The row of fromLeaf. The reference is valid until the next call to Row().
+            const tRow &Row(
+                int fromLeaf);
+
+            bool IsVisible(
+                int fromLeaf,
+                int toLeaf);
+
+            uint64_t CacheHits() const { return _hits; }
+
+            uint64_t CacheMisses() const { return _misses; }
+
+        private:
+            std::span<const byte> _visData;
+            std::span<const tBSPLeaf> _leafs;
+            int _visLeafCount = 0;
+            size_t _wordCount = 0;
+            std::vector<tRow> _cache;
+            uint64_t _useCounter = 0;
+            uint64_t _hits = 0;
+            uint64_t _misses = 0;
+
+            void Decompress(
+                int fromLeaf,
+                tRow &row) const;
+        };
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif // _HL1BSPVISIBILITY_H_
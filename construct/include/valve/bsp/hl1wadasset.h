@@ -6,6 +6,7 @@
 
 #include <fstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace valve
@@ -30,9 +31,14 @@ namespace valve
 
             bool IsLoaded() const;
 
+            // Case insensitive, through the index built when the lump directory is loaded
             int IndexOf(
                 const std::string &name) const;
 
+            static std::string FoldName(
+                const char *name,
+                size_t maxLength);
+
             byteptr LumpData(
                 int index);
 
@@ -52,6 +58,7 @@ namespace valve
             tWADHeader _header;
             tWADLump *_lumps = nullptr;
             std::vector<std::vector<byte>> _loadedLumps;
+            std::unordered_map<std::string, int> _lumpIndex; // folded name to lump
         };
 
     } // namespace hl1
@@ -0,0 +1,75 @@
+#ifndef _HL1WADLIBRARY_H_
+#define _HL1WADLIBRARY_H_
+
+#include "../hltexture.h"
+#include "hl1wadasset.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        // Keeps wad files open with their lump directories indexed for as long as the
+        // library lives, so loading the next map does not read halflife.wad again.
+        // Textures decoded from a wad are kept as well, keyed by (wad, lump).
+        class WadLibrary
+        {
+        public:
+            explicit WadLibrary(
+                IFileSystem *fs);
+
+            WadLibrary(
+                const WadLibrary &) = delete;
+
+            WadLibrary &operator=(
+                const WadLibrary &) = delete;
+
+            virtual ~WadLibrary();
+
+            // Returns the wads from a ';' separated worldspawn wad list in the same
+            // order, wads opened for an earlier map are reused
+            std::vector<WadAsset *> Acquire(
+                const std::string &wads);
+
+            // Looks the lump up in each wad in turn, returns nullptr when none has it
+            WadAsset *Find(
+                const std::vector<WadAsset *> &wads,
+                const std::string &name,
+                int &lump);
+
+            // A texture earlier decoded from this lump, or nullptr. The library owns it.
+            const Texture *FindDecoded(
+                const WadAsset *wad,
+                int lump) const;
+
+            // Keeps a copy of texture as the decoded form of this lump
+            void StoreDecoded(
+                const WadAsset *wad,
+                int lump,
+                const Texture &texture);
+
+            size_t WadCount() const;
+
+            size_t DecodedCount() const;
+
+            // Closes all wads and drops every decoded texture
+            void Clear();
+
+        private:
+            IFileSystem *_fs;
+            std::map<std::string, std::unique_ptr<WadAsset>> _wads; // by folded file name
+            std::map<std::pair<long, int>, std::unique_ptr<Texture>> _decoded;
+        };
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif // _HL1WADLIBRARY_H_
@@ -6,8 +6,10 @@
 #include <filesystem>
 #include <fstream>
 #include <map>
+#include <mappedfile.h>
 #include <memory>
 #include <string>
+#include <unordered_map>
 
 class FileSystemSearchPath
 {
@@ -31,6 +33,9 @@ public:
     virtual valve::IOpenFile *OpenFile(
         const std::string &filename);
 
+    virtual std::span<const valve::byte> ViewFile(
+        const std::string &filename);
+
     class FileSystemSearchPathOpenFile : public valve::IOpenFile
     {
     public:
@@ -78,6 +83,9 @@ public:
     virtual valve::IOpenFile *OpenFile(
         const std::string &filename);
 
+    virtual std::span<const valve::byte> ViewFile(
+        const std::string &filename);
+
     class PakSearchPathOpenFile : public valve::IOpenFile
     {
     public:
@@ -97,9 +105,14 @@ public:
 
 private:
     void OpenPakFile();
-    std::ifstream _pakFile;
+    const valve::hl1::tPAKLump *FindLump(
+        const std::string &relativeFilename) const;
+    const valve::hl1::tPAKLump *FindLumpByPath(
+        const std::string &filename) const;
+    MappedFile _pakFile;
     valve::hl1::tPAKHeader _header;
     std::vector<valve::hl1::tPAKLump> _files;
+    std::unordered_map<std::string, size_t> _fileIndex;
     std::map<std::string, std::unique_ptr<PakSearchPathOpenFile>> _openFiles;
     friend class PakSearchPathOpenFile;
 
@@ -124,6 +137,9 @@ public:
     virtual valve::IOpenFile *OpenFile(
         const std::string &filename) override;
 
+    virtual std::span<const valve::byte> ViewFile(
+        const std::string &filename) override;
+
     const std::filesystem::path &Root() const;
     const std::string &Mod() const;
 
@@ -0,0 +1,47 @@
+#ifndef _HLBLOCKCOMPRESSION_H_
+#define _HLBLOCKCOMPRESSION_H_
+
+#include <cstddef>
+
+class WorkerPool;
+
+namespace valve
+{
+
+    // The S3TC/DXT block formats, the values are the BC numbers
+    enum class BlockFormats
+    {
+        None = 0,
+        BC1 = 1, // 8 bytes per 4x4 block, opaque RGB
+        BC3 = 3, // 16 bytes per 4x4 block, RGB with interpolated alpha
+    };
+
+    size_t BlockCompressedSize(
+        BlockFormats format,
+        int width,
+        int height);
+
+    // Encodes an RGB8 or RGBA8 image. Blocks that hang over the right or bottom edge
+    // repeat the last column and row. Color endpoints follow the principal axis of the
+    // block, transparent texels are left out of the color fit in BC3. With a pool the
+    // rows of blocks are spread over its workers, without one it runs on this thread.
+    void CompressBlocks(
+        BlockFormats format,
+        const unsigned char *data,
+        int width,
+        int height,
+        int bpp,
+        unsigned char *blocks,
+        WorkerPool *pool = nullptr);
+
+    // Decodes to RGBA8, for checking the encoder and for renderers without S3TC
+    void DecompressBlocks(
+        BlockFormats format,
+        const unsigned char *blocks,
+        int width,
+        int height,
+        unsigned char *rgba);
+
+} // namespace valve
+
+#endif // _HLBLOCKCOMPRESSION_H_
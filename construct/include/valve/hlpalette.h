@@ -0,0 +1,33 @@
+#ifndef _HLPALETTE_H_
+#define _HLPALETTE_H_
+
+#include <cstddef>
+
+namespace valve
+{
+
+    // Expands 8-bit palette indices to RGBA. The palette holds RGB triplets, indices
+    // beyond paletteColors become opaque black. When transparentIndex is a valid index
+    // those pixels become fully transparent black, as used by the '{' textures.
+    void ExpandPalette(
+        const unsigned char *indices,
+        size_t count,
+        const unsigned char *palette,
+        unsigned char *rgba,
+        int transparentIndex = -1,
+        int paletteColors = 256);
+
+    // Resamples an indexed image to outWidth x outHeight RGBA by averaging four
+    // palette lookups per output texel, at 1/4 and 3/4 of its footprint.
+    void ResamplePalette(
+        const unsigned char *indices,
+        int inWidth,
+        int inHeight,
+        const unsigned char *palette,
+        unsigned char *rgba,
+        int outWidth,
+        int outHeight);
+
+} // namespace valve
+
+#endif // _HLPALETTE_H_
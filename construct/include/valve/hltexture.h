@@ -1,8 +1,11 @@
 #ifndef _HLTEXTURE_H_
 #define _HLTEXTURE_H_
 
+#include "hlblockcompression.h"
+
 #include <glm/glm.hpp>
 #include <string>
+#include <vector>
 
 namespace valve
 {
@@ -33,9 +36,51 @@ namespace valve
             int w,
             int h,
             int bpp,
-            unsigned char *data,
+            const unsigned char *data,
             bool repeat = true);
 
+        // Keeps a smaller copy for mip level 1 and up, level 0 is the texture itself.
+        // Setting the data of level 0 drops all levels below it.
+        void SetMipData(
+            int level,
+            const unsigned char *data);
+
+        // 1 when the texture has no mip levels of its own
+        int MipLevels() const;
+
+        int MipWidth(
+            int level) const;
+
+        int MipHeight(
+            int level) const;
+
+        unsigned char *MipData(
+            int level);
+
+        // Block compresses every mip level, BC1 when all texels are opaque and BC3
+        // otherwise. The uncompressed data is kept, call this once the data is final.
+        // Setting the data of level 0 drops the blocks.
+        void Compress(
+            WorkerPool *pool = nullptr);
+
+        // Sets the blocks of one level, level 0 first
+        void SetBlockData(
+            BlockFormats format,
+            int level,
+            const unsigned char *blocks);
+
+        // None when the texture is not compressed
+        BlockFormats BlockFormat() const;
+
+        const unsigned char *BlockData(
+            int level) const;
+
+        size_t BlockDataSize(
+            int level) const;
+
+        // Adds mip levels down to 1x1, each a box filtered copy of the one before
+        void GenerateMips();
+
         void DefaultTexture();
 
         glm::vec4 PixelAt(
@@ -91,6 +136,9 @@ namespace valve
         int _bpp = 0;
         bool _repeat = true;
         unsigned char *_data = nullptr;
+        std::vector<std::vector<unsigned char>> _mips; // level 1 and up
+        BlockFormats _blockFormat = BlockFormats::None;
+        std::vector<std::vector<unsigned char>> _blocks; // level 0 and up
     };
 
 } // namespace valve
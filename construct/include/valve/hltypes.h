@@ -3,6 +3,7 @@
 
 #include <filesystem>
 #include <glm/glm.hpp>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -129,6 +130,11 @@ namespace valve
         virtual valve::IOpenFile *OpenFile(
             const std::string &filename) = 0;
 
+        // Returns a read-only view of the whole file when the file lives in a memory
+        // mapped archive, or an empty span when it has to be read with LoadFile
+        virtual std::span<const byte> ViewFile(
+            const std::string &filename) = 0;
+
         const std::filesystem::path &Root() const { return _root; }
 
         const std::string &Mod() const { return _mod; }
@@ -29,6 +29,16 @@ namespace valve
 
             } tBodypart;
 
+            // The animation of one sequence decoded to floats, the bone defaults and
+            // scales applied. Laid out [blend][bone][channel][frame] with the channels
+            // X, Y, Z, XR, YR, ZR, so the frames of one channel are next to each other.
+            typedef struct sSequenceTracks
+            {
+                int frameCount;
+                std::vector<float> values;
+
+            } tSequenceTracks;
+
         public:
             MdlAsset(
                 IFileSystem *fs);
@@ -67,10 +77,25 @@ namespace valve
             int BodypartCount() const;
 
             tMDLAnimation *GetAnimation(
-                tMDLSequenceDescription *pseqdesc);
+                const tMDLSequenceDescription *pseqdesc) const;
+
+            // Bytes the decoded tracks of all sequences take, or would take when they are
+            // not decoded
+            size_t AnimationTrackSize() const;
+
+            // Decodes the run length compressed animation of every sequence once, posing
+            // then samples the tracks instead of walking the runs for every bone
+            void DecodeAnimationTracks();
+
+            void ClearAnimationTracks();
+
+            // nullptr when the tracks are not decoded
+            const tSequenceTracks *AnimationTracks(
+                size_t sequence) const;
 
         private:
             std::vector<byte> data;
+            std::vector<tSequenceTracks> _tracks; // by sequence, empty when not decoded
 
             void LoadTextures(
                 std::vector<Texture *> &textures);
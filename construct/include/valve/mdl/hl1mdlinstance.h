@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include <span>
 
 namespace valve
 {
@@ -12,6 +13,60 @@ namespace valve
     namespace hl1
     {
 
+        // Everything a pose depends on besides the asset. The controllers, mouth and
+        // blending are the byte settings the Set functions of MdlInstance produce.
+        typedef struct sMDLPoseParams
+        {
+            size_t sequence = 0;
+            float frame = 0.0f;
+            short controller[4] = {0, 0, 0, 0};
+            short mouth = 0;
+            short blending[2] = {0, 0};
+
+        } tMDLPoseParams;
+
+        // A bone relative to its parent, the way the pose kernels blend it
+        typedef struct sMDLBonePose
+        {
+            glm::vec3 position;
+            glm::quat rotation;
+
+        } tMDLBonePose;
+
+        // Evaluates the skeleton of asset in pose into bones, one matrix for each bone of
+        // the asset, so bones must hold asset->_boneData.size(). Only reads the asset and
+        // keeps its scratch on the stack, different poses can be built at the same time.
+        void BuildSkeleton(
+            const MdlAsset *asset,
+            const tMDLPoseParams &pose,
+            std::span<glm::mat4> bones);
+
+        // Takes the parents back out of bones built by BuildSkeleton() for asset, so
+        // local must hold as many bones
+        void LocalBones(
+            const MdlAsset *asset,
+            std::span<const glm::mat4> bones,
+            std::span<tMDLBonePose> local);
+
+        // Blends the local bones from a to b by s the way the sequence blends are, and
+        // builds the skeleton of the result into bones. Unlike blending the matrices
+        // this keeps the bones rigid.
+        void BlendSkeletons(
+            const MdlAsset *asset,
+            std::span<const tMDLBonePose> a,
+            std::span<const tMDLBonePose> b,
+            float s,
+            std::span<glm::mat4> bones);
+
+        // The frame of sequence after time has passed, wrapped or held at the end
+        float AdvanceFrame(
+            const MdlAsset *asset,
+            size_t sequence,
+            float frame,
+            bool repeat,
+            float speed,
+            std::chrono::microseconds time);
+
         class MdlInstance
         {
         public:
@@ -46,56 +101,27 @@ namespace valve
             float SetSpeed(
                 float speed);
 
+            // Moves on from prevFrame and returns the new frame, without posing
+            float Advance(
+                float prevFrame,
+                std::chrono::microseconds time);
+
+            // Advance() and then BuildSkeleton() into _bonetransform
             float Update(
                 float prevFrame,
                 std::chrono::microseconds time);
 
-            static glm::mat4 _bonetransform[MAX_MDL_BONES];
+            const tMDLPoseParams &Pose() const { return _pose; }
+
+            glm::mat4 _bonetransform[MAX_MDL_BONES];
 
             int _visibleModels[MAX_MDL_BODYPARTS];
 
         private:
-            size_t Sequence = 0;
+            tMDLPoseParams _pose;
             size_t Skin = 0;
-            float Frame = 0.0f;
             bool Repeat = true;
-            short Controller[4];
-            short Blending[4];
-            short Mouth = 0;
             float Speed = 1.0f;
-
-            const glm::mat4 *BuildSkeleton();
-
-            void CalcBoneAdj();
-
-            void CalcBoneQuaternion(
-                int frame,
-                float s,
-                const tMDLBone *pbone,
-                tMDLAnimation *panim,
-                glm::quat &q);
-
-            void CalcBonePosition(
-                int frame,
-                float s,
-                const tMDLBone *pbone,
-                tMDLAnimation *panim,
-                glm::vec3 &pos);
-
-            void CalcRotations(
-                glm::vec3 pos[],
-                glm::quat q[],
-                tMDLSequenceDescription *pseqdesc,
-                tMDLAnimation *panim);
-
-            void SlerpBones(
-                glm::quat q1[],
-                glm::vec3 pos1[],
-                glm::quat q2[],
-                glm::vec3 pos2[],
-                float s);
-
-            glm::quat _adj; // FIX: non persistant, make static
         };
 
     } // namespace hl1
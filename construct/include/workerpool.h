@@ -0,0 +1,67 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads that run queued tasks in FIFO order.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(
+        size_t threadCount = 0);
+
+    WorkerPool(
+        const WorkerPool &) = delete;
+
+    WorkerPool &operator=(
+        const WorkerPool &) = delete;
+
+    virtual ~WorkerPool();
+
+    // Process wide pool sized to the hardware, used by the asset loaders
+    static WorkerPool &Shared();
+
+    size_t ThreadCount() const;
+
+    template <class F>
+    std::future<std::invoke_result_t<F>> Submit(
+        F &&task)
+    {
+        auto packaged = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(task));
+
+        auto result = packaged->get_future();
+
+        Enqueue([packaged]() { (*packaged)(); });
+
+        return result;
+    }
+
+    // Runs task(i) for every i in [0, count) and returns when all of them are done.
+    // The calling thread takes part in the work, so this is safe to call from a worker.
+    void ParallelFor(
+        size_t count,
+        const std::function<void(size_t)> &task);
+
+private:
+    std::vector<std::thread> _threads;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stopping = false;
+
+    void Enqueue(
+        std::function<void()> &&task);
+
+    void WorkerLoop();
+};
+
+#endif // WORKERPOOL_H
@@ -7,7 +7,8 @@
 
 AssetManager::AssetManager(
     valve::IFileSystem *fileSystem)
-    : _fs(fileSystem)
+    : _fs(fileSystem),
+      _wadLibrary(fileSystem)
 {}
 
 inline bool ends_with(
@@ -33,7 +34,7 @@ valve::Asset *AssetManager::LoadAsset(
     // TODO these compares are case sensitive
     if (ends_with(assetName, ".bsp"))
     {
-        asset = new valve::hl1::BspAsset(_fs);
+        asset = new valve::hl1::BspAsset(_fs, &_wadLibrary, _compressTextures);
     }
     else if (ends_with(assetName, ".mdl"))
     {
@@ -71,3 +72,9 @@ valve::Asset *AssetManager::GetAsset(
 
     return nullptr;
 }
+
+void AssetManager::SetTextureCompression(
+    bool compressTextures)
+{
+    _compressTextures = compressTextures;
+}
@@ -1,10 +1,15 @@
 #include "engine.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include <glm/gtx/string_cast.hpp>
 #include <iostream>
+#include <limits>
 #include <print>
 #include <sstream>
 #include <valve/mdl/hl1mdlinstance.h>
+#include <workerpool.h>
 
 template <class T>
 inline std::istream &operator>>(
@@ -29,7 +34,14 @@ Engine::Engine(
       _assetManager(assetManager)
 {}
 
-Engine::~Engine() = default;
+Engine::~Engine()
+{
+    // The decode task uses the asset manager
+    if (_loadDecode.valid())
+    {
+        _loadDecode.wait();
+    }
+}
 
 void Engine::SetProjectionMatrix(
     const glm::mat4 &projectionMatrix)
@@ -40,102 +52,489 @@ void Engine::SetProjectionMatrix(
 bool Engine::Load(
     const std::string &asset)
 {
-    auto rootAsset = _assetManager->LoadAsset(asset);
+    if (!BeginLoad(asset))
+    {
+        return false;
+    }
 
-    if (rootAsset == nullptr)
+    while (ContinueLoad(std::chrono::microseconds::max()))
     {
-        std::println("[ERR] Failed to load {}", asset);
+        // Only the decode on the worker can hold up a load without a budget
+        if (_loadProgress.Stage == LoadStages::Decoding)
+        {
+            _loadDecode.wait();
+        }
+    }
 
-        return false;
+    return _loadProgress.Stage == LoadStages::Done;
+}
+
+// Model and sprite textures get a mip chain and, when they go to the GPU compressed,
+// blocks on the decode worker. The world textures are compressed by the bsp loader.
+static void CompressAssetTextures(
+    valve::Asset *asset,
+    bool compress)
+{
+    std::vector<valve::Texture *> *textures = nullptr;
+
+    if (auto mdl = dynamic_cast<valve::hl1::MdlAsset *>(asset); mdl != nullptr)
+    {
+        textures = &mdl->_textures;
+    }
+    else if (auto spr = dynamic_cast<valve::hl1::SprAsset *>(asset); spr != nullptr)
+    {
+        textures = &spr->_textures;
     }
 
-    if (rootAsset->AssetType() == valve::AssetTypes::Spr)
+    if (textures == nullptr)
     {
-        sprAsset = dynamic_cast<valve::hl1::SprAsset *>(rootAsset);
+        return;
+    }
 
-        const auto entity = _registry.create();
+    WorkerPool::Shared().ParallelFor(textures->size(), [textures, compress](size_t t) {
+        auto tex = (*textures)[t];
 
-        OriginComponent originComponent = {
-            .Origin = glm::vec3(0.0f),
-            .Angles = glm::vec3(0.0f),
-        };
+        if (tex == nullptr || tex->BlockFormat() != valve::BlockFormats::None)
+        {
+            return;
+        }
 
-        _registry.emplace<OriginComponent>(entity, originComponent);
+        tex->GenerateMips();
 
-        RenderComponent rc = {
-            .Amount = 0,
-            .Color = {255, 255, 255},
-            .Mode = RenderModes::NormalBlending,
-        };
+        if (compress)
+        {
+            tex->Compress();
+        }
+    });
+}
 
-        _registry.emplace<RenderComponent>(entity, rc);
+// Studio models whose tracks fit in budget are sampled from the decoded tracks, the
+// others keep walking the compressed animation
+static void DecodeAnimationTracks(
+    valve::Asset *asset,
+    const std::string &name,
+    size_t budget)
+{
+    auto mdl = dynamic_cast<valve::hl1::MdlAsset *>(asset);
 
-        _registry.emplace<SpriteComponent>(entity, BuildSpriteComponent(sprAsset));
+    if (mdl == nullptr || budget == 0 || mdl->_sequenceData.empty() || mdl->AnimationTracks(0) != nullptr)
+    {
+        return;
     }
-    else if (rootAsset->AssetType() == valve::AssetTypes::Mdl)
+
+    auto size = mdl->AnimationTrackSize();
+
+    if (size > budget)
     {
-        mdlAsset = dynamic_cast<valve::hl1::MdlAsset *>(rootAsset);
+        std::println("[INF] animation tracks of {} need {} KB, over the budget of {} KB", name, size / 1024, budget / 1024);
 
-        auto center = mdlAsset->_header->min + ((mdlAsset->_header->max - mdlAsset->_header->min) * 0.5f);
+        return;
+    }
 
-        const auto entity = _registry.create();
+    mdl->DecodeAnimationTracks();
 
-        OriginComponent originComponent = {
-            .Origin = glm::vec3(0.0f),
-            .Angles = glm::vec3(0.0f),
-        };
+    std::println("[DBG] decoded animation tracks of {} into {} KB", name, size / 1024);
+}
 
-        _registry.emplace<OriginComponent>(entity, originComponent);
+bool Engine::BeginLoad(
+    const std::string &asset)
+{
+    if (IsLoading())
+    {
+        std::println("[ERR] {} is still loading", _loadName);
 
-        RenderComponent rc = {
-            .Amount = 0,
-            .Color = {255, 255, 255},
-            .Mode = RenderModes::NormalBlending,
-        };
+        return false;
+    }
 
-        _registry.emplace<RenderComponent>(entity, rc);
+    UnloadLevel();
+
+    _loadName = asset;
+    _loadAsset = nullptr;
+    _loadCollision = {};
+    EnterLoadStage(LoadStages::Decoding, 1);
+
+    // The bsp and the models its entities use are decoded off the main thread, the
+    // asset manager is not touched from the main thread until this is done
+    auto assetManager = _assetManager;
+    auto trackBudget = _animationTrackBudget;
+
+    // Blocks nobody uploads are not worth the encode
+    auto compress = _useTextureCompression && _renderer->SupportsCompressedTextures();
+    assetManager->SetTextureCompression(compress);
+
+    _loadDecode = WorkerPool::Shared().Submit([assetManager, asset, trackBudget, compress]() {
+        auto rootAsset = assetManager->LoadAsset(asset);
+
+        auto bsp = dynamic_cast<valve::hl1::BspAsset *>(rootAsset);
+
+        if (bsp != nullptr)
+        {
+            for (auto &bspEntity : bsp->_entities)
+            {
+                auto model = bspEntity.keyvalues.find("model");
+
+                if (model == bspEntity.keyvalues.end() || model->second.empty() || model->second[0] == '*' ||
+                    bspEntity.classname.rfind("hostage_entity", 0) == 0)
+                {
+                    continue;
+                }
+
+                auto modelAsset = assetManager->LoadAsset(model->second);
+
+                CompressAssetTextures(modelAsset, compress);
+                DecodeAnimationTracks(modelAsset, model->second, trackBudget);
+            }
+        }
+        else
+        {
+            CompressAssetTextures(rootAsset, compress);
+            DecodeAnimationTracks(rootAsset, asset, trackBudget);
+        }
+
+        return rootAsset;
+    });
+
+    return true;
+}
+
+void Engine::UnloadLevel()
+{
+    sprAsset = nullptr;
+    mdlAsset = nullptr;
+    bspAsset = nullptr;
+
+    _registry.clear();
+    _physicsService->Clear();
+    _character = {};
+
+    _renderer->UnloadTextures(_textureIndices);
+    _renderer->UnloadTextures(_lightmapIndices);
+    _renderer->UnloadTextures(_skyTextureIndices);
+    _renderer->UnloadTextures(std::span(&_emptyWhiteTexture, 1));
+    _textureIndices.clear();
+    _lightmapIndices.clear();
+    std::fill(std::begin(_skyTextureIndices), std::end(_skyTextureIndices), 0);
+    _emptyWhiteTexture = 0;
+
+    _vertexBuffer.cleanup();
+    _defaultShader = nullptr;
+    _firstWorldIndex = 0;
+    _firstSkyVertex = 0;
+    _batchFirstIndices.clear();
+    _batchIndexCounts.clear();
+
+    _lightGrid.Attach(nullptr);
+    _lightStyles = valve::hl1::BspLightStyles();
+    _dirtyLightmaps.clear();
+
+    _viewLeaf = -1;
+    _viewLeafCache = {};
+    _faceVisFrames.clear();
+    _leafPvsFrames.clear();
+    _nodePvsFrames.clear();
+    _leafParents.clear();
+    _nodeParents.clear();
+    _cullingStats = {};
+
+    _studioPoses.clear();
+    _studioBones.clear();
+    _studioPoseCache.clear();
+    _studioLodBlends.clear();
+    _studioLodUpdates.clear();
+    _animationStats = {};
+}
+
+bool Engine::ContinueLoad(
+    std::chrono::microseconds budget)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // At least one step is taken per call, so a small budget still gets there
+    while (IsLoading())
+    {
+        if (_loadProgress.Stage == LoadStages::Decoding &&
+            _loadDecode.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            break;
+        }
 
-        _registry.emplace<StudioComponent>(entity, BuildStudioComponent(mdlAsset));
+        if (!LoadStep())
+        {
+            std::println("[ERR] Failed to load {}", _loadName);
+
+            EnterLoadStage(LoadStages::Failed, 0);
+
+            break;
+        }
 
-        auto offset = glm::length(center);
-        if (offset == 0.0f)
+        if (std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start) >= budget)
         {
-            offset = 50.0f;
+            break;
         }
+    }
+
+    return IsLoading();
+}
+
+bool Engine::IsLoading() const
+{
+    return _loadProgress.Stage != LoadStages::Idle &&
+           _loadProgress.Stage != LoadStages::Done &&
+           _loadProgress.Stage != LoadStages::Failed;
+}
+
+const LoadProgress &Engine::GetLoadProgress() const
+{
+    return _loadProgress;
+}
+
+void Engine::EnterLoadStage(
+    LoadStages stage,
+    size_t total)
+{
+    _loadProgress.Stage = stage;
+    _loadProgress.Done = 0;
+    _loadProgress.Total = total;
+    UpdateLoadProgress();
+}
+
+void Engine::UpdateLoadProgress()
+{
+    const float stageCount = float(LoadStages::Finishing) - float(LoadStages::Decoding) + 1.0f;
+
+    if (_loadProgress.Stage == LoadStages::Done)
+    {
+        _loadProgress.Fraction = 1.0f;
 
-        _cam.SetPosition(center + glm::vec3(0.0f, offset, 0.0f));
+        return;
     }
-    else if (rootAsset->AssetType() == valve::AssetTypes::Bsp)
+
+    if (!IsLoading())
+    {
+        _loadProgress.Fraction = 0.0f;
+
+        return;
+    }
+
+    float stageFraction = 0.0f;
+    if (_loadProgress.Total > 0)
     {
-        bspAsset = dynamic_cast<valve::hl1::BspAsset *>(rootAsset);
+        stageFraction = float(_loadProgress.Done) / float(_loadProgress.Total);
+    }
+
+    _loadProgress.Fraction = (float(_loadProgress.Stage) - float(LoadStages::Decoding) + stageFraction) / stageCount;
+}
 
-        if (!SetupBsp(bspAsset))
+bool Engine::LoadStep()
+{
+    auto bsp = dynamic_cast<valve::hl1::BspAsset *>(_loadAsset);
+
+    switch (_loadProgress.Stage)
+    {
+        case LoadStages::Decoding:
         {
-            return false;
+            _loadAsset = _loadDecode.get();
+
+            if (_loadAsset == nullptr)
+            {
+                return false;
+            }
+
+            if (_loadAsset->AssetType() == valve::AssetTypes::Spr)
+            {
+                SetupSprite(dynamic_cast<valve::hl1::SprAsset *>(_loadAsset));
+
+                EnterLoadStage(LoadStages::Finishing, 1);
+            }
+            else if (_loadAsset->AssetType() == valve::AssetTypes::Mdl)
+            {
+                SetupStudio(dynamic_cast<valve::hl1::MdlAsset *>(_loadAsset));
+
+                EnterLoadStage(LoadStages::Finishing, 1);
+            }
+            else if (_loadAsset->AssetType() == valve::AssetTypes::Bsp)
+            {
+                bsp = dynamic_cast<valve::hl1::BspAsset *>(_loadAsset);
+
+                SetupLightStyles(bsp);
+
+                _lightmapIndices = std::vector<unsigned int>();
+                _textureIndices = std::vector<unsigned int>();
+                _loadMipSkip = TextureMipSkip(bsp);
+
+                EnterLoadStage(LoadStages::Lightmaps, bsp->_lightMaps.size());
+            }
+            else
+            {
+                return false;
+            }
+
+            return true;
         }
+        case LoadStages::Lightmaps:
+        {
+            if (_loadProgress.Done < _loadProgress.Total)
+            {
+                LoadWorldLightmap(bsp, _loadProgress.Done++);
+                UpdateLoadProgress();
+            }
+            else
+            {
+                EnterLoadStage(LoadStages::Textures, bsp->_textures.size());
+            }
 
-        auto entities = _registry.view<PlayerStartComponent, OriginComponent>();
+            return true;
+        }
+        case LoadStages::Textures:
+        {
+            if (_loadProgress.Done < _loadProgress.Total)
+            {
+                LoadWorldTexture(bsp, _loadProgress.Done++, _loadMipSkip);
+                UpdateLoadProgress();
+            }
+            else
+            {
+                EnterLoadStage(LoadStages::WorldMesh, 1);
+            }
 
-        std::srand(static_cast<unsigned int>(std::time(nullptr)));
+            return true;
+        }
+        case LoadStages::WorldMesh:
+        {
+            SetupWorldMesh(bsp);
 
-        auto size = entities.size_hint();
-        auto randomMax = std::rand() % size;
+            EnterLoadStage(LoadStages::Entities, bsp->_entities.size());
 
-        size_t i = 0;
-        for (auto &entity : entities)
+            return true;
+        }
+        case LoadStages::Entities:
         {
-            i++;
-            if (i >= randomMax)
+            if (_loadProgress.Done < _loadProgress.Total)
             {
-                auto originComponent = _registry.try_get<OriginComponent>(entity);
+                SetupEntity(bsp, bsp->_entities[_loadProgress.Done++], _loadCollision);
+                UpdateLoadProgress();
+            }
+            else
+            {
+                FinishEntities(_loadCollision);
+                _loadCollision = {};
 
-                // Todo, use angles for character look direction at spawn
-                _character = _physicsService->AddCharacter(15, 16, 35, originComponent->Origin);
+                EnterLoadStage(LoadStages::Finishing, 1);
+            }
 
-                break;
+            return true;
+        }
+        case LoadStages::Finishing:
+        {
+            if (!FinishLoad())
+            {
+                return false;
             }
+
+            EnterLoadStage(LoadStages::Done, 0);
+
+            return true;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+void Engine::SetupSprite(
+    valve::hl1::SprAsset *sprAsset)
+{
+    const auto entity = _registry.create();
+
+    OriginComponent originComponent = {
+        .Origin = glm::vec3(0.0f),
+        .Angles = glm::vec3(0.0f),
+    };
+
+    _registry.emplace<OriginComponent>(entity, originComponent);
+
+    RenderComponent rc = {
+        .Amount = 0,
+        .Color = {255, 255, 255},
+        .Mode = RenderModes::NormalBlending,
+    };
+
+    _registry.emplace<RenderComponent>(entity, rc);
+
+    _registry.emplace<SpriteComponent>(entity, BuildSpriteComponent(sprAsset));
+}
+
+void Engine::SetupStudio(
+    valve::hl1::MdlAsset *mdlAsset)
+{
+    auto center = mdlAsset->_header->min + ((mdlAsset->_header->max - mdlAsset->_header->min) * 0.5f);
+
+    const auto entity = _registry.create();
+
+    OriginComponent originComponent = {
+        .Origin = glm::vec3(0.0f),
+        .Angles = glm::vec3(0.0f),
+    };
+
+    _registry.emplace<OriginComponent>(entity, originComponent);
+
+    RenderComponent rc = {
+        .Amount = 0,
+        .Color = {255, 255, 255},
+        .Mode = RenderModes::NormalBlending,
+    };
+
+    _registry.emplace<RenderComponent>(entity, rc);
+
+    _registry.emplace<StudioComponent>(entity, BuildStudioComponent(mdlAsset));
+    _registry.emplace<StudioLodComponent>(entity);
+
+    auto offset = glm::length(center);
+    if (offset == 0.0f)
+    {
+        offset = 50.0f;
+    }
+
+    _cam.SetPosition(center + glm::vec3(0.0f, offset, 0.0f));
+}
+
+void Engine::SpawnCharacter()
+{
+    auto entities = _registry.view<PlayerStartComponent, OriginComponent>();
+
+    std::srand(static_cast<unsigned int>(std::time(nullptr)));
+
+    auto size = entities.size_hint();
+    auto randomMax = std::rand() % size;
+
+    size_t i = 0;
+    for (auto &entity : entities)
+    {
+        i++;
+        if (i >= randomMax)
+        {
+            auto originComponent = _registry.try_get<OriginComponent>(entity);
+
+            // Todo, use angles for character look direction at spawn
+            _character = _physicsService->AddCharacter(15, 16, 35, originComponent->Origin);
+
+            break;
         }
     }
+}
+
+bool Engine::FinishLoad()
+{
+    // Only now the asset shows up for Render(), everything it needs is set up
+    sprAsset = dynamic_cast<valve::hl1::SprAsset *>(_loadAsset);
+    mdlAsset = dynamic_cast<valve::hl1::MdlAsset *>(_loadAsset);
+    bspAsset = dynamic_cast<valve::hl1::BspAsset *>(_loadAsset);
+
+    if (bspAsset != nullptr)
+    {
+        SpawnCharacter();
+    }
 
     if (!_vertexBuffer.upload())
     {
@@ -188,16 +587,7 @@ StudioComponent Engine::BuildStudioComponent(
     sc.TextureOffset = static_cast<int>(_textureIndices.size());
     for (size_t i = 0; i < mdlAsset->_textures.size(); i++)
     {
-        auto &tex = mdlAsset->_textures[i];
-
-        auto textureIndex = _renderer->LoadTexture(
-            tex->Width(),
-            tex->Height(),
-            tex->Bpp(),
-            tex->Repeat(),
-            tex->Data());
-
-        _textureIndices.push_back(textureIndex);
+        _textureIndices.push_back(UploadTexture(mdlAsset->_textures[i]));
     }
 
     for (auto &vert : mdlAsset->_vertices)
@@ -226,16 +616,7 @@ SpriteComponent Engine::BuildSpriteComponent(
     sc.TextureOffset = static_cast<int>(_textureIndices.size());
     for (size_t i = 0; i < sprAsset->_textures.size(); i++)
     {
-        auto &tex = sprAsset->_textures[i];
-
-        auto textureIndex = _renderer->LoadTexture(
-            tex->Width(),
-            tex->Height(),
-            tex->Bpp(),
-            tex->Repeat(),
-            tex->Data());
-
-        _textureIndices.push_back(textureIndex);
+        _textureIndices.push_back(UploadTexture(sprAsset->_textures[i]));
     }
 
     for (auto &vert : sprAsset->_vertices)
@@ -250,254 +631,487 @@ SpriteComponent Engine::BuildSpriteComponent(
     return sc;
 }
 
-bool Engine::SetupBsp(
+void Engine::LoadWorldLightmap(
+    valve::hl1::BspAsset *bspAsset,
+    size_t index)
+{
+    auto &tex = bspAsset->_lightMaps[index];
+
+    auto textureIndex = _renderer->LoadLightmap(
+        tex->Width(),
+        tex->Height(),
+        tex->Bpp(),
+        tex->Repeat(),
+        tex->Data());
+
+    _lightmapIndices.push_back(textureIndex);
+}
+
+void Engine::LoadWorldTexture(
+    valve::hl1::BspAsset *bspAsset,
+    size_t index,
+    int mipSkip)
+{
+    _textureIndices.push_back(UploadTexture(bspAsset->_textures[index], mipSkip));
+}
+
+void Engine::SetupWorldMesh(
     valve::hl1::BspAsset *bspAsset)
 {
-    _lightmapIndices = std::vector<unsigned int>();
-    for (size_t i = 0; i < bspAsset->_lightMaps.size(); i++)
+    // The mesh indices start at zero, shift them past the vertices already in the buffer
+    auto &mesh = bspAsset->_mesh;
+    auto firstWorldVertex = static_cast<unsigned int>(_vertexBuffer.vertexCount());
+
+    _firstWorldIndex = _vertexBuffer.indexCount();
+
+    for (auto &vertex : mesh._vertices)
     {
-        auto &tex = bspAsset->_lightMaps[i];
+        _vertexBuffer
+            .uvs(glm::vec4(vertex.texcoords[1].x, vertex.texcoords[1].y, vertex.texcoords[0].x, vertex.texcoords[0].y))
+            .bone(-1)
+            .vertex(glm::vec3(vertex.position));
+    }
 
-        auto textureIndex = _renderer->LoadLightmap(
-            tex->Width(),
-            tex->Height(),
-            tex->Bpp(),
-            tex->Repeat(),
-            tex->Data());
+    for (auto index : mesh._indices)
+    {
+        _vertexBuffer.index(firstWorldVertex + index);
+    }
 
-        _lightmapIndices.push_back(textureIndex);
+    _viewLeaf = -1;
+    _viewLeafCache = {};
+    _lightGrid.Attach(bspAsset);
+    _pvsFrame = 0;
+    _visFrame = 0;
+    _faceVisFrames.assign(bspAsset->_faces.size(), 0);
+
+    // Walking from a leaf in the PVS up to the root marks every node leading to it
+    auto &nodes = bspAsset->_bspFile->_nodeData;
+
+    _leafPvsFrames.assign(bspAsset->_bspFile->_leafData.size(), 0);
+    _nodePvsFrames.assign(nodes.size(), 0);
+    _leafParents.assign(bspAsset->_bspFile->_leafData.size(), -1);
+    _nodeParents.assign(nodes.size(), -1);
+
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        for (auto child : nodes[n].children)
+        {
+            if (child >= 0 && size_t(child) < nodes.size())
+            {
+                _nodeParents[child] = int(n);
+            }
+            else if (child < 0 && size_t(-(child + 1)) < _leafParents.size())
+            {
+                _leafParents[-(child + 1)] = int(n);
+            }
+        }
     }
+}
+
+void Engine::SetupEntity(
+    valve::hl1::BspAsset *bspAsset,
+    valve::hl1::tBSPEntity &bspEntity,
+    valve::hl1::BspMesh::tCollisionMesh &collision)
+{
+    const auto entity = _registry.create();
 
-    _textureIndices = std::vector<unsigned int>();
-    for (size_t i = 0; i < bspAsset->_textures.size(); i++)
+    if (bspEntity.classname == "worldspawn")
     {
-        auto &tex = bspAsset->_textures[i];
+        GrabTriangles(bspAsset, 0, collision);
 
-        auto textureIndex = _renderer->LoadTexture(
-            tex->Width(),
-            tex->Height(),
-            tex->Bpp(),
-            tex->Repeat(),
-            tex->Data());
+        _registry.emplace<ModelComponent>(entity, 0);
+
+        SetupSky(bspAsset);
+
+        RenderComponent rc = {
+            .Amount = 255,
+            .Color = {255, 255, 255},
+            .Mode = RenderModes::NormalBlending,
+        };
 
-        _textureIndices.push_back(textureIndex);
+        _registry.emplace<RenderComponent>(entity, rc);
+
+        OriginComponent oc = {
+            .Origin = glm::vec3(0.0f),
+            .Angles = glm::vec3(0.0f),
+        };
+
+        _registry.emplace<OriginComponent>(entity, oc);
+
+        return;
     }
 
-    for (size_t f = 0; f < bspAsset->_faces.size(); f++)
+    if (bspEntity.classname == "info_player_start" ||
+        bspEntity.classname == "info_player_deathmatch" ||
+        bspEntity.classname == "info_player_coop")
     {
-        auto &face = bspAsset->_faces[f];
+        auto originComponent = BuildOriginComponent(bspEntity);
+        _registry.emplace<OriginComponent>(entity, originComponent);
 
-        valve::tFace ft;
+        PlayerStartComponent playerStartComponent = {
+            .className = bspEntity.classname,
+        };
+        _registry.emplace<PlayerStartComponent>(entity, playerStartComponent);
+
+        return;
+    }
+
+    if (bspEntity.keyvalues.count("model") != 0 && bspEntity.classname.rfind("hostage_entity", 0) != 0)
+    {
+        ModelComponent mc = {
+            .AssetId = bspAsset->Id(),
+            .Model = 0,
+        };
 
-        ft.flags = face.flags;
-        ft.firstVertex = 0;
-        ft.vertexCount = 0;
-        ft.lightmap = 0;
-        ft.texture = 0;
+        std::istringstream iss(bspEntity.keyvalues["model"]);
+        iss.get(); // get the astrix
+        iss >> (mc.Model);
 
-        // if (face.flags == 0)
+        if (mc.Model != 0)
         {
-            ft.firstVertex = _vertexBuffer.vertexCount();
-            ft.vertexCount = face.vertexCount;
-            ft.lightmap = static_cast<unsigned int>(f);
-            ft.texture = face.texture;
+            _registry.emplace<ModelComponent>(entity, mc);
 
-            for (int v = face.firstVertex; v < face.firstVertex + face.vertexCount; v++)
+            if (bspEntity.classname.rfind("func_wall", 0) == 0 ||
+                bspEntity.classname.rfind("func_breakable", 0) == 0 ||
+                bspEntity.classname.rfind("func_plat", 0) == 0)
             {
-                auto &vertex = bspAsset->_vertices[v];
+                GrabTriangles(bspAsset, mc.Model, collision);
+            }
+        }
+        else
+        {
+            float scale = 1.0f;
+            if (bspEntity.keyvalues.count("scale") != 0)
+            {
+                scale = std::stof(bspEntity.keyvalues["scale"]);
+            }
+
+            auto asset = _assetManager->LoadAsset(bspEntity.keyvalues["model"]);
 
-                _vertexBuffer
-                    .uvs(glm::vec4(vertex.texcoords[1].x, vertex.texcoords[1].y, vertex.texcoords[0].x, vertex.texcoords[0].y))
-                    .bone(-1)
-                    .vertex(glm::vec3(vertex.position));
+            auto sprAsset = dynamic_cast<valve::hl1::SprAsset *>(asset);
+            auto mdlAsset = dynamic_cast<valve::hl1::MdlAsset *>(asset);
+
+            if (sprAsset != nullptr)
+            {
+                _registry.emplace<SpriteComponent>(entity, BuildSpriteComponent(sprAsset, scale));
+            }
+            else if (mdlAsset != nullptr)
+            {
+                _registry.emplace<StudioComponent>(entity, BuildStudioComponent(mdlAsset, scale));
+                _registry.emplace<StudioLodComponent>(entity);
             }
         }
+    }
+
+    RenderComponent rc = {
+        .Amount = 0,
+        .Color = {255, 255, 255},
+        .Mode = RenderModes::NormalBlending,
+    };
 
-        _faces.push_back(ft);
+    auto renderamt = bspEntity.keyvalues.find("renderamt");
+    if (renderamt != bspEntity.keyvalues.end())
+    {
+        std::istringstream(renderamt->second) >> (rc.Amount);
     }
 
-    if (!SetupEntities(bspAsset))
+    auto rendercolor = bspEntity.keyvalues.find("rendercolor");
+    if (rendercolor != bspEntity.keyvalues.end())
     {
-        return false;
+        std::istringstream(rendercolor->second) >> (rc.Color[0]) >> (rc.Color[1]) >> (rc.Color[2]);
     }
 
-    return true;
+    auto rendermode = bspEntity.keyvalues.find("rendermode");
+    if (rendermode != bspEntity.keyvalues.end())
+    {
+        std::istringstream(rendermode->second) >> (rc.Mode);
+    }
+
+    _registry.emplace<RenderComponent>(entity, rc);
+
+    auto originComponent = BuildOriginComponent(bspEntity);
+
+    _registry.emplace<OriginComponent>(entity, originComponent);
+
+    SetupBoundsComponent(entity, bspAsset);
 }
 
-bool Engine::SetupEntities(
-    valve::hl1::BspAsset *bspAsset)
+void Engine::FinishEntities(
+    valve::hl1::BspMesh::tCollisionMesh &collision)
+{
+    _registry.sort<RenderComponent>([](const RenderComponent &lhs, const RenderComponent &rhs) {
+        return lhs.Mode < rhs.Mode;
+    });
+
+    std::println("[DBG] collision mesh of {} triangles, {} vertices", collision.indices.size() / 3, collision.positions.size());
+
+    _physicsService->AddStatic(collision.positions, collision.indices);
+}
+
+OriginComponent Engine::BuildOriginComponent(
+    valve::hl1::tBSPEntity &bspEntity)
 {
-    std::vector<glm::vec3> triangles;
+    OriginComponent originComponent = {
+        .Origin = glm::vec3(0.0f),
+        .Angles = glm::vec3(0.0f),
+    };
 
-    for (auto &bspEntity : bspAsset->_entities)
+    auto origin = bspEntity.keyvalues.find("origin");
+    if (origin != bspEntity.keyvalues.end())
     {
-        const auto entity = _registry.create();
+        glm::vec3 originPosition;
 
-        if (bspEntity.classname == "worldspawn")
-        {
-            GrabTriangles(bspAsset, 0, triangles);
+        std::istringstream(origin->second) >> originPosition.x >> originPosition.y >> originPosition.z;
 
-            _registry.emplace<ModelComponent>(entity, 0);
+        originComponent.Origin = originPosition;
+    }
 
-            SetupSky(bspAsset);
+    auto angles = bspEntity.keyvalues.find("angles");
+    auto angle = bspEntity.keyvalues.find("angle");
+    if (angles != bspEntity.keyvalues.end())
+    {
+        glm::vec3 anglesPosition;
 
-            RenderComponent rc = {
-                .Amount = 255,
-                .Color = {255, 255, 255},
-                .Mode = RenderModes::NormalBlending,
-            };
+        std::istringstream(angles->second) >> anglesPosition.x >> anglesPosition.y >> anglesPosition.z;
 
-            _registry.emplace<RenderComponent>(entity, rc);
+        originComponent.Angles = anglesPosition;
+    }
+    else if (angle != bspEntity.keyvalues.end())
+    {
+        float anglePosition;
 
-            OriginComponent oc = {
-                .Origin = glm::vec3(0.0f),
-                .Angles = glm::vec3(0.0f),
-            };
+        std::istringstream(angle->second) >> anglePosition;
 
-            _registry.emplace<OriginComponent>(entity, oc);
+        originComponent.Angles = glm::vec3(0.0f, anglePosition, 0.0f);
+    }
 
-            continue;
+    return originComponent;
+}
+
+void Engine::SetupBoundsComponent(
+    const entt::entity &entity,
+    valve::hl1::BspAsset *bspAsset)
+{
+    glm::vec3 mins(0.0f), maxs(0.0f);
+    float scale = 1.0f;
+
+    auto modelComponent = _registry.try_get<ModelComponent>(entity);
+    auto studioComponent = _registry.try_get<StudioComponent>(entity);
+    auto spriteComponent = _registry.try_get<SpriteComponent>(entity);
+
+    if (modelComponent != nullptr && modelComponent->Model > 0 && size_t(modelComponent->Model) < bspAsset->_bspFile->_modelData.size())
+    {
+        mins = bspAsset->_bspFile->_modelData[modelComponent->Model].mins;
+        maxs = bspAsset->_bspFile->_modelData[modelComponent->Model].maxs;
+    }
+    else if (studioComponent != nullptr)
+    {
+        auto asset = _assetManager->GetAsset<valve::hl1::MdlAsset>(studioComponent->AssetId);
+
+        if (asset == nullptr)
+        {
+            return;
         }
 
-        if (bspEntity.classname == "info_player_start" ||
-            bspEntity.classname == "info_player_deathmatch" ||
-            bspEntity.classname == "info_player_coop")
+        // Whatever sequence is playing stays within the union of all sequence boxes
+        mins = glm::min(asset->_header->min, asset->_header->bbmin);
+        maxs = glm::max(asset->_header->max, asset->_header->bbmax);
+
+        for (auto &sequence : asset->_sequenceData)
         {
-            auto originComponent = BuildOriginComponent(bspEntity);
-            _registry.emplace<OriginComponent>(entity, originComponent);
+            mins = glm::min(mins, sequence.bbmin);
+            maxs = glm::max(maxs, sequence.bbmax);
+        }
 
-            PlayerStartComponent playerStartComponent = {
-                .className = bspEntity.classname,
-            };
-            _registry.emplace<PlayerStartComponent>(entity, playerStartComponent);
+        scale = studioComponent->Scale;
+    }
+    else if (spriteComponent != nullptr)
+    {
+        auto asset = _assetManager->GetAsset<valve::hl1::SprAsset>(spriteComponent->AssetId);
 
-            continue;
+        if (asset == nullptr)
+        {
+            return;
         }
 
-        if (bspEntity.keyvalues.count("model") != 0 && bspEntity.classname.rfind("hostage_entity", 0) != 0)
+        // Sprites may turn to face the camera, so use the sphere around the quad
+        float radius = 0.0f;
+
+        for (auto &vertex : asset->_vertices)
         {
-            ModelComponent mc = {
-                .AssetId = bspAsset->Id(),
-                .Model = 0,
-            };
+            radius = std::max(radius, glm::length(vertex.position));
+        }
 
-            std::istringstream iss(bspEntity.keyvalues["model"]);
-            iss.get(); // get the astrix
-            iss >> (mc.Model);
+        mins = glm::vec3(-radius);
+        maxs = glm::vec3(radius);
 
-            if (mc.Model != 0)
-            {
-                _registry.emplace<ModelComponent>(entity, mc);
+        scale = spriteComponent->Scale;
+    }
+    else
+    {
+        return;
+    }
 
-                if (bspEntity.classname.rfind("func_wall", 0) == 0 ||
-                    bspEntity.classname.rfind("func_breakable", 0) == 0 ||
-                    bspEntity.classname.rfind("func_plat", 0) == 0)
-                {
-                    GrabTriangles(bspAsset, mc.Model, triangles);
-                }
-            }
-            else
-            {
-                float scale = 1.0f;
-                if (bspEntity.keyvalues.count("scale") != 0)
-                {
-                    scale = std::stof(bspEntity.keyvalues["scale"]);
-                }
+    // Without a box there is nothing to test, those entities are always drawn
+    if (mins == maxs)
+    {
+        return;
+    }
 
-                auto asset = _assetManager->LoadAsset(bspEntity.keyvalues["model"]);
+    auto &originComponent = _registry.get<OriginComponent>(entity);
 
-                auto sprAsset = dynamic_cast<valve::hl1::SprAsset *>(asset);
-                auto mdlAsset = dynamic_cast<valve::hl1::MdlAsset *>(asset);
+    BoundsComponent bc;
 
-                if (sprAsset != nullptr)
-                {
-                    _registry.emplace<SpriteComponent>(entity, BuildSpriteComponent(sprAsset, scale));
-                }
-                else if (mdlAsset != nullptr)
-                {
-                    _registry.emplace<StudioComponent>(entity, BuildStudioComponent(mdlAsset, scale));
-                }
-            }
+    if (glm::length(originComponent.Angles) == 0.0f)
+    {
+        bc.Mins = originComponent.Origin + mins * scale;
+        bc.Maxs = originComponent.Origin + maxs * scale;
+    }
+    else
+    {
+        auto radius = std::max(glm::length(mins), glm::length(maxs)) * scale;
+
+        bc.Mins = originComponent.Origin - glm::vec3(radius);
+        bc.Maxs = originComponent.Origin + glm::vec3(radius);
+    }
+
+    bspAsset->_collision.BoxLeafs(bc.Mins, bc.Maxs, bc.Leafs);
+
+    _registry.emplace<BoundsComponent>(entity, bc);
+}
+
+void Engine::SetupLightStyles(
+    valve::hl1::BspAsset *bspAsset)
+{
+    _lightStyles = valve::hl1::BspLightStyles();
+
+    // Switchable lights that start off, and lights with their own pattern
+    for (auto &entity : bspAsset->_entities)
+    {
+        if (!entity.classname.starts_with("light"))
+        {
+            continue;
         }
 
-        RenderComponent rc = {
-            .Amount = 0,
-            .Color = {255, 255, 255},
-            .Mode = RenderModes::NormalBlending,
-        };
+        auto style = entity.keyvalues.find("style");
+
+        if (style == entity.keyvalues.end())
+        {
+            continue;
+        }
+
+        int styleIndex = 0;
+        std::istringstream(style->second) >> styleIndex;
+
+        if (styleIndex < 32)
+        {
+            continue;
+        }
+
+        auto pattern = entity.keyvalues.find("pattern");
 
-        auto renderamt = bspEntity.keyvalues.find("renderamt");
-        if (renderamt != bspEntity.keyvalues.end())
+        if (pattern != entity.keyvalues.end() && !pattern->second.empty())
         {
-            std::istringstream(renderamt->second) >> (rc.Amount);
+            _lightStyles.SetPattern(styleIndex, pattern->second);
         }
 
-        auto rendercolor = bspEntity.keyvalues.find("rendercolor");
-        if (rendercolor != bspEntity.keyvalues.end())
+        int spawnflags = 0;
+
+        auto flags = entity.keyvalues.find("spawnflags");
+        if (flags != entity.keyvalues.end())
         {
-            std::istringstream(rendercolor->second) >> (rc.Color[0]) >> (rc.Color[1]) >> (rc.Color[2]);
+            std::istringstream(flags->second) >> spawnflags;
         }
 
-        auto rendermode = bspEntity.keyvalues.find("rendermode");
-        if (rendermode != bspEntity.keyvalues.end())
+        if ((spawnflags & 1) != 0)
         {
-            std::istringstream(rendermode->second) >> (rc.Mode);
+            _lightStyles.SetPattern(styleIndex, "a");
         }
+    }
 
-        _registry.emplace<RenderComponent>(entity, rc);
-
-        auto originComponent = BuildOriginComponent(bspEntity);
+    // The atlas may still hold the styles of an earlier run of this map, bring all
+    // faces in line before the pages are uploaded
+    _lightStyles.Advance(std::chrono::microseconds(0));
+    bspAsset->UpdateLightStyles(_lightStyles, ~uint64_t(0), _dirtyLightmaps);
+}
 
-        _registry.emplace<OriginComponent>(entity, originComponent);
+int Engine::TextureMipSkip(
+    valve::hl1::BspAsset *bspAsset) const
+{
+    if (_textureBudget == 0)
+    {
+        return 0;
     }
 
-    _registry.sort<RenderComponent>([](const RenderComponent &lhs, const RenderComponent &rhs) {
-        return lhs.Mode < rhs.Mode;
-    });
+    for (int skip = 0; skip < HL1_BSP_MIPLEVELS - 1; skip++)
+    {
+        size_t total = 0;
+
+        for (auto tex : bspAsset->_textures)
+        {
+            for (int level = std::min(skip, tex->MipLevels() - 1); level < tex->MipLevels(); level++)
+            {
+                if (UseCompressedTexture(tex))
+                {
+                    total += tex->BlockDataSize(level);
+                }
+                else
+                {
+                    total += size_t(tex->MipWidth(level)) * size_t(tex->MipHeight(level)) * size_t(tex->Bpp());
+                }
+            }
+        }
 
-    _physicsService->AddStatic(triangles);
+        if (total <= _textureBudget)
+        {
+            return skip;
+        }
+    }
 
-    return true;
+    return HL1_BSP_MIPLEVELS - 1;
 }
 
-OriginComponent Engine::BuildOriginComponent(
-    valve::hl1::tBSPEntity &bspEntity)
+bool Engine::UseCompressedTexture(
+    const valve::Texture *tex) const
 {
-    OriginComponent originComponent = {
-        .Origin = glm::vec3(0.0f),
-        .Angles = glm::vec3(0.0f),
-    };
+    return _useTextureCompression &&
+           tex->BlockFormat() != valve::BlockFormats::None &&
+           _renderer->SupportsCompressedTextures();
+}
 
-    auto origin = bspEntity.keyvalues.find("origin");
-    if (origin != bspEntity.keyvalues.end())
+unsigned int Engine::UploadTexture(
+    valve::Texture *tex,
+    int mipSkip)
+{
+    int firstLevel = std::min(mipSkip, tex->MipLevels() - 1);
+
+    if (UseCompressedTexture(tex))
     {
-        glm::vec3 originPosition;
+        std::vector<CompressedTextureLevel> levels;
+        for (int level = firstLevel; level < tex->MipLevels(); level++)
+        {
+            levels.push_back(CompressedTextureLevel{tex->MipWidth(level), tex->MipHeight(level), tex->BlockDataSize(level), tex->BlockData(level)});
+        }
 
-        std::istringstream(origin->second) >> originPosition.x >> originPosition.y >> originPosition.z;
+        auto format = tex->BlockFormat() == valve::BlockFormats::BC3 ? CompressedFormats::BC3 : CompressedFormats::BC1;
 
-        originComponent.Origin = originPosition;
+        return _renderer->LoadCompressedTexture(format, tex->Repeat(), levels);
     }
 
-    auto angles = bspEntity.keyvalues.find("angles");
-    auto angle = bspEntity.keyvalues.find("angle");
-    if (angles != bspEntity.keyvalues.end())
+    // Without levels of its own the renderer makes the mipmaps
+    if (tex->MipLevels() == 1)
     {
-        glm::vec3 anglesPosition;
-
-        std::istringstream(angles->second) >> anglesPosition.x >> anglesPosition.y >> anglesPosition.z;
-
-        originComponent.Angles = anglesPosition;
+        return _renderer->LoadTexture(tex->Width(), tex->Height(), tex->Bpp(), tex->Repeat(), tex->Data());
     }
-    else if (angle != bspEntity.keyvalues.end())
-    {
-        float anglePosition;
-
-        std::istringstream(angle->second) >> anglePosition;
 
-        originComponent.Angles = glm::vec3(0.0f, anglePosition, 0.0f);
+    // The miptex levels are uploaded as they are, starting at the budget level
+    std::vector<TextureLevel> levels;
+    for (int level = firstLevel; level < tex->MipLevels(); level++)
+    {
+        levels.push_back(TextureLevel{tex->MipWidth(level), tex->MipHeight(level), tex->MipData(level)});
     }
 
-    return originComponent;
+    return _renderer->LoadTexture(tex->Bpp(), tex->Repeat(), levels);
 }
 
 void Engine::SetupSky(
@@ -510,7 +1124,7 @@ void Engine::SetupSky(
         {
             continue;
         }
-        _skyTextureIndices[i] = _renderer->LoadTexture(tex->Width(), tex->Height(), tex->Bpp(), tex->Repeat(), tex->Data());
+        _skyTextureIndices[i] = UploadTexture(tex);
     }
 
     // here we make up for the half of pixel to get the sky textures really stitched together because clamping is not enough
@@ -607,31 +1221,12 @@ void Engine::SetupSky(
 void Engine::GrabTriangles(
     valve::hl1::BspAsset *bspAsset,
     int moddelIndex,
-    std::vector<glm::vec3> &triangles)
+    valve::hl1::BspMesh::tCollisionMesh &collision)
 {
     auto &model = bspAsset->_models[moddelIndex];
 
-    for (int f = model.firstFace; f < model.firstFace + model.faceCount; f++)
-    {
-        auto &face = bspAsset->_faces[f];
-
-        // if (face.flags != 0)
-        // {
-        //     continue;
-        // }
-
-        auto &vertex1 = bspAsset->_vertices[face.firstVertex];
-        auto &vertex2 = bspAsset->_vertices[face.firstVertex + 1];
-
-        for (int v = face.firstVertex + 2; v < face.firstVertex + face.vertexCount; v++)
-        {
-            triangles.push_back(vertex1.position);
-            triangles.push_back(vertex2.position);
-            triangles.push_back(bspAsset->_vertices[v].position);
-
-            vertex2 = bspAsset->_vertices[v];
-        }
-    }
+    // Bullet gets the same triangles as the renderer, welded on position alone
+    bspAsset->_mesh.AddCollisionTriangles(model.firstTriangle, model.triangleCount, collision);
 }
 
 void Engine::Update(
@@ -752,80 +1347,349 @@ void Engine::HandleMdlInput(
         }
         else
         {
-            pos = pos + ((_cam.Right()) * speed * dt);
+            pos = pos + ((_cam.Right()) * speed * dt);
+        }
+    }
+    else if (inputState.KeyboardButtonStates[KeyboardButtons::KeyUp] || inputState.KeyboardButtonStates[KeyboardButtons::KeyW])
+    {
+        pos = pos + ((_cam.Forward()) * speed * dt);
+    }
+    else if (inputState.KeyboardButtonStates[KeyboardButtons::KeyDown] || inputState.KeyboardButtonStates[KeyboardButtons::KeyS])
+    {
+        pos = pos + ((_cam.Back()) * speed * dt);
+    }
+
+    _cam.SetPosition(pos);
+}
+
+#include <glad/glad.h>
+
+bool Engine::Render(
+    std::chrono::microseconds time)
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Half set up render data is not drawn, see GetLoadProgress() for what to show
+    if (IsLoading())
+    {
+        return true;
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+
+    if (sprAsset != nullptr)
+    {
+        glDepthFunc(GL_LEQUAL);
+
+        glDisable(GL_BLEND);
+
+        RenderSpritesByRenderMode(RenderModes::NormalBlending, time);
+
+        return true;
+    }
+    else if (mdlAsset != nullptr)
+    {
+        PoseStudioModels(time);
+
+        RenderStudioModelsByRenderMode(RenderModes::NormalBlending);
+
+        return true;
+    }
+    else if (bspAsset != nullptr)
+    {
+        RenderBsp(bspAsset, time);
+
+        return true;
+    }
+
+    return false;
+}
+
+void Engine::RenderBsp(
+    valve::hl1::BspAsset *bspAsset,
+    std::chrono::microseconds time)
+{
+    AnimateLightStyles(bspAsset, time);
+
+    MarkVisibleFaces(bspAsset);
+    CullEntities();
+    PoseStudioModels(time);
+
+    RenderSky();
+
+    glDisable(GL_BLEND);
+    RenderByRenderMode(bspAsset, RenderModes::NormalBlending, time);
+
+    RenderModelsByRenderMode(bspAsset, RenderModes::ColorBlending);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    RenderByRenderMode(bspAsset, RenderModes::AdditiveBlending, time);
+    RenderByRenderMode(bspAsset, RenderModes::TextureBlending, time);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    RenderByRenderMode(bspAsset, RenderModes::SolidBlending, time);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    RenderSpritesByRenderMode(RenderModes::GlowBlending, time);
+}
+
+void Engine::SetCulling(
+    bool usePvs,
+    bool useFrustum)
+{
+    _usePvs = usePvs;
+    _useFrustumCulling = useFrustum;
+
+    // Forces the PVS marks to be rebuilt when it is switched back on
+    _viewLeaf = -1;
+}
+
+const CullingStats &Engine::GetCullingStats() const
+{
+    return _cullingStats;
+}
+
+const AnimationStats &Engine::GetAnimationStats() const
+{
+    return _animationStats;
+}
+
+void Engine::SetTextureBudget(
+    size_t bytes)
+{
+    _textureBudget = bytes;
+}
+
+void Engine::SetTextureCompression(
+    bool useCompression)
+{
+    _useTextureCompression = useCompression;
+}
+
+void Engine::SetAnimationLodDistance(
+    float distance)
+{
+    _animationLodDistance = distance;
+}
+
+void Engine::SetAnimationBudget(
+    int poses)
+{
+    _animationBudget = poses;
+}
+
+void Engine::SetAnimationTrackBudget(
+    size_t bytes)
+{
+    _animationTrackBudget = bytes;
+}
+
+void Engine::AnimateLightStyles(
+    valve::hl1::BspAsset *bspAsset,
+    std::chrono::microseconds time)
+{
+    auto changed = _lightStyles.Advance(time);
+
+    if (changed == 0)
+    {
+        return;
+    }
+
+    bspAsset->UpdateLightStyles(_lightStyles, changed, _dirtyLightmaps);
+
+    for (auto &region : _dirtyLightmaps)
+    {
+        auto &page = bspAsset->_lightMaps[region.page];
+        auto pitch = page->Width() * page->Bpp();
+
+        _renderer->UpdateLightmap(
+            _lightmapIndices[region.page],
+            region.x,
+            region.y,
+            region.width,
+            region.height,
+            page->Bpp(),
+            pitch,
+            page->Data() + region.y * pitch + region.x * page->Bpp());
+    }
+}
+
+void Engine::MarkPvs(
+    valve::hl1::BspAsset *bspAsset)
+{
+    auto leaf = bspAsset->_collision.PointInLeaf(_cam.Position(), _viewLeafCache);
+
+    // The marks only change when the camera moves into another leaf
+    if (leaf == _viewLeaf)
+    {
+        return;
+    }
+
+    _viewLeaf = leaf;
+    _pvsFrame++;
+
+    auto &row = bspAsset->_visibility.Row(leaf);
+
+    for (size_t word = 0; word < row.bits.size(); word++)
+    {
+        for (auto bits = row.bits[word]; bits != 0; bits &= bits - 1)
+        {
+            auto visibleLeaf = word * 64 + size_t(std::countr_zero(bits));
+
+            if (visibleLeaf >= _leafPvsFrames.size())
+            {
+                break;
+            }
+
+            _leafPvsFrames[visibleLeaf] = _pvsFrame;
+
+            for (auto node = _leafParents[visibleLeaf]; node >= 0 && _nodePvsFrames[node] != _pvsFrame; node = _nodeParents[node])
+            {
+                _nodePvsFrames[node] = _pvsFrame;
+            }
+        }
+    }
+}
+
+void Engine::MarkVisibleFaces(
+    valve::hl1::BspAsset *bspAsset)
+{
+    _visFrame++;
+    _cullingStats = CullingStats();
+
+    if (_usePvs)
+    {
+        MarkPvs(bspAsset);
+    }
+
+    _frustum.Update(_projectionMatrix * _cam.GetViewMatrix());
+
+    auto &nodes = bspAsset->_bspFile->_nodeData;
+    auto &leafs = bspAsset->_bspFile->_leafData;
+    auto &marksurfaces = bspAsset->_bspFile->_marksurfaceData;
+
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    // Each entry is a node, or -(leaf + 1), and the frustum planes it still crosses
+    _nodeStack.clear();
+    _nodeStack.push_back(std::make_pair(bspAsset->_bspFile->_modelData[0].headnode[0], Frustum::AllPlanes));
+
+    while (!_nodeStack.empty())
+    {
+        auto [index, planeMask] = _nodeStack.back();
+        _nodeStack.pop_back();
+
+        if (index >= 0)
+        {
+            auto &node = nodes[index];
+
+            _cullingStats.VisitedNodes++;
+
+            if (_usePvs && _nodePvsFrames[index] != _pvsFrame)
+            {
+                continue;
+            }
+
+            if (_useFrustumCulling && planeMask != 0 && _frustum.CullBox(glm::vec3(node.mins[0], node.mins[1], node.mins[2]), glm::vec3(node.maxs[0], node.maxs[1], node.maxs[2]), planeMask))
+            {
+                _cullingStats.CulledNodes++;
+
+                continue;
+            }
+
+            _nodeStack.push_back(std::make_pair(int(node.children[0]), planeMask));
+            _nodeStack.push_back(std::make_pair(int(node.children[1]), planeMask));
+
+            continue;
+        }
+
+        auto leafIndex = size_t(-(index + 1));
+
+        // Leaf 0 is the solid leaf, it has no faces
+        if (leafIndex == 0 || leafIndex >= leafs.size())
+        {
+            continue;
+        }
+
+        auto &leaf = leafs[leafIndex];
+
+        _cullingStats.VisitedLeafs++;
+
+        if (_usePvs && _leafPvsFrames[leafIndex] != _pvsFrame)
+        {
+            continue;
+        }
+
+        if (_useFrustumCulling && planeMask != 0 && _frustum.CullBox(glm::vec3(leaf.mins[0], leaf.mins[1], leaf.mins[2]), glm::vec3(leaf.maxs[0], leaf.maxs[1], leaf.maxs[2]), planeMask))
+        {
+            _cullingStats.CulledLeafs++;
+
+            continue;
+        }
+
+        for (int m = leaf.firstMarkSurface; m < leaf.firstMarkSurface + leaf.markSurfacesCount && size_t(m) < marksurfaces.size(); m++)
+        {
+            if (marksurfaces[m] < _faceVisFrames.size())
+            {
+                _faceVisFrames[marksurfaces[m]] = _visFrame;
+            }
         }
     }
-    else if (inputState.KeyboardButtonStates[KeyboardButtons::KeyUp] || inputState.KeyboardButtonStates[KeyboardButtons::KeyW])
-    {
-        pos = pos + ((_cam.Forward()) * speed * dt);
-    }
-    else if (inputState.KeyboardButtonStates[KeyboardButtons::KeyDown] || inputState.KeyboardButtonStates[KeyboardButtons::KeyS])
-    {
-        pos = pos + ((_cam.Back()) * speed * dt);
-    }
-
-    _cam.SetPosition(pos);
 }
 
-#include <glad/glad.h>
-
-bool Engine::Render(
-    std::chrono::microseconds time)
+void Engine::CullEntities()
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
+    auto entities = _registry.view<BoundsComponent>();
 
-    if (sprAsset != nullptr)
+    for (auto entity : entities)
     {
-        glDepthFunc(GL_LEQUAL);
+        auto &bounds = entities.get<BoundsComponent>(entity);
 
-        glDisable(GL_BLEND);
+        _cullingStats.VisitedEntities++;
 
-        RenderSpritesByRenderMode(RenderModes::NormalBlending, time);
+        if (_usePvs && !InPvs(bounds))
+        {
+            _cullingStats.CulledEntities++;
 
-        return true;
-    }
-    else if (mdlAsset != nullptr)
-    {
-        RenderStudioModelsByRenderMode(RenderModes::NormalBlending, time);
+            continue;
+        }
 
-        return true;
-    }
-    else if (bspAsset != nullptr)
-    {
-        RenderBsp(bspAsset, time);
+        if (_useFrustumCulling && _frustum.CullBox(bounds.Mins, bounds.Maxs))
+        {
+            _cullingStats.CulledEntities++;
 
-        return true;
-    }
+            continue;
+        }
 
-    return false;
+        bounds.VisibleFrame = _visFrame;
+    }
 }
 
-void Engine::RenderBsp(
-    valve::hl1::BspAsset *bspAsset,
-    std::chrono::microseconds time)
+bool Engine::InPvs(
+    const BoundsComponent &bounds) const
 {
-    RenderSky();
-
-    glDisable(GL_BLEND);
-    RenderByRenderMode(bspAsset, RenderModes::NormalBlending, time);
-
-    RenderModelsByRenderMode(bspAsset, RenderModes::ColorBlending);
-
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-    RenderByRenderMode(bspAsset, RenderModes::AdditiveBlending, time);
-    RenderByRenderMode(bspAsset, RenderModes::TextureBlending, time);
+    // Bounds that are all in solid have no leafs to test, those are never culled
+    if (bounds.Leafs.empty())
+    {
+        return true;
+    }
 
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    RenderByRenderMode(bspAsset, RenderModes::SolidBlending, time);
+    for (auto leaf : bounds.Leafs)
+    {
+        if (size_t(leaf) < _leafPvsFrames.size() && _leafPvsFrames[leaf] == _pvsFrame)
+        {
+            return true;
+        }
+    }
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-    RenderSpritesByRenderMode(RenderModes::GlowBlending, time);
+    return false;
 }
 
 void Engine::RenderByRenderMode(
@@ -834,7 +1698,7 @@ void Engine::RenderByRenderMode(
     std::chrono::microseconds time)
 {
     RenderModelsByRenderMode(bspAsset, mode);
-    RenderStudioModelsByRenderMode(mode, time);
+    RenderStudioModelsByRenderMode(mode);
     RenderSpritesByRenderMode(mode, time);
 }
 
@@ -860,6 +1724,11 @@ void Engine::RenderModelsByRenderMode(
 
     for (auto entity : entities)
     {
+        if (!IsInView(entity))
+        {
+            continue;
+        }
+
         if (!SetupRenderComponent(entity, mode))
         {
             continue;
@@ -875,20 +1744,88 @@ void Engine::RenderModelsByRenderMode(
         auto modelComponent = _registry.get<ModelComponent>(entity);
         auto model = bspAsset->_models[modelComponent.Model];
 
+        // Lightmaps live in a few atlas pages, so only rebind when the page or texture changes
+        size_t boundTexture = std::numeric_limits<size_t>::max();
+        unsigned int boundLightmap = std::numeric_limits<unsigned int>::max();
+
+        // Only the world is split into leafs, brush entities are drawn whole
+        bool useVisibility = modelComponent.Model == 0;
+
+        // The faces come sorted by texture and lightmap page, the visible faces of each
+        // pair are gathered into one batch and go out in a single draw
+        auto &mesh = bspAsset->_mesh;
+        size_t batchTexture = std::numeric_limits<size_t>::max();
+        unsigned int batchLightmap = std::numeric_limits<unsigned int>::max();
+
         for (int i = model.firstFace; i < model.firstFace + model.faceCount; i++)
         {
-            if (_faces[i].flags > 0)
+            int f = mesh._drawOrder[i];
+            auto &face = bspAsset->_faces[f];
+            auto &range = mesh._faceRanges[f];
+
+            if (face.flags > 0 || range.indexCount == 0)
+            {
+                continue;
+            }
+
+            if (useVisibility && _faceVisFrames[f] != _visFrame)
             {
                 continue;
             }
 
-            _renderer->BindTexture(_textureIndices[_faces[i].texture]);
+            if (face.texture != batchTexture || face.lightmap != batchLightmap)
+            {
+                RenderModelBatch(batchTexture, batchLightmap, boundTexture, boundLightmap);
+
+                batchTexture = face.texture;
+                batchLightmap = face.lightmap;
+            }
 
-            _renderer->BindLightmap(_lightmapIndices[_faces[i].lightmap]);
+            int firstIndex = _firstWorldIndex + range.firstIndex;
 
-            _renderer->RenderTriangleFans(_faces[i].firstVertex, _faces[i].vertexCount);
+            // Faces next to each other in the index list merge into one range
+            if (!_batchFirstIndices.empty() && _batchFirstIndices.back() + _batchIndexCounts.back() == firstIndex)
+            {
+                _batchIndexCounts.back() += range.indexCount;
+            }
+            else
+            {
+                _batchFirstIndices.push_back(firstIndex);
+                _batchIndexCounts.push_back(range.indexCount);
+            }
         }
+
+        RenderModelBatch(batchTexture, batchLightmap, boundTexture, boundLightmap);
+    }
+}
+
+void Engine::RenderModelBatch(
+    size_t texture,
+    unsigned int lightmap,
+    size_t &boundTexture,
+    unsigned int &boundLightmap)
+{
+    if (_batchFirstIndices.empty())
+    {
+        return;
+    }
+
+    if (texture != boundTexture)
+    {
+        boundTexture = texture;
+        _renderer->BindTexture(_textureIndices[boundTexture]);
     }
+
+    if (lightmap != boundLightmap)
+    {
+        boundLightmap = lightmap;
+        _renderer->BindLightmap(_lightmapIndices[boundLightmap]);
+    }
+
+    _renderer->RenderIndexedTriangles(_batchFirstIndices, _batchIndexCounts);
+
+    _batchFirstIndices.clear();
+    _batchIndexCounts.clear();
 }
 
 void Engine::RenderSpritesByRenderMode(
@@ -911,6 +1848,11 @@ void Engine::RenderSpritesByRenderMode(
 
     for (auto entity : entities)
     {
+        if (!IsInView(entity))
+        {
+            continue;
+        }
+
         auto spriteComponent = _registry.try_get<SpriteComponent>(entity);
 
         auto asset = _assetManager->GetAsset<valve::hl1::SprAsset>(spriteComponent->AssetId);
@@ -950,9 +1892,278 @@ void Engine::RenderSpritesByRenderMode(
     }
 }
 
-void Engine::RenderStudioModelsByRenderMode(
-    RenderModes mode,
+// A fully lit lightmap texel gives the same brightness models had without lighting
+const float ModelLightScale = 1.5f / 255.0f;
+
+// Poses are built for the frame rounded down to 1/PoseFrameSteps of a frame
+const float PoseFrameSteps = 8.0f;
+
+size_t Engine::StudioPoseKeyHash::operator()(
+    const StudioPoseKey &key) const
+{
+    size_t hash = std::hash<const void *>()(key.Asset);
+
+    hash = hash * 31 + key.Sequence;
+    hash = hash * 31 + size_t(key.FrameStep);
+
+    for (auto controller : key.Controller)
+    {
+        hash = hash * 31 + size_t(controller);
+    }
+
+    hash = hash * 31 + size_t(key.Mouth);
+
+    for (auto blending : key.Blending)
+    {
+        hash = hash * 31 + size_t(blending);
+    }
+
+    return hash;
+}
+
+// How often each LOD is posed, in frames
+const int AnimationLodIntervals[AnimationLodCount] = {1, 2, 4, 8};
+
+int Engine::AnimationLod(
+    const entt::entity &entity)
+{
+    auto originComponent = _registry.try_get<OriginComponent>(entity);
+
+    // A model on its own is what is being looked at, only models in a map get a LOD
+    if (_animationLodDistance <= 0.0f || bspAsset == nullptr || originComponent == nullptr)
+    {
+        return 0;
+    }
+
+    auto distance = glm::length(originComponent->Origin - _cam.Position());
+    auto lodDistance = _animationLodDistance;
+    int lod = 0;
+
+    while (lod < AnimationLodCount - 1 && distance >= lodDistance)
+    {
+        lod++;
+        lodDistance *= 2.0f;
+    }
+
+    return lod;
+}
+
+size_t Engine::RequestPose(
+    const valve::hl1::MdlAsset *asset,
+    valve::hl1::tMDLPoseParams params,
+    bool build)
+{
+    auto frameStep = int(std::floor(params.frame * PoseFrameSteps));
+
+    params.frame = float(frameStep) / PoseFrameSteps;
+
+    StudioPoseKey key = {
+        asset,
+        params.sequence,
+        frameStep,
+        {params.controller[0], params.controller[1], params.controller[2], params.controller[3]},
+        params.mouth,
+        {params.blending[0], params.blending[1]},
+    };
+
+    auto cached = _studioPoseCache.find(key);
+
+    if (cached != _studioPoseCache.end())
+    {
+        _animationStats.PoseCacheHits++;
+
+        return cached->second;
+    }
+
+    if (!build)
+    {
+        return size_t(-1);
+    }
+
+    _animationStats.PoseCacheMisses++;
+
+    auto firstBone = _studioBones.size();
+
+    _studioPoseCache.emplace(key, firstBone);
+    _studioPoses.push_back(StudioPose{asset, params, firstBone});
+    _studioBones.resize(firstBone + asset->_boneData.size());
+
+    return firstBone;
+}
+
+void Engine::PoseStudioModels(
     std::chrono::microseconds time)
+{
+    _studioPoses.clear();
+    _studioPoseCache.clear();
+    _studioBones.clear();
+    _studioLodBlends.clear();
+    _studioLodUpdates.clear();
+    _animationStats = AnimationStats();
+    _animationStats.PoseBudget = _animationBudget;
+
+    auto entities = _registry.view<StudioComponent, StudioLodComponent>();
+
+    valve::hl1::MdlInstance instance;
+
+    // Moving the frames on and turning the settings into pose parameters is cheap and
+    // touches the components, that stays on this thread
+    for (auto entity : entities)
+    {
+        auto &studioComponent = entities.get<StudioComponent>(entity);
+        auto &lodComponent = entities.get<StudioLodComponent>(entity);
+
+        auto asset = _assetManager->GetAsset<valve::hl1::MdlAsset>(studioComponent.AssetId);
+
+        if (asset == nullptr)
+        {
+            continue;
+        }
+
+        instance.Asset = asset;
+        instance.SetMouth(studioComponent.Mouth);
+        instance.SetSequence(studioComponent.Sequence, studioComponent.Repeat);
+
+        for (int i = 0; i < 2; i++)
+        {
+            instance.SetBlending(i, studioComponent.Blending[i]);
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            instance.SetController(i, studioComponent.Controller[i]);
+        }
+
+        // Models out of view keep their time but get no pose, they are posed again
+        // from scratch once they come back
+        studioComponent.Frame = instance.Advance(studioComponent.Frame, time);
+
+        if (!IsInView(entity))
+        {
+            _animationStats.CulledModels++;
+            lodComponent.HasPose = false;
+
+            continue;
+        }
+
+        _animationStats.PosedModels++;
+
+        lodComponent.Lod = AnimationLod(entity);
+        _animationStats.LodModels[lodComponent.Lod]++;
+
+        if (lodComponent.Lod == 0)
+        {
+            lodComponent.HasPose = false;
+            studioComponent.FirstBone = RequestPose(asset, instance.Pose(), true);
+
+            continue;
+        }
+
+        lodComponent.FramesSincePose++;
+
+        auto blend = _studioLodBlends.size();
+        _studioLodBlends.push_back(StudioLodBlend{entity, &lodComponent, asset, asset->_boneData.size(), 0, size_t(-1)});
+
+        if (!lodComponent.HasPose || lodComponent.Current.size() != asset->_boneData.size())
+        {
+            // Nothing to blend from yet, this one cannot wait
+            lodComponent.HasPose = false;
+            _studioLodBlends[blend].PosedBone = RequestPose(asset, instance.Pose(), true);
+        }
+        else if (lodComponent.FramesSincePose >= AnimationLodIntervals[lodComponent.Lod])
+        {
+            _studioLodUpdates.push_back(StudioLodUpdate{asset, instance.Pose(), lodComponent.FramesSincePose, blend});
+        }
+    }
+
+    // The models that waited longest go first, what is over the budget waits for the
+    // next frame unless another model already has its pose
+    std::stable_sort(_studioLodUpdates.begin(), _studioLodUpdates.end(), [](const StudioLodUpdate &a, const StudioLodUpdate &b) {
+        return a.FramesSincePose > b.FramesSincePose;
+    });
+
+    int built = 0;
+
+    for (auto &update : _studioLodUpdates)
+    {
+        auto misses = _animationStats.PoseCacheMisses;
+        auto posedBone = RequestPose(update.Asset, update.Params, _animationBudget == 0 || built < _animationBudget);
+
+        built += _animationStats.PoseCacheMisses - misses;
+
+        if (posedBone == size_t(-1))
+        {
+            _animationStats.DeferredPoses++;
+
+            continue;
+        }
+
+        _studioLodBlends[update.Blend].PosedBone = posedBone;
+    }
+
+    for (auto &blend : _studioLodBlends)
+    {
+        blend.FirstBone = _studioBones.size();
+        _studioBones.resize(blend.FirstBone + blend.BoneCount);
+
+        _registry.get<StudioComponent>(blend.Entity).FirstBone = blend.FirstBone;
+    }
+
+    _animationStats.BlendedPoses = int(_studioLodBlends.size());
+
+    // Every pose writes its own range of bones
+    WorkerPool::Shared().ParallelFor(_studioPoses.size(), [this](size_t p) {
+        auto &pose = _studioPoses[p];
+
+        valve::hl1::BuildSkeleton(
+            pose.Asset,
+            pose.Params,
+            std::span<glm::mat4>(_studioBones).subspan(pose.FirstBone, pose.Asset->_boneData.size()));
+    });
+
+    // The reduced rate models show the pose before their last one, moving towards the
+    // last one over their interval, so they are always between two real poses. The
+    // blend is on the local bones so the skeleton stays rigid. It costs about as much
+    // as building a skeleton, so it runs on the pool as well, once every pose is done.
+    WorkerPool::Shared().ParallelFor(_studioLodBlends.size(), [this](size_t b) {
+        auto &blend = _studioLodBlends[b];
+        auto &lodComponent = *blend.Lod;
+
+        if (blend.PosedBone != size_t(-1))
+        {
+            if (lodComponent.HasPose)
+            {
+                lodComponent.Previous.swap(lodComponent.Current);
+            }
+
+            lodComponent.Current.resize(blend.BoneCount);
+            valve::hl1::LocalBones(
+                blend.Asset,
+                std::span<const glm::mat4>(_studioBones).subspan(blend.PosedBone, blend.BoneCount),
+                lodComponent.Current);
+
+            if (!lodComponent.HasPose)
+            {
+                lodComponent.Previous = lodComponent.Current;
+            }
+
+            lodComponent.HasPose = true;
+            lodComponent.FramesSincePose = 0;
+        }
+
+        auto t = std::min(float(lodComponent.FramesSincePose) / float(AnimationLodIntervals[lodComponent.Lod]), 1.0f);
+
+        valve::hl1::BlendSkeletons(
+            blend.Asset,
+            lodComponent.Previous,
+            lodComponent.Current,
+            t,
+            std::span<glm::mat4>(_studioBones).subspan(blend.FirstBone, blend.BoneCount));
+    });
+}
+
+void Engine::RenderStudioModelsByRenderMode(
+    RenderModes mode)
 {
     if (mode == RenderModes::GlowBlending)
     {
@@ -969,11 +2180,18 @@ void Engine::RenderStudioModelsByRenderMode(
     _defaultShader->use();
     _defaultShader->setupSpriteType(9);
     _defaultShader->setupColor(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
-    _defaultShader->setupBrightness(0.5f);
 
-    valve::hl1::MdlInstance _mdlInstance;
+    // In a map the models are lit by the lightmaps below them, on their own they are
+    // drawn at the same brightness as before
+    _defaultShader->setupBrightness(bspAsset != nullptr ? 0.0f : 0.5f);
+
     for (auto entity : entities)
     {
+        if (!IsInView(entity))
+        {
+            continue;
+        }
+
         auto studioComponent = _registry.try_get<StudioComponent>(entity);
 
         auto asset = _assetManager->GetAsset<valve::hl1::MdlAsset>(studioComponent->AssetId);
@@ -983,21 +2201,14 @@ void Engine::RenderStudioModelsByRenderMode(
             continue;
         }
 
-        _mdlInstance.Asset = asset;
-        _mdlInstance.SetMouth(studioComponent->Mouth);
-        _mdlInstance.SetSequence(studioComponent->Sequence, studioComponent->Repeat);
+        auto light = glm::vec3(1.0f);
 
-        for (int i = 0; i < 4; i++)
+        if (bspAsset != nullptr)
         {
-            _mdlInstance.SetBlending(i, studioComponent->Blending[i]);
-            _mdlInstance.SetController(i, studioComponent->Controller[i]);
+            light = _lightGrid.LightAt(_registry.get<OriginComponent>(entity).Origin) * ModelLightScale;
         }
 
-        studioComponent->Frame = _mdlInstance.Update(studioComponent->Frame, time);
-
-        _defaultShader->BindBones(_mdlInstance._bonetransform, _mdlInstance.Asset->_boneData.size());
-
-        if (!SetupRenderComponent(entity, mode))
+        if (!SetupRenderComponent(entity, mode, light))
         {
             continue;
         }
@@ -1007,6 +2218,9 @@ void Engine::RenderStudioModelsByRenderMode(
             continue;
         }
 
+        // Posed in PoseStudioModels() for this frame
+        _defaultShader->BindBones(_studioBones.data() + studioComponent->FirstBone, asset->_boneData.size());
+
         _vertexBuffer.bind();
 
         std::set<size_t> indices;
@@ -1038,9 +2252,18 @@ void Engine::RenderStudioModelsByRenderMode(
     }
 }
 
+bool Engine::IsInView(
+    const entt::entity &entity)
+{
+    auto bounds = _registry.try_get<BoundsComponent>(entity);
+
+    return bounds == nullptr || bounds->VisibleFrame == _visFrame;
+}
+
 bool Engine::SetupRenderComponent(
     const entt::entity &entity,
-    RenderModes mode)
+    RenderModes mode,
+    const glm::vec3 &light)
 {
     auto renderComponent = _registry.get<RenderComponent>(entity);
 
@@ -1052,20 +2275,20 @@ bool Engine::SetupRenderComponent(
     if (mode == RenderModes::TextureBlending || mode == RenderModes::SolidBlending)
     {
         _defaultShader->setupColor(
-            glm::vec4(1.0f, 1.0f, 1.0f, float(renderComponent.Amount) / 255.0f));
+            glm::vec4(light, float(renderComponent.Amount) / 255.0f));
     }
     else if (mode == RenderModes::ColorBlending)
     {
         _defaultShader->setupColor(
             glm::vec4(
-                float(renderComponent.Color[0] / 255.0f),
-                float(renderComponent.Color[1] / 255.0f),
-                float(renderComponent.Color[2] / 255.0f),
+                light.r * float(renderComponent.Color[0] / 255.0f),
+                light.g * float(renderComponent.Color[1] / 255.0f),
+                light.b * float(renderComponent.Color[2] / 255.0f),
                 float(renderComponent.Amount) / 255.0f));
     }
     else
     {
-        _defaultShader->setupColor(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+        _defaultShader->setupColor(glm::vec4(light, 1.0f));
     }
 
     return true;
@@ -0,0 +1,76 @@
+#include "frustum.h"
+
+void Frustum::Update(
+    const glm::mat4 &viewProjection)
+{
+    auto row = [&viewProjection](int i) {
+        return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    };
+
+    _planes[0] = row(3) + row(0); // left
+    _planes[1] = row(3) - row(0); // right
+    _planes[2] = row(3) + row(1); // bottom
+    _planes[3] = row(3) - row(1); // top
+    _planes[4] = row(3) + row(2); // near
+    _planes[5] = row(3) - row(2); // far
+
+    for (auto &plane : _planes)
+    {
+        auto length = glm::length(glm::vec3(plane));
+
+        if (length > 0.0f)
+        {
+            plane /= length;
+        }
+    }
+}
+
+bool Frustum::CullBox(
+    const glm::vec3 &mins,
+    const glm::vec3 &maxs,
+    int &planeMask) const
+{
+    for (int i = 0; i < 6; i++)
+    {
+        int bit = 1 << i;
+
+        if ((planeMask & bit) == 0)
+        {
+            continue;
+        }
+
+        auto &plane = _planes[i];
+
+        // The corners furthest along and furthest against the plane normal
+        glm::vec3 inner(
+            plane.x >= 0.0f ? maxs.x : mins.x,
+            plane.y >= 0.0f ? maxs.y : mins.y,
+            plane.z >= 0.0f ? maxs.z : mins.z);
+
+        glm::vec3 outer(
+            plane.x >= 0.0f ? mins.x : maxs.x,
+            plane.y >= 0.0f ? mins.y : maxs.y,
+            plane.z >= 0.0f ? mins.z : maxs.z);
+
+        if (glm::dot(glm::vec3(plane), inner) + plane.w < 0.0f)
+        {
+            return true;
+        }
+
+        if (glm::dot(glm::vec3(plane), outer) + plane.w >= 0.0f)
+        {
+            planeMask &= ~bit;
+        }
+    }
+
+    return false;
+}
+
+bool Frustum::CullBox(
+    const glm::vec3 &mins,
+    const glm::vec3 &maxs) const
+{
+    int planeMask = AllPlanes;
+
+    return CullBox(mins, maxs, planeMask);
+}
@@ -116,6 +116,20 @@ BufferType &BufferType::bone(
     return *this;
 }
 
+BufferType &BufferType::index(
+    unsigned int index)
+{
+    _indices.push_back(index);
+    _indexCount = static_cast<GLsizei>(_indices.size());
+
+    return *this;
+}
+
+int BufferType::indexCount() const
+{
+    return _indexCount;
+}
+
 bool BufferType::upload()
 {
     _vertexCount = static_cast<GLsizei>(_verts.size());
@@ -125,6 +139,9 @@ bool BufferType::upload()
         return true;
     }
 
+    // Uploading again replaces what was on the GPU
+    DeleteObjects();
+
     glGenVertexArrays(1, &_vertexArrayId);
     glGenBuffers(1, &_vertexBufferId);
 
@@ -143,12 +160,27 @@ bool BufferType::upload()
         GLsizeiptr(_verts.size() * sizeof(VertexType)),
         reinterpret_cast<const GLvoid *>(&_verts[0]));
 
+    if (!_indices.empty())
+    {
+        glGenBuffers(1, &_indexBufferId);
+
+        // The element buffer binding is part of the vertex array state
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBufferId);
+
+        glBufferData(
+            GL_ELEMENT_ARRAY_BUFFER,
+            GLsizeiptr(_indices.size() * sizeof(unsigned int)),
+            reinterpret_cast<const GLvoid *>(&_indices[0]),
+            GL_STATIC_DRAW);
+    }
+
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
     glEnableVertexAttribArray(3);
 
     _verts.clear();
+    _indices.clear();
 
     return true;
 }
@@ -166,6 +198,21 @@ void BufferType::unbind()
 
 void BufferType::cleanup()
 {
+    DeleteObjects();
+
+    _verts.clear();
+    _indices.clear();
+    _vertexCount = 0;
+    _indexCount = 0;
+}
+
+void BufferType::DeleteObjects()
+{
+    if (_indexBufferId != 0)
+    {
+        glDeleteBuffers(1, &_indexBufferId);
+        _indexBufferId = 0;
+    }
     if (_vertexBufferId != 0)
     {
         glDeleteBuffers(1, &_vertexBufferId);
@@ -0,0 +1,157 @@
+#include "mappedfile.h"
+
+#include <print>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() = default;
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(
+    const std::filesystem::path &path)
+{
+    Close();
+
+#ifdef _WIN32
+    auto file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::println("[ERR] failed to open {} for mapping", path.string());
+
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+
+        return false;
+    }
+
+    auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mapping == nullptr)
+    {
+        std::println("[ERR] failed to create file mapping for {}", path.string());
+
+        CloseHandle(file);
+
+        return false;
+    }
+
+    auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (data == nullptr)
+    {
+        std::println("[ERR] failed to map view of {}", path.string());
+
+        CloseHandle(mapping);
+        CloseHandle(file);
+
+        return false;
+    }
+
+    _fileHandle = file;
+    _mappingHandle = mapping;
+    _data = reinterpret_cast<const unsigned char *>(data);
+    _size = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+    {
+        std::println("[ERR] failed to open {} for mapping", path.string());
+
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+
+        return false;
+    }
+
+    auto data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps its own reference to the file
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        std::println("[ERR] failed to map {}", path.string());
+
+        return false;
+    }
+
+    _data = reinterpret_cast<const unsigned char *>(data);
+    _size = static_cast<size_t>(st.st_size);
+#endif
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (_data == nullptr)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+    CloseHandle(_mappingHandle);
+    CloseHandle(_fileHandle);
+
+    _mappingHandle = nullptr;
+    _fileHandle = nullptr;
+#else
+    munmap(const_cast<unsigned char *>(_data), _size);
+#endif
+
+    _data = nullptr;
+    _size = 0;
+}
+
+bool MappedFile::IsOpen() const
+{
+    return _data != nullptr;
+}
+
+const unsigned char *MappedFile::Data() const
+{
+    return _data;
+}
+
+size_t MappedFile::Size() const
+{
+    return _size;
+}
+
+std::span<const unsigned char> MappedFile::View(
+    size_t offset,
+    size_t count) const
+{
+    if (_data == nullptr || offset > _size || count > _size - offset)
+    {
+        return {};
+    }
+
+    return std::span<const unsigned char>(_data + offset, count);
+}
@@ -103,16 +103,22 @@ PhysicsComponent PhysicsService::AddCharacter(
 }
 
 PhysicsComponent PhysicsService::AddStatic(
-    const std::vector<glm::vec3> &t)
+    const std::vector<glm::vec3> &vertices,
+    const std::vector<uint32_t> &indices)
 {
     auto mesh = new btTriangleMesh();
 
-    for (size_t i = 0; i < t.size(); i += 3)
+    mesh->preallocateVertices(int(vertices.size()));
+    mesh->preallocateIndices(int(indices.size()));
+
+    for (auto &v : vertices)
+    {
+        mesh->findOrAddVertex(btVector3(v.x * scalef, v.y * scalef, v.z * scalef), false);
+    }
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
     {
-        mesh->addTriangle(
-            btVector3(t[i + 0].x * scalef, t[i + 0].y * scalef, t[i + 0].z * scalef),
-            btVector3(t[i + 1].x * scalef, t[i + 1].y * scalef, t[i + 1].z * scalef),
-            btVector3(t[i + 2].x * scalef, t[i + 2].y * scalef, t[i + 2].z * scalef));
+        mesh->addTriangleIndices(int(indices[i + 0]), int(indices[i + 1]), int(indices[i + 2]));
     }
 
     auto shape = new btBvhTriangleMeshShape(mesh, true);
@@ -205,6 +211,27 @@ void PhysicsService::Step(
     //    mDynamicsWorld->stepSimulation(static_cast<double>(diff.count()) / 100.0, 1, btScalar(1.0f / 120.0f));
 }
 
+void PhysicsService::Clear()
+{
+    for (auto body : _rigidBodies)
+    {
+        mDynamicsWorld->removeRigidBody(body);
+
+        auto shape = body->getCollisionShape();
+
+        // The static meshes own their triangles
+        if (auto meshShape = dynamic_cast<btBvhTriangleMeshShape *>(shape); meshShape != nullptr)
+        {
+            delete meshShape->getMeshInterface();
+        }
+
+        delete shape;
+        delete body;
+    }
+
+    _rigidBodies.clear();
+}
+
 void PhysicsService::JumpCharacter(
     const PhysicsComponent &component,
     const glm::vec3 &direction)
@@ -1,37 +1,101 @@
 #include <valve/bsp/hl1bspasset.h>
 
 #include "stb_rect_pack.h"
+#include <algorithm>
 #include <format>
-#include <glm/gtx/string_cast.hpp>
 #include <print>
 #include <stb_image.h>
+#include <valve/bsp/hl1bspcache.h>
 #include <valve/bsp/hl1bsptypes.h>
+#include <valve/hlpalette.h>
+#include <workerpool.h>
 
 namespace fs = std::filesystem;
 using namespace valve::hl1;
 
 BspFile::BspFile(
-    byte *data)
-    : _entityData(LoadLump<byte, HL1_BSP_ENTITYLUMP>(data)),
-      _planes(LoadLump<tBSPPlane, HL1_BSP_PLANELUMP>(data)),
-      _textureData(LoadLump<byte, HL1_BSP_TEXTURELUMP>(data)),
-      _verticesData(LoadLump<tBSPVertex, HL1_BSP_VERTEXLUMP>(data)),
-      _visData(LoadLump<byte, HL1_BSP_VISIBILITYLUMP>(data)),
-      _nodeData(LoadLump<tBSPNode, HL1_BSP_NODELUMP>(data)),
-      _texinfoData(LoadLump<tBSPTexInfo, HL1_BSP_TEXINFOLUMP>(data)),
-      _faceData(LoadLump<tBSPFace, HL1_BSP_FACELUMP>(data)),
-      _lightingData(LoadLump<byte, HL1_BSP_LIGHTINGLUMP>(data)),
-      _clipnodeData(LoadLump<tBSPClipNode, HL1_BSP_CLIPNODELUMP>(data)),
-      _leafData(LoadLump<tBSPLeaf, HL1_BSP_LEAFLUMP>(data)),
-      _marksurfaceData(LoadLump<unsigned short, HL1_BSP_MARKSURFACELUMP>(data)),
-      _edgeData(LoadLump<tBSPEdge, HL1_BSP_EDGELUMP>(data)),
-      _surfedgeData(LoadLump<int, HL1_BSP_SURFEDGELUMP>(data)),
-      _modelData(LoadLump<tBSPModel, HL1_BSP_MODELLUMP>(data))
-{}
+    std::vector<byte> &&data)
+    : _ownedData(std::move(data))
+{
+    _data = std::span<const byte>(_ownedData.data(), _ownedData.size());
+
+    MapLumps();
+}
+
+BspFile::BspFile(
+    std::unique_ptr<MappedFile> &&mappedFile)
+    : _mappedFile(std::move(mappedFile))
+{
+    _data = std::span<const byte>(_mappedFile->Data(), _mappedFile->Size());
+
+    MapLumps();
+}
+
+BspFile::BspFile(
+    std::span<const byte> data)
+    : _data(data)
+{
+    MapLumps();
+}
+
+bool BspFile::IsValid() const
+{
+    return _valid;
+}
+
+std::span<const valve::byte> BspFile::Data() const
+{
+    return _data;
+}
+
+void BspFile::MapLumps()
+{
+    _valid = false;
+
+    if (_data.size() < sizeof(tBSPHeader))
+    {
+        return;
+    }
+
+    auto header = reinterpret_cast<const tBSPHeader *>(_data.data());
+
+    if (header->signature != HL1_BSP_SIGNATURE)
+    {
+        return;
+    }
+
+    // LoadLump() clears this when a lump points outside the buffer
+    _valid = true;
+
+    _entityData = LoadLump<byte, HL1_BSP_ENTITYLUMP>(*header);
+    _planes = LoadLump<tBSPPlane, HL1_BSP_PLANELUMP>(*header);
+    _textureData = LoadLump<byte, HL1_BSP_TEXTURELUMP>(*header);
+    _verticesData = LoadLump<tBSPVertex, HL1_BSP_VERTEXLUMP>(*header);
+    _visData = LoadLump<byte, HL1_BSP_VISIBILITYLUMP>(*header);
+    _nodeData = LoadLump<tBSPNode, HL1_BSP_NODELUMP>(*header);
+    _texinfoData = LoadLump<tBSPTexInfo, HL1_BSP_TEXINFOLUMP>(*header);
+    _faceData = LoadLump<tBSPFace, HL1_BSP_FACELUMP>(*header);
+    _lightingData = LoadLump<byte, HL1_BSP_LIGHTINGLUMP>(*header);
+    _clipnodeData = LoadLump<tBSPClipNode, HL1_BSP_CLIPNODELUMP>(*header);
+    _leafData = LoadLump<tBSPLeaf, HL1_BSP_LEAFLUMP>(*header);
+    _marksurfaceData = LoadLump<unsigned short, HL1_BSP_MARKSURFACELUMP>(*header);
+    _edgeData = LoadLump<tBSPEdge, HL1_BSP_EDGELUMP>(*header);
+    _surfedgeData = LoadLump<int, HL1_BSP_SURFEDGELUMP>(*header);
+    _modelData = LoadLump<tBSPModel, HL1_BSP_MODELLUMP>(*header);
+
+    if (_valid && (_entityData.empty() || _modelData.empty() || _textureData.size() < sizeof(int)))
+    {
+        _valid = false;
+    }
+}
 
 BspAsset::BspAsset(
-    IFileSystem *fs)
-    : Asset(fs)
+    IFileSystem *fs,
+    WadLibrary *wadLibrary,
+    bool compressTextures)
+    : Asset(fs),
+      _wadLibrary(wadLibrary),
+      _compressTextures(compressTextures)
 {}
 
 BspAsset::~BspAsset() = default;
@@ -48,37 +112,115 @@ bool BspAsset::Load(
 
     auto fullpath = std::filesystem::path(location) / filename;
 
-    std::vector<byte> data;
+    // Prefer a view into a mapped pak, then a mapping of the loose file, and only
+    // copy the file into memory when neither of those is available
+    auto view = _fs->ViewFile(fullpath.string());
 
-    if (!_fs->LoadFile(fullpath.string(), data))
+    if (!view.empty())
+    {
+        _bspFile = std::make_unique<BspFile>(view);
+    }
+    else
     {
+        // Only loose files can be mapped, a path inside a pak that could not be
+        // viewed goes straight to the copy
+        std::error_code ec;
+        auto mappedFile = std::make_unique<MappedFile>();
+
+        if (std::filesystem::is_regular_file(fullpath, ec) && mappedFile->Open(fullpath))
+        {
+            _bspFile = std::make_unique<BspFile>(std::move(mappedFile));
+        }
+        else
+        {
+            std::vector<byte> data;
+
+            if (!_fs->LoadFile(fullpath.string(), data))
+            {
+                return false;
+            }
+
+            _bspFile = std::make_unique<BspFile>(std::move(data));
+        }
+    }
+
+    if (!_bspFile->IsValid())
+    {
+        std::println("[ERR] {} is not a valid bsp file", fullpath.string());
+
         return false;
     }
 
-    _bspFile = std::make_unique<BspFile>(data.data());
+    // The vis lump stays compressed, rows are expanded when they are needed
+    _visibility.Attach(_bspFile->_visData, _bspFile->_leafData, _bspFile->_modelData[0].visLeafs);
 
-    _entities = BspAsset::LoadEntities(_bspFile);
+    _collision.Attach(_bspFile->_planes, _bspFile->_nodeData, _bspFile->_leafData, _bspFile->_clipnodeData, _bspFile->_modelData);
+
+    // A baked cache of the same bsp replaces all the parsing and decoding below
+    auto contentHash = BspCache::Hash(_bspFile->Data());
+    auto cachePath = BspCache::CachePath(location, filename);
+
+    if (BspCache::Read(cachePath, contentHash, *this))
+    {
+        std::println("[DBG] loaded {} from level cache {}", filename, cachePath.string());
+
+        // A cache written while compression was off has no blocks
+        if (_compressTextures)
+        {
+            WorkerPool::Shared().ParallelFor(_textures.size(), [this](size_t t) {
+                if (_textures[t] != nullptr && _textures[t]->BlockFormat() == BlockFormats::None)
+                {
+                    _textures[t]->Compress();
+                }
+            });
+        }
+
+        auto worldspawn = FindEntityByClassname("worldspawn");
+        if (worldspawn != nullptr)
+        {
+            _worldspawn = *worldspawn;
+        }
 
-    //    _visLeafs = BspAsset::LoadVisLeafs(_bspFile);
+        IndexLightStyles();
+
+        return true;
+    }
+
+    _entities = BspAsset::LoadEntities(_bspFile);
 
-    std::vector<WadAsset *> wads;
     _worldspawn = _entities.front();
     if (_worldspawn.classname != "worldspawn")
     {
         _worldspawn = *FindEntityByClassname("worldspawn");
     }
 
-    wads = WadAsset::LoadWads(_worldspawn.keyvalues["wad"], _fs);
+    {
+        WadLibrary ownWadLibrary(_fs);
+
+        auto &wadLibrary = _wadLibrary != nullptr ? *_wadLibrary : ownWadLibrary;
 
-    LoadTextures(_textures, wads);
-    WadAsset::UnloadWads(wads);
+        auto wads = wadLibrary.Acquire(_worldspawn.keyvalues["wad"]);
 
-    LoadFacesWithLightmaps(_faces, _lightMaps, _vertices);
+        LoadTextures(_textures, wadLibrary, wads);
+    }
+
+    std::vector<tVertex> fanVertices;
+
+    LoadFacesWithLightmaps(_faces, _lightMaps, fanVertices);
 
     LoadModels();
 
+    BuildMesh(fanVertices);
+
     LoadSkyTextures();
 
+    IndexLightStyles();
+
+    if (!BspCache::Write(cachePath, contentHash, *this))
+    {
+        std::println("[WRN] failed to write level cache {}", cachePath.string());
+    }
+
     return true;
 }
 
@@ -177,6 +319,11 @@ bool valve::hl1::BspAsset::LoadSkyTextures()
             _skytextures[i]->SetData(x, y, n, data, false);
             _skytextures[i]->EnsureFullOpacity();
 
+            if (_compressTextures)
+            {
+                _skytextures[i]->Compress(&WorkerPool::Shared());
+            }
+
             stbi_image_free(data);
         }
         else
@@ -244,93 +391,63 @@ tBSPEntity *BspAsset::FindEntityByClassname(
     return nullptr;
 }
 
-std::vector<tBSPVisLeaf> BspAsset::LoadVisLeafs(
-    std::unique_ptr<BspFile> &bspFile)
+// Lightmaps are packed into square pages of this size, each lightmap gets a
+// 1 texel border so bilinear filtering does not bleed into its neighbours
+const int LightmapAtlasPageSize = 1024;
+const int LightmapAtlasBorder = 1;
+
+bool BspAsset::LoadFacesWithLightmaps(
+    std::vector<tFace> &faces,
+    std::vector<Texture *> &lightmaps,
+    std::vector<tVertex> &vertices)
 {
-    std::vector<tBSPVisLeaf> visLeafs = std::vector<tBSPVisLeaf>(bspFile->_leafData.size());
+    auto faceCount = _bspFile->_faceData.size();
+
+    // The extents are needed twice, once for packing and once for the texcoords
+    std::vector<glm::vec4> extents(faceCount);
+    std::vector<glm::ivec2> sizes(faceCount + 1);
 
-    for (unsigned int i = 0; i < bspFile->_leafData.size(); i++)
+    for (size_t f = 0; f < faceCount; f++)
     {
-        visLeafs[i].leafs = 0;
-        visLeafs[i].leafCount = 0;
-        int visOffset = bspFile->_leafData[i].visofs;
+        float min[2], max[2];
+        CalculateSurfaceExtents(_bspFile->_faceData[f], min, max);
 
-        for (int j = 1; j < bspFile->_modelData[0].visLeafs; visOffset++)
-        {
-            if (bspFile->_visData[visOffset] == 0)
-            {
-                visOffset++;
-                j += (bspFile->_visData[visOffset] << 3);
-            }
-            else
-            {
-                for (byte bit = 1; bit; bit <<= 1, j++)
-                {
-                    if (bspFile->_visData[visOffset] & bit)
-                        visLeafs[i].leafCount++;
-                }
-            }
-        }
+        extents[f] = glm::vec4(min[0], min[1], max[0], max[1]);
 
-        if (visLeafs[i].leafCount > 0)
-        {
-            visLeafs[i].leafs = new int[visLeafs[i].leafCount];
-            if (visLeafs[i].leafs == 0)
-                return visLeafs;
-        }
+        int size[2];
+        CalculateLightmapSize(min, max, size);
+
+        sizes[f] = glm::ivec2(size[0], size[1]);
     }
 
-    for (unsigned int i = 0; i < bspFile->_leafData.size(); i++)
+    // All faces with special flags share one white lightmap, stored after the faces
+    const size_t whiteLightmap = faceCount;
+    sizes[whiteLightmap] = glm::ivec2(8, 8);
+
+    std::vector<tLightmapRegion> regions;
+
+    if (!PackLightmaps(sizes, regions, lightmaps))
     {
-        int visOffset = bspFile->_leafData[i].visofs;
-        int index = 0;
-        for (int j = 1; j < bspFile->_modelData[0].visLeafs; visOffset++)
-        {
-            if (bspFile->_visData[visOffset] == 0)
-            {
-                visOffset++;
-                j += (bspFile->_visData[visOffset] << 3);
-            }
-            else
-            {
-                for (byte bit = 1; bit; bit <<= 1, j++)
-                {
-                    if (bspFile->_visData[visOffset] & bit)
-                    {
-                        visLeafs[i].leafs[index++] = j;
-                    }
-                }
-            }
-        }
+        return false;
     }
 
-    return visLeafs;
-}
+    // The atlas starts out with every style at its value at time 0
+    BspLightStyles styles;
 
-bool BspAsset::LoadFacesWithLightmaps(
-    std::vector<tFace> &faces,
-    std::vector<Texture *> &tempLightmaps,
-    std::vector<tVertex> &vertices)
-{
-    // Allocate the arrays for faces and lightmaps
-    tempLightmaps.resize(_bspFile->_faceData.size());
+    LoadLightmap(tBSPFace{.lightOffset = -1}, *lightmaps[regions[whiteLightmap].page], regions[whiteLightmap], styles);
 
-    Texture whiteTexture;
-    unsigned char data[8 * 8 * 3];
-    memset(data, 255, 8 * 8 * 3);
-    whiteTexture.SetData(8, 8, 3, data);
+    _lightmapRegions.resize(faceCount);
 
-    for (unsigned int f = 0; f < _bspFile->_faceData.size(); f++)
+    for (unsigned int f = 0; f < faceCount; f++)
     {
-        tBSPFace &in = _bspFile->_faceData[f];
-        tBSPMipTexHeader *mip = GetMiptex(_bspFile->_texinfoData[in.texinfo].miptexIndex);
+        const tBSPFace &in = _bspFile->_faceData[f];
+        const tBSPMipTexHeader *mip = GetMiptex(_bspFile->_texinfoData[in.texinfo].miptexIndex);
         tFace out;
 
         out.firstVertex = int(vertices.size());
         out.vertexCount = in.edgeCount;
         out.flags = _bspFile->_texinfoData[in.texinfo].flags;
         out.texture = _bspFile->_texinfoData[in.texinfo].miptexIndex;
-        out.lightmap = f;
         out.plane = glm::vec4(
             _bspFile->_planes[in.planeIndex].normal[0],
             _bspFile->_planes[in.planeIndex].normal[1],
@@ -346,30 +463,31 @@ bool BspAsset::LoadFacesWithLightmaps(
             out.plane[3] = -out.plane[3];
         }
 
-        // Calculate and grab the lightmap buffer
-        float min[2], max[2];
-        CalculateSurfaceExtents(in, min, max);
-
-        tempLightmaps[f] = new Texture();
-        tempLightmaps[f]->SetRepeat(false);
-
         // Skip the lightmaps for faces with special flags
         if (out.flags == 0)
         {
-            if (!LoadLightmap(in, *tempLightmaps[f], min, max))
+            _lightmapRegions[f] = regions[f];
+
+            if (!LoadLightmap(in, *lightmaps[regions[f].page], regions[f], styles))
             {
                 std::println("[ERR] failed to load lightmap {}", f);
             }
         }
         else
         {
-            tempLightmaps[f]->CopyFrom(whiteTexture);
+            _lightmapRegions[f] = regions[whiteLightmap];
         }
 
-        float lw = float(tempLightmaps[f]->Width());
-        float lh = float(tempLightmaps[f]->Height());
-        float halfsizew = (min[0] + max[0]) / 2.0f;
-        float halfsizeh = (min[1] + max[1]) / 2.0f;
+        auto &region = _lightmapRegions[f];
+
+        out.lightmap = static_cast<unsigned int>(region.page);
+
+        float lw = float(region.width);
+        float lh = float(region.height);
+        float halfsizew = (extents[f][0] + extents[f][2]) / 2.0f;
+        float halfsizeh = (extents[f][1] + extents[f][3]) / 2.0f;
+        float pagew = float(lightmaps[region.page]->Width());
+        float pageh = float(lightmaps[region.page]->Height());
 
         // Create a vertex list for this face
         for (int e = 0; e < in.edgeCount; e++)
@@ -387,39 +505,132 @@ bool BspAsset::LoadFacesWithLightmaps(
             // Reset the bone so its not used
             v.bone = -1;
 
-            tBSPTexInfo &ti = _bspFile->_texinfoData[in.texinfo];
+            const tBSPTexInfo &ti = _bspFile->_texinfoData[in.texinfo];
             float s = glm::dot(v.position, glm::vec3(ti.vecs[0][0], ti.vecs[0][1], ti.vecs[0][2])) + ti.vecs[0][3];
             float t = glm::dot(v.position, glm::vec3(ti.vecs[1][0], ti.vecs[1][1], ti.vecs[1][2])) + ti.vecs[1][3];
 
             // Calculate the texture texcoords
             v.texcoords[0] = glm::vec2(s / float(mip->width), t / float(mip->height));
 
-            // Calculate the lightmap texcoords
-            v.texcoords[1] = glm::vec2(((lw / 2.0f) + (s - halfsizew) / 16.0f) / lw, ((lh / 2.0f) + (t - halfsizeh) / 16.0f) / lh);
+            // Calculate the lightmap texcoords within the region of this face in the atlas page
+            v.texcoords[1] = glm::vec2(
+                (float(region.x) + (lw / 2.0f) + (s - halfsizew) / 16.0f) / pagew,
+                (float(region.y) + (lh / 2.0f) + (t - halfsizeh) / 16.0f) / pageh);
 
             vertices.push_back(v);
         }
         faces.push_back(out);
     }
 
+    std::println("[DBG] packed {} lightmaps into {} atlas pages", faceCount, lightmaps.size());
+
+    return true;
+}
+
+bool BspAsset::PackLightmaps(
+    const std::vector<glm::ivec2> &sizes,
+    std::vector<tLightmapRegion> &regions,
+    std::vector<Texture *> &pages)
+{
+    regions.resize(sizes.size());
+
+    std::vector<stbrp_rect> pending;
+    pending.reserve(sizes.size());
+
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        stbrp_rect rect = {};
+
+        rect.id = int(i);
+        rect.w = stbrp_coord(sizes[i].x + LightmapAtlasBorder * 2);
+        rect.h = stbrp_coord(sizes[i].y + LightmapAtlasBorder * 2);
+
+        if (rect.w > LightmapAtlasPageSize || rect.h > LightmapAtlasPageSize)
+        {
+            std::println("[ERR] lightmap {} of {}x{} does not fit an atlas page", i, sizes[i].x, sizes[i].y);
+
+            return false;
+        }
+
+        pending.push_back(rect);
+    }
+
+    std::vector<stbrp_node> nodes(LightmapAtlasPageSize);
+
+    // Fill one page at a time, whatever does not fit goes to the next page
+    while (!pending.empty())
+    {
+        stbrp_context context;
+        stbrp_init_target(&context, LightmapAtlasPageSize, LightmapAtlasPageSize, nodes.data(), int(nodes.size()));
+        stbrp_pack_rects(&context, pending.data(), int(pending.size()));
+
+        auto page = int(pages.size());
+        std::vector<stbrp_rect> next;
+
+        for (auto &rect : pending)
+        {
+            if (!rect.was_packed)
+            {
+                next.push_back(rect);
+
+                continue;
+            }
+
+            auto &region = regions[rect.id];
+
+            region.page = page;
+            region.x = rect.x + LightmapAtlasBorder;
+            region.y = rect.y + LightmapAtlasBorder;
+            region.width = sizes[rect.id].x;
+            region.height = sizes[rect.id].y;
+        }
+
+        if (next.size() == pending.size())
+        {
+            std::println("[ERR] failed to pack {} lightmaps", next.size());
+
+            return false;
+        }
+
+        auto texture = new Texture();
+        texture->SetDimentions(LightmapAtlasPageSize, LightmapAtlasPageSize, 3);
+        texture->SetRepeat(false);
+        pages.push_back(texture);
+
+        pending = std::move(next);
+    }
+
     return true;
 }
 
 bool BspAsset::LoadTextures(
     std::vector<Texture *> &textures,
+    WadLibrary &wadLibrary,
     const std::vector<WadAsset *> &wads)
 {
-    auto count = int(*_bspFile->_textureData.data());
-    auto offsetPtr = (int *)(_bspFile->_textureData.data() + sizeof(int));
-    std::vector<int> textureTable(offsetPtr, offsetPtr + count);
+    auto table = reinterpret_cast<const tBSPMipTexOffsetTable *>(_bspFile->_textureData.data());
+    auto count = table->miptexCount;
 
-    for (int t = 0; t < int(*_bspFile->_textureData.data()); t++)
+    if (count < 0 || sizeof(int) * (size_t(count) + 1) > _bspFile->_textureData.size())
     {
-        std::println("[TRA] texture #{} @ {}", t, textureTable[t]);
+        std::println("[ERR] invalid miptex count {}", count);
+
+        return false;
+    }
+
+    auto firstTexture = textures.size();
+    std::vector<const unsigned char *> sources(count, nullptr);
+    std::vector<std::pair<WadAsset *, int>> wadLumps(count, std::make_pair(nullptr, -1));
 
-        if (textureTable[t] < 0)
+    // Finding the texture data may read from the wad files, which is not thread safe,
+    // so that is done up front and only the decoding is spread over the workers
+    for (int t = 0; t < count; t++)
+    {
+        std::println("[TRA] texture #{} @ {}", t, table->offsets[t]);
+
+        if (table->offsets[t] < 0)
         {
-            std::println("[DBG] skipping texture #{} with invalid data index: {}", t, textureTable[t]);
+            std::println("[DBG] skipping texture #{} with invalid data index: {}", t, table->offsets[t]);
 
             auto tex = new Texture("unknown");
 
@@ -430,9 +641,9 @@ bool BspAsset::LoadTextures(
             continue;
         }
 
-        const unsigned char *textureData = _bspFile->_textureData.data() + textureTable[t];
+        const unsigned char *textureData = _bspFile->_textureData.data() + table->offsets[t];
 
-        tBSPMipTexHeader *miptex = (tBSPMipTexHeader *)textureData;
+        const tBSPMipTexHeader *miptex = (const tBSPMipTexHeader *)textureData;
 
         auto tex = new Texture(miptex->name);
 
@@ -440,76 +651,114 @@ bool BspAsset::LoadTextures(
         {
             std::println("[TRA] looking for {} in wad files", miptex->name);
 
-            for (std::vector<WadAsset *>::const_iterator i = wads.cbegin(); i != wads.cend(); ++i)
-            {
-                WadAsset *wad = *i;
+            textureData = nullptr;
 
-                textureData = wad->LumpData(wad->IndexOf(miptex->name));
+            int lump = -1;
+            auto wad = wadLibrary.Find(wads, miptex->name, lump);
 
-                if (textureData != nullptr)
+            if (wad != nullptr)
+            {
+                // Decoded for an earlier map already
+                auto decoded = wadLibrary.FindDecoded(wad, lump);
+
+                if (decoded != nullptr)
                 {
-                    break;
+                    tex->CopyFrom(*decoded);
+                    tex->SetName(miptex->name);
+
+                    textures.push_back(tex);
+
+                    continue;
                 }
+
+                textureData = wad->LumpData(lump);
+                wadLumps[t] = std::make_pair(wad, lump);
             }
         }
 
         if (textureData != nullptr)
         {
-            miptex = (tBSPMipTexHeader *)textureData;
-            int s = miptex->width * miptex->height;
-            int bpp = 4;
-            int paletteOffset = miptex->offsets[0] + s + (s / 4) + (s / 16) + (s / 64) + sizeof(short);
+            sources[t] = textureData;
+        }
+        else
+        {
+            std::println("[ERR] texture \"{}\" not found, using default texture", miptex->name);
 
-            // Get the miptex data and palette
-            const unsigned char *source0 = textureData + miptex->offsets[0];
-            const unsigned char *palette = textureData + paletteOffset;
+            tex->DefaultTexture();
+        }
+
+        textures.push_back(tex);
+    }
 
-            unsigned char *destination = new unsigned char[s * bpp];
+    // Each texture is expanded and block compressed on its own, the results stay in table order
+    WorkerPool::Shared().ParallelFor(sources.size(), [&](size_t t) {
+        if (sources[t] != nullptr)
+        {
+            DecodeMiptex(sources[t], *textures[firstTexture + t]);
 
-            for (int i = 0; i < s; i++)
+            if (_compressTextures)
             {
-                unsigned r = palette[source0[i] * 3];
-                unsigned g = palette[source0[i] * 3 + 1];
-                unsigned b = palette[source0[i] * 3 + 2];
-                unsigned a = 255;
+                textures[firstTexture + t]->Compress();
+            }
+        }
+    });
 
-                // Do we need a transparent pixel
-                if (tex->Name()[0] == '{' && source0[i] == 255)
-                {
-                    r = g = b = a = 0;
-                }
+    for (int t = 0; t < count; t++)
+    {
+        if (sources[t] != nullptr && wadLumps[t].first != nullptr)
+        {
+            wadLibrary.StoreDecoded(wadLumps[t].first, wadLumps[t].second, *textures[firstTexture + t]);
+        }
+    }
 
-                destination[i * 4 + 0] = r;
-                destination[i * 4 + 1] = g;
-                destination[i * 4 + 2] = b;
-                destination[i * 4 + 3] = a;
-            }
+    return true;
+}
 
-            tex->SetData(miptex->width, miptex->height, bpp, destination);
+void BspAsset::DecodeMiptex(
+    const unsigned char *textureData,
+    Texture &texture)
+{
+    auto miptex = (const tBSPMipTexHeader *)textureData;
+    int s = miptex->width * miptex->height;
+    int bpp = 4;
+    int paletteOffset = miptex->offsets[0] + s + (s / 4) + (s / 16) + (s / 64) + sizeof(short);
+
+    const unsigned char *palette = textureData + paletteOffset;
+
+    // Palette index 255 is the transparency key on '{' textures
+    int transparentIndex = texture.Name()[0] == '{' ? 255 : -1;
+
+    unsigned char *destination = new unsigned char[s * bpp];
+
+    // The miptex carries all four levels, each half the size of the one before
+    for (int level = 0; level < HL1_BSP_MIPLEVELS; level++)
+    {
+        int w = std::max(int(miptex->width) >> level, 1);
+        int h = std::max(int(miptex->height) >> level, 1);
 
-            delete[] destination;
+        ExpandPalette(textureData + miptex->offsets[level], w * h, palette, destination, transparentIndex);
+
+        if (level == 0)
+        {
+            texture.SetData(w, h, bpp, destination);
         }
         else
         {
-            std::println("[ERR] texture \"{}\" not found, using default texture", miptex->name);
-
-            tex->DefaultTexture();
+            texture.SetMipData(level, destination);
         }
-
-        textures.push_back(tex);
     }
 
-    return true;
+    delete[] destination;
 }
 
-tBSPMipTexHeader *BspAsset::GetMiptex(
+const tBSPMipTexHeader *BspAsset::GetMiptex(
     int index)
 {
-    tBSPMipTexOffsetTable *bspMiptexTable = (tBSPMipTexOffsetTable *)_bspFile->_textureData.data();
+    auto bspMiptexTable = reinterpret_cast<const tBSPMipTexOffsetTable *>(_bspFile->_textureData.data());
 
     if (index >= 0 && bspMiptexTable->miptexCount > index)
     {
-        return (tBSPMipTexHeader *)(_bspFile->_textureData.data() + bspMiptexTable->offsets[index]);
+        return reinterpret_cast<const tBSPMipTexHeader *>(_bspFile->_textureData.data() + bspMiptexTable->offsets[index]);
     }
 
     return 0;
@@ -526,138 +775,227 @@ int BspAsset::FaceFlags(
     return -1;
 }
 
-float dist(
-    const tBSPPlane &plane,
-    const glm::vec3 &point)
+int BspAsset::PointInLeaf(
+    const glm::vec3 &point) const
 {
-    //    if (plane.type < 3)
-    //    {
-    //        return point[plane.type] - plane.distance;
-    //    }
-    //    else
-    {
-        return glm::dot(plane.normal, point) - plane.distance;
-    }
+    return _collision.PointInLeaf(point);
+}
+
+int BspAsset::PointContents(
+    const glm::vec3 &point,
+    int hull,
+    int model,
+    const glm::vec3 &offset) const
+{
+    return _collision.PointContents(point, hull, model, offset);
+}
+
+BspAsset::tTraceResult BspAsset::Trace(
+    const glm::vec3 &start,
+    const glm::vec3 &end,
+    int hull,
+    int model,
+    const glm::vec3 &offset) const
+{
+    return _collision.Trace(start, end, hull, model, offset);
 }
 
-#define DIST_EPSILON (1.0f / 32.0f)
-#define VectorLerp(v1, lerp, v2, c) ((c)[0] = (v1)[0] + (lerp) * ((v2)[0] - (v1)[0]), (c)[1] = (v1)[1] + (lerp) * ((v2)[1] - (v1)[1]), (c)[2] = (v1)[2] + (lerp) * ((v2)[2] - (v1)[2]))
-glm::vec3 BspAsset::Trace(
-    const glm::vec3 &from,
-    const glm::vec3 &to,
-    int clipNodeIndex)
+void BspAsset::TraceBatch(
+    std::span<const glm::vec3> starts,
+    std::span<const glm::vec3> ends,
+    std::span<tTraceResult> results,
+    int hull,
+    int model,
+    const glm::vec3 &offset) const
 {
-    if (clipNodeIndex < 0)
+    _collision.TraceBatch(starts, ends, results, hull, model, offset);
+}
+
+bool BspAsset::SampleFaceLight(
+    const tBSPFace &face,
+    const glm::vec3 &point,
+    tLightSample &sample) const
+{
+    auto &texinfo = _bspFile->_texinfoData[face.texinfo];
+
+    // Sky, water and the other special surfaces have no lightmap
+    if (texinfo.flags != 0)
     {
-        clipNodeIndex = _bspFile->_modelData[0].headnode[0];
+        return false;
     }
 
-    auto plane = _bspFile->_planes[_bspFile->_clipnodeData[clipNodeIndex].planeIndex];
+    float min[2], max[2];
+    CalculateSurfaceExtents(face, min, max);
 
-    auto fromInFront = dist(plane, from);
-    auto toInFront = dist(plane, to);
+    int size[2];
+    CalculateLightmapSize(min, max, size);
 
-    auto nextClipNode = _bspFile->_clipnodeData[clipNodeIndex].children[(toInFront >= 0.0f) ? 0 : 1];
-    if (nextClipNode < -1)
+    // Lightmap texel 0 sits on the 16 unit grid line below the smallest s and t
+    float st[2];
+    for (int c = 0; c < 2; c++)
     {
-        std::println("[DBG] we are in the solid! {}", nextClipNode);
-        float frac = fromInFront < 0.0f ? (fromInFront + DIST_EPSILON) / (fromInFront - toInFront) : (fromInFront - DIST_EPSILON) / (fromInFront - toInFront);
+        auto texturemin = floorf(min[c] / 16.0f) * 16.0f;
+        auto value = point.x * texinfo.vecs[c].x + point.y * texinfo.vecs[c].y + point.z * texinfo.vecs[c].z + texinfo.vecs[c].w;
 
-        glm::vec3 mid;
-        VectorLerp(from, frac, to, mid);
+        st[c] = (value - texturemin) / 16.0f;
 
-        std::println("[DBG] {} {} {}", glm::to_string(from), glm::to_string(mid), glm::to_string(to));
-        return mid;
+        if (st[c] < 0.0f || st[c] > float(size[c] - 1))
+        {
+            return false;
+        }
     }
 
-    if (nextClipNode < 0)
+    auto texels = size_t(size[0]) * size_t(size[1]);
+
+    int maps = 0;
+    while (maps < HL1_BSP_MAX_LIGHT_MAPS && face.styles[maps] != 255)
     {
-        return to;
+        sample.styles[maps] = face.styles[maps];
+        maps++;
     }
 
-    return Trace(from, to, nextClipNode);
-}
-
-bool BspAsset::IsInContents(
-    const glm::vec3 &from,
-    const glm::vec3 &to,
-    glm::vec3 &target,
-    int clipNodeIndex)
-{
-    restartCount++;
+    std::fill(sample.styles + maps, sample.styles + HL1_BSP_MAX_LIGHT_MAPS, 255);
 
-    if (clipNodeIndex == CONTENTS_EMPTY)
+    // Faces without light data are drawn fullbright
+    if (face.lightOffset < 0 || size_t(face.lightOffset) + texels * 3 * size_t(std::max(maps, 1)) > _bspFile->_lightingData.size())
     {
-        target = to;
+        sample.styles[0] = 255;
+        sample.maps[0] = glm::vec3(255.0f);
 
-        return false;
+        return true;
     }
 
-    std::println("[DBG]     clipNode     : {}", clipNodeIndex);
+    int x0 = std::min(int(st[0]), size[0] - 1);
+    int y0 = std::min(int(st[1]), size[1] - 1);
+    int x1 = std::min(x0 + 1, size[0] - 1);
+    int y1 = std::min(y0 + 1, size[1] - 1);
+    float fx = st[0] - float(x0);
+    float fy = st[1] - float(y0);
 
-    auto plane = _bspFile->_planes[_bspFile->_clipnodeData[clipNodeIndex].planeIndex];
+    // The face has a block of samples for each style it uses, in the order of styles[]
+    for (int m = 0; m < std::max(maps, 1); m++)
+    {
+        auto samples = _bspFile->_lightingData.data() + face.lightOffset + size_t(m) * texels * 3;
 
-    auto toInFront = dist(plane, to);
-    auto fromInFront = dist(plane, from);
+        auto texel = [&](int x, int y) {
+            auto t = samples + (size_t(y) * size_t(size[0]) + size_t(x)) * 3;
 
-    if (toInFront >= 0 && fromInFront >= 0 && _bspFile->_clipnodeData[clipNodeIndex].children[0] >= CONTENTS_EMPTY)
-    {
-        return IsInContents(from, to, target, _bspFile->_clipnodeData[clipNodeIndex].children[0]);
+            return glm::vec3(t[0], t[1], t[2]);
+        };
+
+        sample.maps[m] = glm::mix(
+            glm::mix(texel(x0, y0), texel(x1, y0), fx),
+            glm::mix(texel(x0, y1), texel(x1, y1), fx),
+            fy);
     }
 
-    if (toInFront < 0 && fromInFront < 0 && _bspFile->_clipnodeData[clipNodeIndex].children[1] >= CONTENTS_EMPTY)
+    return true;
+}
+
+glm::vec3 BspAsset::StyleLight(
+    const tLightSample &sample) const
+{
+    if (sample.styles[0] == 255)
     {
-        return IsInContents(from, to, target, _bspFile->_clipnodeData[clipNodeIndex].children[1]);
+        return sample.maps[0];
     }
 
-    auto nextClipNode = _bspFile->_clipnodeData[clipNodeIndex].children[(toInFront >= 0.0f) ? 0 : 1];
+    glm::vec3 light(0.0f);
 
-    if (nextClipNode == CONTENTS_EMPTY)
+    for (int m = 0; m < HL1_BSP_MAX_LIGHT_MAPS && sample.styles[m] != 255; m++)
     {
-        target = to;
+        auto scale = sample.styles[m] < HL1_BSP_MAX_LIGHTSTYLES ? _styleScales[sample.styles[m]] : 0.0f;
+
+        light += sample.maps[m] * scale;
+    }
+
+    // The lightmaps clamp the same way
+    return glm::min(light, glm::vec3(255.0f));
+}
+
+// Deeper than the node trees qbsp produces for maps within the engine limits
+const int MaxLightPointDepth = 256;
 
+bool BspAsset::LightPoint(
+    const glm::vec3 &start,
+    const glm::vec3 &end,
+    tLightSample &sample) const
+{
+    if (_bspFile->_nodeData.empty() || _bspFile->_modelData.empty())
+    {
         return false;
     }
 
-    if (nextClipNode == CONTENTS_SOLID)
+    // Where the segment crosses a node, the near side is walked first. The node's own
+    // faces and the far side are pending until the near side turns out to hit nothing.
+    struct Pending
     {
-        auto dir = toInFront;
-        if (dir < 0)
-            dir -= DIST_EPSILON;
-        else
-            dir += DIST_EPSILON;
+        int node;
+        int side;
+        glm::vec3 mid;
+        glm::vec3 end;
+    };
+
+    Pending pending[MaxLightPointDepth];
+    int pendingCount = 0;
 
-        auto newTo = to + (plane.normal * -dir);
+    int num = _bspFile->_modelData[0].headnode[0];
+    auto p1 = start;
+    auto p2 = end;
 
-        if (newTo == to)
+    while (true)
+    {
+        while (num >= 0)
         {
-            target = to;
+            auto &node = _bspFile->_nodeData[num];
+            auto &plane = _bspFile->_planes[node.planeIndex];
+
+            auto front = glm::dot(plane.normal, p1) - plane.distance;
+            auto back = glm::dot(plane.normal, p2) - plane.distance;
+
+            if ((front < 0.0f) == (back < 0.0f))
+            {
+                num = node.children[front < 0.0f ? 1 : 0];
+
+                continue;
+            }
+
+            if (pendingCount == MaxLightPointDepth)
+            {
+                return false;
+            }
+
+            auto side = front < 0.0f ? 1 : 0;
+            auto mid = p1 + (p2 - p1) * (front / (front - back));
 
-            std::println("[DBG]     {}, {}, {}", target.x, target.y, target.z);
+            pending[pendingCount++] = Pending{num, side, mid, p2};
 
+            num = node.children[side];
+            p2 = mid;
+        }
+
+        if (pendingCount == 0)
+        {
             return false;
         }
 
-        target = newTo;
+        auto &crossing = pending[--pendingCount];
+        auto &node = _bspFile->_nodeData[crossing.node];
 
-        std::println("[DBG]     jump {}", restartCount);
-        std::println("[DBG]     new to       : {}, {}, {}", newTo.x, newTo.y, newTo.z);
-        std::println("[DBG]     plane        : {}", _bspFile->_clipnodeData[clipNodeIndex].planeIndex);
-        std::println("[DBG]     plane normal : {}, {}, {} [{}]", plane.normal.x, plane.normal.y, plane.normal.z, plane.distance);
-        std::println("[DBG]     toInFront    : {}", toInFront);
-        std::println("[DBG]     fromInFront  : {}", fromInFront);
+        for (int f = 0; f < node.faceCount; f++)
+        {
+            if (SampleFaceLight(_bspFile->_faceData[node.firstFace + f], crossing.mid, sample))
+            {
+                return true;
+            }
+        }
 
-        return IsInContents(from, newTo, target, _bspFile->_modelData[0].headnode[0]);
+        num = node.children[crossing.side ^ 1];
+        p1 = crossing.mid;
+        p2 = crossing.end;
     }
-
-    return IsInContents(from, to, target, nextClipNode);
 }
 
-//
-// the following computations are based on:
-// PolyEngine (c) Alexey Goloshubin and Quake I source by id Software
-//
-
 void BspAsset::CalculateSurfaceExtents(
     const tBSPFace &in,
     float min[2],
@@ -699,33 +1037,181 @@ void BspAsset::CalculateSurfaceExtents(
     }
 }
 
-bool BspAsset::LoadLightmap(
-    const tBSPFace &in,
-    Texture &out,
-    float min[2],
-    float max[2])
+void BspAsset::CalculateLightmapSize(
+    const float min[2],
+    const float max[2],
+    int size[2])
 {
-    // compute lightmap size
-    int size[2];
-
     for (int c = 0; c < 2; c++)
     {
         float tmin = floorf(min[c] / 16.0f);
         float tmax = ceilf(max[c] / 16.0f);
 
-        size[c] = (int)(tmax - tmin);
+        size[c] = (int)(tmax - tmin) + 1;
     }
+}
+
+bool BspAsset::LoadLightmap(
+    const tBSPFace &in,
+    Texture &page,
+    const tLightmapRegion &region,
+    const BspLightStyles &styles)
+{
+    auto size = size_t(region.width) * size_t(region.height) * 3;
 
-    out.SetData(size[0] + 1, size[1] + 1, 3, _bspFile->_lightingData.data() + in.lightOffset, false);
+    // The face has a block of samples for each style it uses, in the order of styles[]
+    const unsigned char *source = nullptr;
+    float scales[HL1_BSP_MAX_LIGHT_MAPS];
+    int maps = 0;
 
-    return true;
+    while (maps < HL1_BSP_MAX_LIGHT_MAPS && in.styles[maps] != 255)
+    {
+        scales[maps] = styles.Scale(in.styles[maps]);
+        maps++;
+    }
+
+    // Faces without light data are drawn fullbright
+    if (in.lightOffset >= 0 && size_t(in.lightOffset) + size * size_t(std::max(maps, 1)) <= _bspFile->_lightingData.size())
+    {
+        source = _bspFile->_lightingData.data() + in.lightOffset;
+    }
+
+    if (maps == 0)
+    {
+        scales[maps++] = 1.0f;
+    }
+
+    auto pixels = page.Data();
+    auto bpp = page.Bpp();
+    auto pitch = page.Width() * bpp;
+
+    // Add up the styles and repeat the outer texels into the border around the lightmap
+    for (int y = -LightmapAtlasBorder; y < region.height + LightmapAtlasBorder; y++)
+    {
+        int sy = glm::clamp(y, 0, region.height - 1);
+        auto destination = pixels + (region.y + y) * pitch + (region.x - LightmapAtlasBorder) * bpp;
+
+        for (int x = -LightmapAtlasBorder; x < region.width + LightmapAtlasBorder; x++, destination += bpp)
+        {
+            int sx = glm::clamp(x, 0, region.width - 1);
+
+            for (int c = 0; c < 3; c++)
+            {
+                if (source == nullptr)
+                {
+                    destination[c] = 255;
+
+                    continue;
+                }
+
+                auto texel = (sy * region.width + sx) * 3 + c;
+                float value = 0.0f;
+
+                for (int m = 0; m < maps; m++)
+                {
+                    value += float(source[m * size + texel]) * scales[m];
+                }
+
+                destination[c] = (unsigned char)std::min(value, 255.0f);
+            }
+        }
+    }
+
+    return source != nullptr || in.lightOffset < 0;
+}
+
+void BspAsset::IndexLightStyles()
+{
+    _styleFaces.assign(HL1_BSP_MAX_LIGHTSTYLES, std::vector<int>());
+    _styleFaceStamps.assign(_lightmapRegions.size(), 0);
+    _styleStamp = 0;
+
+    BspLightStyles styles;
+
+    for (int style = 0; style < HL1_BSP_MAX_LIGHTSTYLES; style++)
+    {
+        _styleScales[style] = styles.Scale(style);
+    }
+
+    for (size_t f = 0; f < _lightmapRegions.size() && f < _bspFile->_faceData.size(); f++)
+    {
+        auto &in = _bspFile->_faceData[f];
+
+        // Special faces share the white lightmap, fullbright faces never change
+        if (_bspFile->_texinfoData[in.texinfo].flags != 0 || in.lightOffset < 0)
+        {
+            continue;
+        }
+
+        for (int m = 0; m < HL1_BSP_MAX_LIGHT_MAPS && in.styles[m] != 255; m++)
+        {
+            if (in.styles[m] < HL1_BSP_MAX_LIGHTSTYLES)
+            {
+                _styleFaces[in.styles[m]].push_back(int(f));
+            }
+        }
+    }
+}
+
+void BspAsset::UpdateLightStyles(
+    const BspLightStyles &styles,
+    uint64_t changedStyles,
+    std::vector<tLightmapRegion> &dirtyRegions)
+{
+    dirtyRegions.clear();
+
+    if (changedStyles == 0)
+    {
+        return;
+    }
+
+    for (int style = 0; style < HL1_BSP_MAX_LIGHTSTYLES; style++)
+    {
+        if (changedStyles & (uint64_t(1) << style))
+        {
+            _styleScales[style] = styles.Scale(style);
+        }
+    }
+
+    // A face using two changed styles is recomposited once
+    _styleStamp++;
+
+    for (int style = 0; style < HL1_BSP_MAX_LIGHTSTYLES && style < int(_styleFaces.size()); style++)
+    {
+        if ((changedStyles & (uint64_t(1) << style)) == 0)
+        {
+            continue;
+        }
+
+        for (auto f : _styleFaces[style])
+        {
+            if (_styleFaceStamps[f] == _styleStamp)
+            {
+                continue;
+            }
+
+            _styleFaceStamps[f] = _styleStamp;
+
+            auto &region = _lightmapRegions[f];
+
+            LoadLightmap(_bspFile->_faceData[f], *_lightMaps[region.page], region, styles);
+
+            dirtyRegions.push_back(tLightmapRegion{
+                region.page,
+                region.x - LightmapAtlasBorder,
+                region.y - LightmapAtlasBorder,
+                region.width + 2 * LightmapAtlasBorder,
+                region.height + 2 * LightmapAtlasBorder,
+            });
+        }
+    }
 }
 
 bool BspAsset::LoadModels()
 {
     for (unsigned int m = 0; m < _bspFile->_modelData.size(); m++)
     {
-        tModel model;
+        tModel model = {};
 
         model.position = _bspFile->_modelData[m].origin;
         model.firstFace = _bspFile->_modelData[m].firstFace;
@@ -736,3 +1222,17 @@ bool BspAsset::LoadModels()
 
     return true;
 }
+
+void BspAsset::BuildMesh(
+    const std::vector<tVertex> &fanVertices)
+{
+    _mesh.Clear();
+
+    for (auto &model : _models)
+    {
+        model.firstTriangle = _mesh.AddFaces(fanVertices, _faces, model.firstFace, model.faceCount);
+        model.triangleCount = _mesh.TriangleCount() - model.firstTriangle;
+    }
+
+    std::println("[DBG] welded {} face corners into {} vertices", fanVertices.size(), _mesh._vertices.size());
+}
@@ -0,0 +1,585 @@
+#include <valve/bsp/hl1bspcache.h>
+
+#include <cstring>
+#include <fstream>
+#include <mappedfile.h>
+#include <print>
+#include <type_traits>
+#include <valve/bsp/hl1bspasset.h>
+
+namespace fs = std::filesystem;
+using namespace valve::hl1;
+
+class BspCacheWriter
+{
+public:
+    std::vector<valve::byte> _data;
+
+    void Write(
+        const void *data,
+        size_t size)
+    {
+        auto bytes = reinterpret_cast<const valve::byte *>(data);
+
+        _data.insert(_data.end(), bytes, bytes + size);
+    }
+
+    template <class T>
+    void WriteValue(
+        const T &value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        Write(&value, sizeof(T));
+    }
+
+    template <class T>
+    void WriteArray(
+        const std::vector<T> &values)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        WriteValue(uint64_t(values.size()));
+        Write(values.data(), values.size() * sizeof(T));
+    }
+
+    void WriteString(
+        const std::string &value)
+    {
+        WriteValue(uint32_t(value.size()));
+        Write(value.data(), value.size());
+    }
+
+    void WriteTexture(
+        valve::Texture *texture)
+    {
+        if (texture == nullptr)
+        {
+            WriteValue(int(0));
+
+            return;
+        }
+
+        WriteValue(int(1));
+        WriteString(texture->Name());
+        WriteValue(texture->Width());
+        WriteValue(texture->Height());
+        WriteValue(texture->Bpp());
+        WriteValue(int(texture->Repeat() ? 1 : 0));
+        Write(texture->Data(), texture->DataSize());
+
+        WriteValue(texture->MipLevels());
+        for (int level = 1; level < texture->MipLevels(); level++)
+        {
+            Write(texture->MipData(level), size_t(texture->MipWidth(level)) * size_t(texture->MipHeight(level)) * size_t(texture->Bpp()));
+        }
+
+        WriteValue(int(texture->BlockFormat()));
+        if (texture->BlockFormat() != valve::BlockFormats::None)
+        {
+            for (int level = 0; level < texture->MipLevels(); level++)
+            {
+                Write(texture->BlockData(level), texture->BlockDataSize(level));
+            }
+        }
+    }
+};
+
+// Reads back what BspCacheWriter wrote, every read is checked against the end of the data
+class BspCacheReader
+{
+public:
+    explicit BspCacheReader(
+        std::span<const valve::byte> data)
+        : _data(data)
+    {}
+
+    std::span<const valve::byte> Read(
+        size_t size)
+    {
+        if (size > _data.size() - _offset)
+        {
+            _failed = true;
+
+            return {};
+        }
+
+        auto result = _data.subspan(_offset, size);
+
+        _offset += size;
+
+        return result;
+    }
+
+    template <class T>
+    T ReadValue()
+    {
+        T value = {};
+
+        auto bytes = Read(sizeof(T));
+
+        if (!bytes.empty())
+        {
+            memcpy(&value, bytes.data(), sizeof(T));
+        }
+
+        return value;
+    }
+
+    // Reads an element count, every element takes at least elementSize bytes so a
+    // count that cannot fit in what is left of the data fails the read
+    uint64_t ReadCount(
+        size_t elementSize)
+    {
+        auto count = ReadValue<uint64_t>();
+
+        if (count > (_data.size() - _offset) / elementSize)
+        {
+            _failed = true;
+
+            return 0;
+        }
+
+        return count;
+    }
+
+    template <class T>
+    void ReadArray(
+        std::vector<T> &values)
+    {
+        auto count = ReadCount(sizeof(T));
+
+        if (_failed)
+        {
+            return;
+        }
+
+        values.resize(count);
+
+        auto bytes = Read(count * sizeof(T));
+
+        if (!bytes.empty())
+        {
+            memcpy(values.data(), bytes.data(), bytes.size());
+        }
+    }
+
+    std::string ReadString()
+    {
+        auto size = ReadValue<uint32_t>();
+
+        auto bytes = Read(size);
+
+        return std::string(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    }
+
+    valve::Texture *ReadTexture()
+    {
+        if (ReadValue<int>() == 0)
+        {
+            return nullptr;
+        }
+
+        auto name = ReadString();
+        auto width = ReadValue<int>();
+        auto height = ReadValue<int>();
+        auto bpp = ReadValue<int>();
+        auto repeat = ReadValue<int>() != 0;
+
+        if (width < 0 || height < 0 || bpp < 0)
+        {
+            _failed = true;
+
+            return nullptr;
+        }
+
+        auto bytes = Read(size_t(width) * size_t(height) * size_t(bpp));
+
+        if (_failed)
+        {
+            return nullptr;
+        }
+
+        auto texture = new valve::Texture(name);
+        texture->SetData(width, height, bpp, bytes.data(), repeat);
+
+        auto levels = ReadValue<int>();
+        if (levels < 1 || levels > 32)
+        {
+            _failed = true;
+        }
+
+        for (int level = 1; level < levels && !_failed; level++)
+        {
+            auto mip = Read(size_t(texture->MipWidth(level)) * size_t(texture->MipHeight(level)) * size_t(bpp));
+
+            if (!_failed)
+            {
+                texture->SetMipData(level, mip.data());
+            }
+        }
+
+        auto format = valve::BlockFormats(ReadValue<int>());
+        if (format != valve::BlockFormats::None && format != valve::BlockFormats::BC1 && format != valve::BlockFormats::BC3)
+        {
+            _failed = true;
+        }
+
+        for (int level = 0; level < levels && format != valve::BlockFormats::None && !_failed; level++)
+        {
+            auto blocks = Read(valve::BlockCompressedSize(format, texture->MipWidth(level), texture->MipHeight(level)));
+
+            if (!_failed)
+            {
+                texture->SetBlockData(format, level, blocks.data());
+            }
+        }
+
+        if (_failed)
+        {
+            delete texture;
+
+            return nullptr;
+        }
+
+        return texture;
+    }
+
+    bool Failed() const { return _failed; }
+
+private:
+    std::span<const valve::byte> _data;
+    size_t _offset = 0;
+    bool _failed = false;
+};
+
+uint64_t BspCache::Hash(
+    std::span<const byte> data)
+{
+    // FNV-1a over 64-bit words with an extra shift to mix the high bits down
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t hash = 0xcbf29ce484222325ull ^ uint64_t(data.size());
+
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data.data() + i, sizeof(uint64_t));
+
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+
+    for (; i < data.size(); i++)
+    {
+        hash = (hash ^ data[i]) * prime;
+    }
+
+    return hash;
+}
+
+fs::path BspCache::CachePath(
+    const fs::path &location,
+    const std::string &filename)
+{
+    // Maps found in a pak are cached next to the pak
+    auto root = fs::is_directory(location) ? location : location.parent_path();
+
+    return (root / "cache" / fs::path(filename)).replace_extension(".bspcache");
+}
+
+static void ClearTextures(
+    std::vector<valve::Texture *> &textures)
+{
+    for (auto texture : textures)
+    {
+        delete texture;
+    }
+
+    textures.clear();
+}
+
+// The renderer and physics index into the mesh without checks
+static bool IsValidMesh(
+    const BspMesh &mesh,
+    size_t faceCount)
+{
+    if (mesh._faceRanges.size() != faceCount || mesh._drawOrder.size() != faceCount || mesh._indices.size() % 3 != 0)
+    {
+        return false;
+    }
+
+    for (auto index : mesh._indices)
+    {
+        if (index >= mesh._vertices.size())
+        {
+            return false;
+        }
+    }
+
+    for (auto &range : mesh._faceRanges)
+    {
+        if (range.firstIndex < 0 || range.indexCount < 0 || size_t(range.firstIndex) + size_t(range.indexCount) > mesh._indices.size())
+        {
+            return false;
+        }
+    }
+
+    for (auto face : mesh._drawOrder)
+    {
+        if (face < 0 || size_t(face) >= faceCount)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Faces and regions index the texture and lightmap lists without checks
+static bool IsValidFaces(
+    const std::vector<valve::tFace> &faces,
+    const std::vector<BspAsset::tLightmapRegion> &lightmapRegions,
+    size_t textureCount,
+    size_t lightmapCount)
+{
+    for (auto &face : faces)
+    {
+        if (face.texture >= textureCount || face.lightmap >= lightmapCount)
+        {
+            return false;
+        }
+    }
+
+    for (auto &region : lightmapRegions)
+    {
+        if (region.page < 0 || size_t(region.page) >= lightmapCount)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool BspCache::Read(
+    const fs::path &path,
+    uint64_t contentHash,
+    BspAsset &asset)
+{
+    MappedFile file;
+
+    if (!fs::exists(path) || !file.Open(path))
+    {
+        return false;
+    }
+
+    auto headerBytes = file.View(0, sizeof(tBspCacheHeader));
+
+    if (headerBytes.empty())
+    {
+        return false;
+    }
+
+    tBspCacheHeader header;
+    memcpy(&header, headerBytes.data(), sizeof(tBspCacheHeader));
+
+    if (memcmp(header.signature, HL1_BSPCACHE_SIGNATURE, 4) != 0 ||
+        header.version != HL1_BSPCACHE_VERSION ||
+        header.contentHash != contentHash ||
+        header.vertexSize != int(sizeof(tVertex)) ||
+        header.faceSize != int(sizeof(tFace)) ||
+        header.modelSize != int(sizeof(BspAsset::tModel)) ||
+        header.regionSize != int(sizeof(BspAsset::tLightmapRegion)))
+    {
+        std::println("[DBG] level cache {} is out of date", path.string());
+
+        return false;
+    }
+
+    auto payload = file.View(sizeof(tBspCacheHeader), header.payloadSize);
+
+    if (payload.empty())
+    {
+        return false;
+    }
+
+    BspCacheReader reader(payload);
+
+    // An entity is at least a classname length and a keyvalue count
+    auto entityCount = reader.ReadCount(sizeof(uint32_t) * 2);
+
+    std::vector<tBSPEntity> entities;
+
+    for (uint64_t e = 0; e < entityCount && !reader.Failed(); e++)
+    {
+        tBSPEntity entity;
+        entity.classname = reader.ReadString();
+
+        auto keyvalueCount = reader.ReadValue<uint32_t>();
+
+        for (uint32_t k = 0; k < keyvalueCount && !reader.Failed(); k++)
+        {
+            auto key = reader.ReadString();
+            entity.keyvalues.insert(std::make_pair(key, reader.ReadString()));
+        }
+
+        entities.push_back(entity);
+    }
+
+    // A texture is at least the flag that says whether it is there
+    std::vector<valve::Texture *> textures(reader.ReadCount(sizeof(int)));
+    for (auto &texture : textures)
+    {
+        texture = reader.ReadTexture();
+    }
+
+    std::vector<valve::Texture *> lightmaps(reader.ReadCount(sizeof(int)));
+    for (auto &lightmap : lightmaps)
+    {
+        lightmap = reader.ReadTexture();
+    }
+
+    valve::Texture *skytextures[6];
+    for (auto &skytexture : skytextures)
+    {
+        skytexture = reader.ReadTexture();
+    }
+
+    std::vector<BspAsset::tLightmapRegion> lightmapRegions;
+    std::vector<tFace> faces;
+    std::vector<BspAsset::tModel> models;
+    BspMesh mesh;
+
+    reader.ReadArray(lightmapRegions);
+    reader.ReadArray(faces);
+    reader.ReadArray(models);
+    reader.ReadArray(mesh._vertices);
+    reader.ReadArray(mesh._indices);
+    reader.ReadArray(mesh._faceRanges);
+    reader.ReadArray(mesh._drawOrder);
+
+    if (reader.Failed() || entities.empty() || !IsValidMesh(mesh, faces.size()) ||
+        !IsValidFaces(faces, lightmapRegions, textures.size(), lightmaps.size()))
+    {
+        std::println("[ERR] level cache {} is damaged", path.string());
+
+        ClearTextures(textures);
+        ClearTextures(lightmaps);
+        for (auto skytexture : skytextures)
+        {
+            delete skytexture;
+        }
+
+        return false;
+    }
+
+    asset._entities = std::move(entities);
+    asset._textures = std::move(textures);
+    asset._lightMaps = std::move(lightmaps);
+    asset._lightmapRegions = std::move(lightmapRegions);
+    asset._faces = std::move(faces);
+    asset._models = std::move(models);
+    asset._mesh = std::move(mesh);
+
+    for (int i = 0; i < 6; i++)
+    {
+        asset._skytextures[i] = skytextures[i];
+    }
+
+    return true;
+}
+
+bool BspCache::Write(
+    const fs::path &path,
+    uint64_t contentHash,
+    BspAsset &asset)
+{
+    BspCacheWriter writer;
+
+    writer.WriteValue(uint64_t(asset._entities.size()));
+    for (auto &entity : asset._entities)
+    {
+        writer.WriteString(entity.classname);
+        writer.WriteValue(uint32_t(entity.keyvalues.size()));
+
+        for (auto &keyvalue : entity.keyvalues)
+        {
+            writer.WriteString(keyvalue.first);
+            writer.WriteString(keyvalue.second);
+        }
+    }
+
+    writer.WriteValue(uint64_t(asset._textures.size()));
+    for (auto texture : asset._textures)
+    {
+        writer.WriteTexture(texture);
+    }
+
+    writer.WriteValue(uint64_t(asset._lightMaps.size()));
+    for (auto lightmap : asset._lightMaps)
+    {
+        writer.WriteTexture(lightmap);
+    }
+
+    for (auto skytexture : asset._skytextures)
+    {
+        writer.WriteTexture(skytexture);
+    }
+
+    writer.WriteArray(asset._lightmapRegions);
+    writer.WriteArray(asset._faces);
+    writer.WriteArray(asset._models);
+    writer.WriteArray(asset._mesh._vertices);
+    writer.WriteArray(asset._mesh._indices);
+    writer.WriteArray(asset._mesh._faceRanges);
+    writer.WriteArray(asset._mesh._drawOrder);
+
+    tBspCacheHeader header = {};
+    memcpy(header.signature, HL1_BSPCACHE_SIGNATURE, 4);
+    header.version = HL1_BSPCACHE_VERSION;
+    header.contentHash = contentHash;
+    header.payloadSize = writer._data.size();
+    header.vertexSize = int(sizeof(tVertex));
+    header.faceSize = int(sizeof(tFace));
+    header.modelSize = int(sizeof(BspAsset::tModel));
+    header.regionSize = int(sizeof(BspAsset::tLightmapRegion));
+
+    std::error_code error;
+    fs::create_directories(path.parent_path(), error);
+
+    // Write next to the target and rename, so a reader never maps a half written cache
+    auto temporaryPath = fs::path(path).concat(".tmp");
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char *>(&header), sizeof(tBspCacheHeader));
+        file.write(reinterpret_cast<const char *>(writer._data.data()), std::streamsize(writer._data.size()));
+
+        if (!file.good())
+        {
+            file.close();
+            fs::remove(temporaryPath, error);
+
+            return false;
+        }
+    }
+
+    fs::rename(temporaryPath, path, error);
+
+    if (error)
+    {
+        fs::remove(temporaryPath, error);
+
+        return false;
+    }
+
+    return true;
+}
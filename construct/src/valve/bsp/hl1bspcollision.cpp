@@ -0,0 +1,946 @@
+#include <valve/bsp/hl1bspcollision.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX__)
+#define HL1BSP_AVX
+#include <immintrin.h>
+#endif
+
+using namespace valve::hl1;
+
+static float dist(
+    const tBSPPlane &plane,
+    const glm::vec3 &point)
+{
+    // Axial planes have a unit normal along x, y or z
+    if (plane.type < 3)
+    {
+        return point[plane.type] - plane.distance;
+    }
+
+    return glm::dot(plane.normal, point) - plane.distance;
+}
+
+int BspCollisionModel::PointInLeaf(
+    const glm::vec3 &point) const
+{
+    if (_nodes.empty() || _models.empty())
+    {
+        return 0;
+    }
+
+    int index = _models[0].headnode[0];
+
+    while (index >= 0)
+    {
+        auto &node = _nodes[index];
+
+        index = node.children[dist(_planes[node.planeIndex], point) > 0.0f ? 0 : 1];
+    }
+
+    return -(index + 1);
+}
+
+int BspCollisionModel::PointInLeaf(
+    const glm::vec3 &point,
+    tPointCache &cache) const
+{
+    auto delta = point - cache.origin;
+
+    // A cache that was never filled has a negative clearance, which squares to a hit
+    if (cache.clearance > 0.0f && glm::dot(delta, delta) < cache.clearance * cache.clearance)
+    {
+        return cache.leaf;
+    }
+
+    cache.origin = point;
+    cache.clearance = -1.0f;
+    cache.leaf = 0;
+
+    if (_nodes.empty() || _models.empty())
+    {
+        return 0;
+    }
+
+    // The leaf is exactly the space on the taken side of every plane on the way
+    // down, so until the point gets as close to one of them it stays in the leaf
+    auto clearance = std::numeric_limits<float>::max();
+    int index = _models[0].headnode[0];
+
+    while (index >= 0)
+    {
+        auto &node = _nodes[index];
+        auto d = dist(_planes[node.planeIndex], point);
+
+        clearance = std::min(clearance, std::abs(d));
+        index = node.children[d > 0.0f ? 0 : 1];
+    }
+
+    cache.clearance = clearance;
+    cache.leaf = -(index + 1);
+
+    return cache.leaf;
+}
+
+void BspCollisionModel::BoxLeafs(
+    const glm::vec3 &mins,
+    const glm::vec3 &maxs,
+    std::vector<int> &leafs) const
+{
+    if (_nodes.empty() || _models.empty())
+    {
+        return;
+    }
+
+    std::vector<int> stack = {_models[0].headnode[0]};
+
+    while (!stack.empty())
+    {
+        auto index = stack.back();
+        stack.pop_back();
+
+        if (index < 0)
+        {
+            auto leaf = -(index + 1);
+
+            if (leaf > 0 && size_t(leaf) < _leafs.size() && _leafs[leaf].contents != CONTENTS_SOLID)
+            {
+                leafs.push_back(leaf);
+            }
+
+            continue;
+        }
+
+        auto &node = _nodes[index];
+        auto &plane = _planes[node.planeIndex];
+
+        // The corners of the box furthest along and against the normal
+        glm::vec3 front, back;
+
+        for (int i = 0; i < 3; i++)
+        {
+            front[i] = plane.normal[i] >= 0.0f ? maxs[i] : mins[i];
+            back[i] = plane.normal[i] >= 0.0f ? mins[i] : maxs[i];
+        }
+
+        if (dist(plane, front) > 0.0f)
+        {
+            stack.push_back(node.children[0]);
+        }
+
+        if (dist(plane, back) <= 0.0f)
+        {
+            stack.push_back(node.children[1]);
+        }
+    }
+}
+
+int BspCollisionModel::LeafContents(
+    int leaf) const
+{
+    if (leaf < 0 || size_t(leaf) >= _leafs.size())
+    {
+        return CONTENTS_SOLID;
+    }
+
+    return _leafs[leaf].contents;
+}
+
+int BspCollisionModel::PointContents(
+    const glm::vec3 &point,
+    int hull,
+    int model,
+    const glm::vec3 &offset) const
+{
+    tHull h;
+
+    if (!GetHull(hull, model, h))
+    {
+        return CONTENTS_EMPTY;
+    }
+
+    return HullPointContents(h, h.firstClipNode, point - offset);
+}
+
+int BspCollisionModel::PointContents(
+    const glm::vec3 &point,
+    tPointCache &cache) const
+{
+    return LeafContents(PointInLeaf(point, cache));
+}
+
+void BspCollisionModel::Attach(
+    std::span<const tBSPPlane> planes,
+    std::span<const tBSPNode> nodes,
+    std::span<const tBSPLeaf> leafs,
+    std::span<const tBSPClipNode> clipNodes,
+    std::span<const tBSPModel> models)
+{
+    _planes = planes;
+    _nodes = nodes;
+    _leafs = leafs;
+    _clipNodes = clipNodes;
+    _models = models;
+
+    _hull0ClipNodes.resize(nodes.size());
+
+    // The node tree as clip nodes, with the leafs replaced by their contents
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        _hull0ClipNodes[n].planeIndex = nodes[n].planeIndex;
+
+        for (int side = 0; side < 2; side++)
+        {
+            auto child = nodes[n].children[side];
+
+            if (child >= 0)
+            {
+                _hull0ClipNodes[n].children[side] = child;
+            }
+            else if (size_t(-(child + 1)) < leafs.size())
+            {
+                _hull0ClipNodes[n].children[side] = short(leafs[-(child + 1)].contents);
+            }
+            else
+            {
+                _hull0ClipNodes[n].children[side] = CONTENTS_SOLID;
+            }
+        }
+    }
+}
+
+bool BspCollisionModel::GetHull(
+    int hull,
+    int model,
+    tHull &result) const
+{
+    if (hull < 0 || hull >= HL1_BSP_MAX_MAP_HULLS || model < 0 || size_t(model) >= _models.size())
+    {
+        return false;
+    }
+
+    result.clipNodes = hull == 0 ? std::span<const tBSPClipNode>(_hull0ClipNodes) : _clipNodes;
+    result.firstClipNode = _models[model].headnode[hull];
+
+    return result.firstClipNode < int(result.clipNodes.size());
+}
+
+int BspCollisionModel::HullPointContents(
+    const tHull &hull,
+    int num,
+    const glm::vec3 &point) const
+{
+    while (num >= 0)
+    {
+        auto &node = hull.clipNodes[num];
+
+        num = node.children[dist(_planes[node.planeIndex], point) < 0.0f ? 1 : 0];
+    }
+
+    return num;
+}
+
+// What a trace returns until it reaches a leaf or hits something
+static BspCollisionModel::tTraceResult StartTrace(
+    const glm::vec3 &p2,
+    const glm::vec3 &offset)
+{
+    BspCollisionModel::tTraceResult trace;
+
+    trace.allSolid = true;
+    trace.startSolid = false;
+    trace.fraction = 1.0f;
+    trace.endPosition = p2 + offset;
+    trace.planeNormal = glm::vec3(0.0f);
+    trace.planeDistance = 0.0f;
+    trace.contents = CONTENTS_EMPTY;
+
+    return trace;
+}
+
+static void FinishTrace(
+    BspCollisionModel::tTraceResult &trace,
+    const glm::vec3 &p1,
+    const glm::vec3 &offset)
+{
+    if (trace.allSolid)
+    {
+        trace.startSolid = true;
+        trace.fraction = 0.0f;
+        trace.endPosition = p1 + offset;
+        trace.contents = CONTENTS_SOLID;
+    }
+}
+
+// Keeps the trace just off the plane it hits, so the end position is never inside the solid
+const float DIST_EPSILON = 1.0f / 32.0f;
+
+// Deeper than the node trees qbsp produces for maps within the engine limits
+const int MaxTraceDepth = 256;
+
+BspCollisionModel::tTraceResult BspCollisionModel::Trace(
+    const glm::vec3 &start,
+    const glm::vec3 &end,
+    int hull,
+    int model,
+    const glm::vec3 &offset) const
+{
+    tHull h;
+
+    if (!GetHull(hull, model, h))
+    {
+        tTraceResult trace = {};
+
+        trace.fraction = 1.0f;
+        trace.endPosition = end;
+        trace.contents = CONTENTS_EMPTY;
+
+        return trace;
+    }
+
+    // Brush models are traced in their own space
+    return TraceHull(h, h.firstClipNode, start - offset, end - offset, offset);
+}
+
+BspCollisionModel::tTraceResult BspCollisionModel::TraceHull(
+    const tHull &h,
+    int num,
+    const glm::vec3 &p1,
+    const glm::vec3 &p2,
+    const glm::vec3 &offset) const
+{
+    auto trace = StartTrace(p2, offset);
+    auto firstLeaf = true;
+    auto stopped = false;
+
+    TraceWalk(h, num, 0.0f, 1.0f, p1, p2, offset, trace, firstLeaf, stopped);
+
+    if (!stopped)
+    {
+        FinishTrace(trace, p1, offset);
+    }
+
+    return trace;
+}
+
+bool BspCollisionModel::TraceWalk(
+    const tHull &h,
+    int num,
+    float p1f,
+    float p2f,
+    const glm::vec3 &p1,
+    const glm::vec3 &p2,
+    const glm::vec3 &offset,
+    tTraceResult &trace,
+    bool &firstLeaf,
+    bool &stopped) const
+{
+    // Same walk as the recursive hull check from Quake. Every frame first descends the
+    // near side of its plane (stage 0), then the far side once the near side is
+    // clear (stage 1). Going down one side only reuses the frame.
+    struct Frame
+    {
+        int num;
+        int stage;
+        int side;
+        float p1f, p2f, midf;
+        glm::vec3 p1, p2, mid;
+    };
+
+    Frame stack[MaxTraceDepth];
+    int depth = 0;
+    bool clear = true; // what the last finished frame returned
+
+    stack[depth++] = Frame{num, 0, 0, p1f, p2f, 0.0f, p1, p2, p1};
+
+    while (depth > 0)
+    {
+        auto &f = stack[depth - 1];
+
+        if (f.stage == 0)
+        {
+            if (f.num < 0)
+            {
+                if (firstLeaf)
+                {
+                    trace.contents = f.num;
+                    firstLeaf = false;
+                }
+
+                if (f.num != CONTENTS_SOLID)
+                {
+                    trace.allSolid = false;
+                }
+                else
+                {
+                    trace.startSolid = true;
+                }
+
+                clear = true;
+                depth--;
+
+                continue;
+            }
+
+            auto &node = h.clipNodes[f.num];
+            auto &plane = _planes[node.planeIndex];
+
+            auto t1 = dist(plane, f.p1);
+            auto t2 = dist(plane, f.p2);
+
+            if (t1 >= 0.0f && t2 >= 0.0f)
+            {
+                f.num = node.children[0];
+
+                continue;
+            }
+
+            if (t1 < 0.0f && t2 < 0.0f)
+            {
+                f.num = node.children[1];
+
+                continue;
+            }
+
+            // Put the crosspoint DIST_EPSILON pixels on the near side
+            auto frac = glm::clamp(t1 < 0.0f ? (t1 + DIST_EPSILON) / (t1 - t2) : (t1 - DIST_EPSILON) / (t1 - t2), 0.0f, 1.0f);
+
+            f.side = t1 < 0.0f ? 1 : 0;
+            f.midf = f.p1f + (f.p2f - f.p1f) * frac;
+            f.mid = f.p1 + (f.p2 - f.p1) * frac;
+            f.stage = 1;
+
+            if (depth == MaxTraceDepth)
+            {
+                // Only a broken tree gets here, stop where we are
+                trace.fraction = f.p1f;
+                trace.endPosition = f.p1 + offset;
+                stopped = true;
+
+                return false;
+            }
+
+            stack[depth++] = Frame{node.children[f.side], 0, 0, f.p1f, f.midf, 0.0f, f.p1, f.mid, f.mid};
+
+            continue;
+        }
+
+        if (!clear)
+        {
+            depth--;
+
+            continue;
+        }
+
+        auto &node = h.clipNodes[f.num];
+
+        if (HullPointContents(h, node.children[f.side ^ 1], f.mid) != CONTENTS_SOLID)
+        {
+            // Go past the node, this frame becomes the far side
+            f = Frame{node.children[f.side ^ 1], 0, 0, f.midf, f.p2f, 0.0f, f.mid, f.p2, f.mid};
+
+            continue;
+        }
+
+        clear = false;
+        depth--;
+
+        if (trace.allSolid)
+        {
+            // Never got out of the solid area
+            continue;
+        }
+
+        // The other side of the node is solid, this is the impact point
+        TraceImpact(h, _planes[node.planeIndex], f.side, f.p1f, f.p2f, f.p1, f.p2, f.midf, f.mid, offset, trace);
+    }
+
+    return clear;
+}
+
+void BspCollisionModel::TraceImpact(
+    const tHull &h,
+    const tBSPPlane &plane,
+    int side,
+    float p1f,
+    float p2f,
+    const glm::vec3 &p1,
+    const glm::vec3 &p2,
+    float midf,
+    glm::vec3 mid,
+    const glm::vec3 &offset,
+    tTraceResult &trace) const
+{
+    trace.planeNormal = side == 0 ? plane.normal : -plane.normal;
+    trace.planeDistance = side == 0 ? plane.distance : -plane.distance;
+    trace.contents = CONTENTS_SOLID;
+
+    auto frac = (midf - p1f) / std::max(p2f - p1f, std::numeric_limits<float>::min());
+
+    // Back off when the epsilon was not enough to get out of the solid
+    while (HullPointContents(h, h.firstClipNode, mid) == CONTENTS_SOLID)
+    {
+        frac -= 0.1f;
+
+        if (frac < 0.0f)
+        {
+            break;
+        }
+
+        midf = p1f + (p2f - p1f) * frac;
+        mid = p1 + (p2 - p1) * frac;
+    }
+
+    trace.fraction = midf;
+    trace.endPosition = mid + offset;
+}
+
+#if defined(HL1BSP_AVX)
+// The packet walk only pays off with 8 lanes, 4 SSE2 lanes measured no faster than
+// single traces in bench/tracebench. Builds without AVX trace one by one.
+const size_t TracePacketSize = 8;
+
+// A frame of the packet walk, the same as a frame of TraceHull() but for every ray
+// in a lane. The lanes in mask are at node num, the others are somewhere else and
+// their values here are stale.
+struct TracePacketFrame
+{
+    alignas(32) float x1[TracePacketSize];
+    alignas(32) float y1[TracePacketSize];
+    alignas(32) float z1[TracePacketSize];
+    alignas(32) float x2[TracePacketSize];
+    alignas(32) float y2[TracePacketSize];
+    alignas(32) float z2[TracePacketSize];
+    float p1f[TracePacketSize];
+    float p2f[TracePacketSize];
+    float midf[TracePacketSize];
+    glm::vec3 mid[TracePacketSize];
+    int side[TracePacketSize];
+    int num;
+    int stage;
+    unsigned int mask;
+};
+
+// The distances of both ends of every lane to plane, the same values dist() gives
+static void PacketDistances(
+    const tBSPPlane &plane,
+    const TracePacketFrame &f,
+    float *t1,
+    float *t2)
+{
+    if (plane.type >= 3)
+    {
+        for (size_t lane = 0; lane < TracePacketSize; lane++)
+        {
+            t1[lane] = dist(plane, glm::vec3(f.x1[lane], f.y1[lane], f.z1[lane]));
+            t2[lane] = dist(plane, glm::vec3(f.x2[lane], f.y2[lane], f.z2[lane]));
+        }
+
+        return;
+    }
+
+    // Most planes are axial, which is one subtract for all lanes at once
+    auto a1 = plane.type == 0 ? f.x1 : (plane.type == 1 ? f.y1 : f.z1);
+    auto a2 = plane.type == 0 ? f.x2 : (plane.type == 1 ? f.y2 : f.z2);
+
+    auto d = _mm256_set1_ps(plane.distance);
+
+    _mm256_storeu_ps(t1, _mm256_sub_ps(_mm256_load_ps(a1), d));
+    _mm256_storeu_ps(t2, _mm256_sub_ps(_mm256_load_ps(a2), d));
+}
+
+// Bit per lane for the lanes that have both ends on the front of the plane, in front,
+// and for the lanes that have both ends behind it, in behind
+static void PacketSides(
+    const float *t1,
+    const float *t2,
+    unsigned int &front,
+    unsigned int &behind)
+{
+    auto zero = _mm256_setzero_ps();
+    auto a = _mm256_loadu_ps(t1);
+    auto b = _mm256_loadu_ps(t2);
+
+    front = unsigned(_mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(a, zero, _CMP_GE_OQ), _mm256_cmp_ps(b, zero, _CMP_GE_OQ))));
+    behind = unsigned(_mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(a, zero, _CMP_LT_OQ), _mm256_cmp_ps(b, zero, _CMP_LT_OQ))));
+}
+
+static glm::vec3 PacketStart(
+    const TracePacketFrame &f,
+    size_t lane)
+{
+    return glm::vec3(f.x1[lane], f.y1[lane], f.z1[lane]);
+}
+
+static glm::vec3 PacketEnd(
+    const TracePacketFrame &f,
+    size_t lane)
+{
+    return glm::vec3(f.x2[lane], f.y2[lane], f.z2[lane]);
+}
+
+// Rays that are far apart share hardly any nodes, walking them together then only
+// costs the bookkeeping of the lanes
+const float PacketRadius = 128.0f;
+
+static bool IsNear(
+    std::span<const glm::vec3> points)
+{
+    for (auto &point : points)
+    {
+        auto delta = glm::abs(point - points[0]);
+
+        if (delta.x > PacketRadius || delta.y > PacketRadius || delta.z > PacketRadius)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+#endif
+
+void BspCollisionModel::TraceBatch(
+    std::span<const glm::vec3> starts,
+    std::span<const glm::vec3> ends,
+    std::span<tTraceResult> results,
+    int hull,
+    int model,
+    const glm::vec3 &offset) const
+{
+    auto count = std::min({starts.size(), ends.size(), results.size()});
+
+#if defined(HL1BSP_AVX)
+    tHull h;
+
+    if (!GetHull(hull, model, h))
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            results[i] = Trace(starts[i], ends[i], hull, model, offset);
+        }
+
+        return;
+    }
+
+    // Every lane follows exactly the walk of TraceHull(). Lanes that take the same
+    // side of a node stay in one frame, a frame only splits into one per child when
+    // its lanes disagree. A lane that is done is dropped from every frame it is in,
+    // and a lane that ends up alone finishes like a single trace.
+    std::vector<TracePacketFrame> stack;
+    stack.reserve(MaxTraceDepth);
+
+    for (size_t first = 0; first < count; first += TracePacketSize)
+    {
+        auto lanes = std::min(TracePacketSize, count - first);
+        auto trace = results.subspan(first, lanes);
+
+        if (!IsNear(starts.subspan(first, lanes)) || !IsNear(ends.subspan(first, lanes)))
+        {
+            for (size_t lane = 0; lane < lanes; lane++)
+            {
+                trace[lane] = TraceHull(h, h.firstClipNode, starts[first + lane] - offset, ends[first + lane] - offset, offset);
+            }
+
+            continue;
+        }
+
+        TracePacketFrame packet;
+
+        for (size_t lane = 0; lane < TracePacketSize; lane++)
+        {
+            auto i = first + std::min(lane, lanes - 1);
+            auto p1 = starts[i] - offset;
+            auto p2 = ends[i] - offset;
+
+            packet.x1[lane] = p1.x;
+            packet.y1[lane] = p1.y;
+            packet.z1[lane] = p1.z;
+            packet.x2[lane] = p2.x;
+            packet.y2[lane] = p2.y;
+            packet.z2[lane] = p2.z;
+            packet.p1f[lane] = 0.0f;
+            packet.p2f[lane] = 1.0f;
+            packet.midf[lane] = 0.0f;
+            packet.mid[lane] = p1;
+            packet.side[lane] = 0;
+
+            if (lane < lanes)
+            {
+                trace[lane] = StartTrace(p2, offset);
+            }
+        }
+
+        packet.num = h.firstClipNode;
+        packet.stage = 0;
+        packet.mask = (1u << lanes) - 1;
+
+        auto alive = packet.mask;     // lanes that did not hit anything yet
+        auto firstLeaf = packet.mask; // lanes that did not reach a leaf yet
+        unsigned int stopped = 0;     // lanes given up on in a broken tree
+
+        // Goes down num with the lanes in mask, a single lane is walked right away
+        auto descend = [&](
+                           const TracePacketFrame &f,
+                           int num,
+                           unsigned int mask) {
+            if (mask == 0)
+            {
+                return;
+            }
+
+            if (!std::has_single_bit(mask))
+            {
+                stack.push_back(f);
+                stack.back().num = num;
+                stack.back().stage = 0;
+                stack.back().mask = mask;
+
+                return;
+            }
+
+            auto lane = std::countr_zero(mask);
+            auto leaf = (firstLeaf & mask) != 0;
+            auto stop = false;
+
+            if (!TraceWalk(h, num, f.p1f[lane], f.p2f[lane], PacketStart(f, lane), PacketEnd(f, lane), offset, trace[lane], leaf, stop))
+            {
+                alive &= ~mask;
+            }
+
+            if (!leaf)
+            {
+                firstLeaf &= ~mask;
+            }
+
+            if (stop)
+            {
+                stopped |= mask;
+            }
+        };
+
+        stack.clear();
+        descend(packet, packet.num, packet.mask);
+
+        while (!stack.empty())
+        {
+            auto &f = stack.back();
+
+            f.mask &= alive;
+
+            if (f.mask == 0)
+            {
+                stack.pop_back();
+
+                continue;
+            }
+
+            if (f.stage == 0 && f.num < 0)
+            {
+                for (auto m = f.mask; m != 0; m &= m - 1)
+                {
+                    auto lane = std::countr_zero(m);
+
+                    if ((firstLeaf & (1u << lane)) != 0)
+                    {
+                        trace[lane].contents = f.num;
+                    }
+
+                    if (f.num != CONTENTS_SOLID)
+                    {
+                        trace[lane].allSolid = false;
+                    }
+                    else
+                    {
+                        trace[lane].startSolid = true;
+                    }
+                }
+
+                firstLeaf &= ~f.mask;
+                stack.pop_back();
+
+                continue;
+            }
+
+            auto &node = h.clipNodes[f.num];
+
+            if (f.stage == 0)
+            {
+                alignas(32) float t1[TracePacketSize];
+                alignas(32) float t2[TracePacketSize];
+                unsigned int front, behind;
+
+                PacketDistances(_planes[node.planeIndex], f, t1, t2);
+                PacketSides(t1, t2, front, behind);
+
+                front &= f.mask;
+                behind &= f.mask;
+
+                if (front == f.mask)
+                {
+                    f.num = node.children[0];
+
+                    continue;
+                }
+
+                if (behind == f.mask)
+                {
+                    f.num = node.children[1];
+
+                    continue;
+                }
+
+                if (stack.size() >= MaxTraceDepth * TracePacketSize)
+                {
+                    // Only a broken tree gets here, stop where we are
+                    for (auto m = f.mask; m != 0; m &= m - 1)
+                    {
+                        auto lane = std::countr_zero(m);
+
+                        trace[lane].fraction = f.p1f[lane];
+                        trace[lane].endPosition = PacketStart(f, lane) + offset;
+                    }
+
+                    stopped |= f.mask;
+                    alive &= ~f.mask;
+                    stack.pop_back();
+
+                    continue;
+                }
+
+                // The lanes that cross the plane go down their near side up to the
+                // crosspoint, this frame picks them up again for the far side
+                auto crossing = f.mask & ~(front | behind);
+                unsigned int nearBack = 0;
+
+                for (auto m = crossing; m != 0; m &= m - 1)
+                {
+                    auto lane = std::countr_zero(m);
+                    auto p1 = PacketStart(f, lane);
+                    auto p2 = PacketEnd(f, lane);
+
+                    // Put the crosspoint DIST_EPSILON pixels on the near side
+                    auto frac = glm::clamp(t1[lane] < 0.0f ? (t1[lane] + DIST_EPSILON) / (t1[lane] - t2[lane]) : (t1[lane] - DIST_EPSILON) / (t1[lane] - t2[lane]), 0.0f, 1.0f);
+
+                    f.side[lane] = t1[lane] < 0.0f ? 1 : 0;
+                    f.midf[lane] = f.p1f[lane] + (f.p2f[lane] - f.p1f[lane]) * frac;
+                    f.mid[lane] = p1 + (p2 - p1) * frac;
+
+                    if (f.side[lane] != 0)
+                    {
+                        nearBack |= 1u << lane;
+                    }
+                }
+
+                auto near = f;
+
+                for (auto m = crossing; m != 0; m &= m - 1)
+                {
+                    auto lane = std::countr_zero(m);
+
+                    near.x2[lane] = near.mid[lane].x;
+                    near.y2[lane] = near.mid[lane].y;
+                    near.z2[lane] = near.mid[lane].z;
+                    near.p2f[lane] = near.midf[lane];
+                }
+
+                if (crossing != 0)
+                {
+                    f.stage = 1;
+                    f.mask = crossing;
+                }
+                else
+                {
+                    stack.pop_back();
+                }
+
+                auto frontChild = node.children[0];
+                auto backChild = node.children[1];
+
+                descend(near, backChild, behind | nearBack);
+                descend(near, frontChild, front | (crossing & ~nearBack));
+
+                continue;
+            }
+
+            // The near side is clear, the lanes that can get into the far side go on
+            // there and the others hit the plane of this node
+            unsigned int farBack = 0;
+            unsigned int farFront = 0;
+
+            for (auto m = f.mask; m != 0; m &= m - 1)
+            {
+                auto lane = std::countr_zero(m);
+                auto far = f.side[lane] ^ 1;
+
+                if (HullPointContents(h, node.children[far], f.mid[lane]) != CONTENTS_SOLID)
+                {
+                    if (far != 0)
+                    {
+                        farBack |= 1u << lane;
+                    }
+                    else
+                    {
+                        farFront |= 1u << lane;
+                    }
+
+                    continue;
+                }
+
+                alive &= ~(1u << lane);
+
+                if (trace[lane].allSolid)
+                {
+                    // Never got out of the solid area
+                    continue;
+                }
+
+                TraceImpact(h, _planes[node.planeIndex], f.side[lane], f.p1f[lane], f.p2f[lane], PacketStart(f, lane), PacketEnd(f, lane), f.midf[lane], f.mid[lane], offset, trace[lane]);
+            }
+
+            // Go past the node, the far sides start at the crosspoints
+            auto far = f;
+
+            for (auto m = farBack | farFront; m != 0; m &= m - 1)
+            {
+                auto lane = std::countr_zero(m);
+
+                far.x1[lane] = far.mid[lane].x;
+                far.y1[lane] = far.mid[lane].y;
+                far.z1[lane] = far.mid[lane].z;
+                far.p1f[lane] = far.midf[lane];
+            }
+
+            auto frontChild = node.children[0];
+            auto backChild = node.children[1];
+
+            stack.pop_back();
+
+            descend(far, backChild, farBack);
+            descend(far, frontChild, farFront);
+        }
+
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            if ((stopped & (1u << lane)) == 0)
+            {
+                FinishTrace(trace[lane], starts[first + lane] - offset, offset);
+            }
+        }
+    }
+#else
+    for (size_t i = 0; i < count; i++)
+    {
+        results[i] = Trace(starts[i], ends[i], hull, model, offset);
+    }
+#endif
+}
+
+//
+// the following computations are based on:
+// PolyEngine (c) Alexey Goloshubin and Quake I source by id Software
+//
@@ -0,0 +1,93 @@
+#include <valve/bsp/hl1bsplightgrid.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace valve::hl1;
+
+// How far below a point the light trace looks for the floor
+const float LightTraceLength = 8192.0f;
+
+// Used where no lit face is found, like models placed outside the world
+const glm::vec3 DefaultLight = glm::vec3(192.0f);
+
+BspLightGrid::BspLightGrid(
+    float cellSize)
+    : _cellSize(std::max(cellSize, 1.0f))
+{}
+
+void BspLightGrid::Attach(
+    const BspAsset *asset)
+{
+    _asset = asset;
+    _cells.clear();
+    _hits = 0;
+    _misses = 0;
+}
+
+glm::vec3 BspLightGrid::LightAt(
+    const glm::vec3 &point)
+{
+    if (_asset == nullptr)
+    {
+        return DefaultLight;
+    }
+
+    auto cell = glm::floor(point / _cellSize);
+    auto leaf = _asset->PointInLeaf(point);
+
+    // 16 bits per axis cover +/- 2^15 cells, more than the map limits even for 1 unit
+    // cells, and 16 bits for the leaf. A cell that walls split is one cell per side.
+    auto key = (uint64_t(int64_t(cell.x) & 0xFFFF) << 48) | (uint64_t(int64_t(cell.y) & 0xFFFF) << 32) | (uint64_t(int64_t(cell.z) & 0xFFFF) << 16) | uint64_t(leaf & 0xFFFF);
+
+    auto found = _cells.find(key);
+
+    if (found != _cells.end())
+    {
+        _hits++;
+
+        return _asset->StyleLight(found->second);
+    }
+
+    _misses++;
+
+    // The cell center is the same for every model in the cell, as long as nothing
+    // solid is in between. Behind a thin wall or inside the floor it would light the
+    // model from the other side, then the point itself is sampled and not kept.
+    auto center = (cell + 0.5f) * _cellSize;
+
+    if (leaf == 0)
+    {
+        return _asset->StyleLight(Sample(point));
+    }
+
+    if (_asset->PointInLeaf(center) != leaf)
+    {
+        auto trace = _asset->Trace(point, center);
+
+        if (trace.startSolid || trace.fraction < 1.0f)
+        {
+            return _asset->StyleLight(Sample(point));
+        }
+    }
+
+    auto sample = Sample(center);
+
+    _cells.insert(std::make_pair(key, sample));
+
+    return _asset->StyleLight(sample);
+}
+
+BspAsset::tLightSample BspLightGrid::Sample(
+    const glm::vec3 &point) const
+{
+    BspAsset::tLightSample sample;
+
+    if (!_asset->LightPoint(point, point - glm::vec3(0.0f, 0.0f, LightTraceLength), sample))
+    {
+        sample.styles[0] = 255;
+        sample.maps[0] = DefaultLight;
+    }
+
+    return sample;
+}
@@ -0,0 +1,108 @@
+#include <valve/bsp/hl1bsplightstyles.h>
+
+#include <iterator>
+
+using namespace valve::hl1;
+
+// From the Half-Life game dll, see world.cpp
+static const char *DefaultPatterns[] = {
+    "m",                                                   // 0 normal
+    "mmnmmommommnonmmonqnmmo",                             // 1 flicker
+    "abcdefghijklmnopqrstuvwxyzyxwvutsrqponmlkjihgfedcba", // 2 slow strong pulse
+    "mmmmmaaaaammmmmaaaaaabcdefgabcdefg",                  // 3 candle
+    "mamamamamama",                                        // 4 fast strobe
+    "jklmnopqrstuvwxyzyxwvutsrqponmlkj",                   // 5 gentle pulse
+    "nmonqnmomnmomomno",                                   // 6 flicker
+    "mmmaaaabcdefgmmmmaaaammmaamm",                        // 7 candle
+    "mmmaaammmaaammmabcdefaaaammmmabcdefmmmaaaa",          // 8 candle
+    "aaaaaaaazzzzzzzz",                                    // 9 slow strobe
+    "mmamammmmammamamaaamammma",                           // 10 fluorescent flicker
+    "abcdefghijklmnopqrrqponmlkjihgfedcba",                // 11 slow pulse, no black
+    "mmnnmmnnnmmnn",                                       // 12 underwater
+};
+
+BspLightStyles::BspLightStyles()
+{
+    for (int style = 0; style < HL1_BSP_MAX_LIGHTSTYLES; style++)
+    {
+        _patterns[style] = style < int(std::size(DefaultPatterns)) ? DefaultPatterns[style] : "m";
+    }
+
+    // Used by the map compilers for testing
+    _patterns[63] = "a";
+
+    for (int style = 0; style < HL1_BSP_MAX_LIGHTSTYLES; style++)
+    {
+        _scales[style] = ScaleAt(style);
+    }
+}
+
+void BspLightStyles::SetPattern(
+    int style,
+    const std::string &pattern)
+{
+    if (style < 0 || style >= HL1_BSP_MAX_LIGHTSTYLES)
+    {
+        return;
+    }
+
+    _patterns[style] = pattern;
+
+    auto scale = ScaleAt(style);
+
+    if (scale != _scales[style])
+    {
+        _scales[style] = scale;
+        _changed |= uint64_t(1) << style;
+    }
+}
+
+uint64_t BspLightStyles::Advance(
+    std::chrono::microseconds elapsed)
+{
+    _time += elapsed;
+
+    for (int style = 0; style < HL1_BSP_MAX_LIGHTSTYLES; style++)
+    {
+        auto scale = ScaleAt(style);
+
+        if (scale != _scales[style])
+        {
+            _scales[style] = scale;
+            _changed |= uint64_t(1) << style;
+        }
+    }
+
+    auto changed = _changed;
+
+    _changed = 0;
+
+    return changed;
+}
+
+float BspLightStyles::Scale(
+    int style) const
+{
+    if (style < 0 || style >= HL1_BSP_MAX_LIGHTSTYLES)
+    {
+        return 0.0f;
+    }
+
+    return _scales[style];
+}
+
+float BspLightStyles::ScaleAt(
+    int style) const
+{
+    auto &pattern = _patterns[style];
+
+    if (pattern.empty())
+    {
+        return 1.0f;
+    }
+
+    auto frame = size_t(_time.count() / 100000) % pattern.size();
+
+    // 'a' is 0, 'm' is 12, and 12 / 12 is normal brightness
+    return float(pattern[frame] - 'a') / 12.0f;
+}
@@ -0,0 +1,204 @@
+#include <valve/bsp/hl1bspmesh.h>
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <unordered_map>
+
+using namespace valve::hl1;
+
+// The attributes a corner is welded on, the normal is left out since it comes from
+// the face plane and the shaders do not use it
+typedef struct sWeldKey
+{
+    float values[7];
+
+    bool operator==(
+        const sWeldKey &other) const
+    {
+        return std::equal(std::begin(values), std::end(values), std::begin(other.values));
+    }
+
+} tWeldKey;
+
+struct WeldKeyHash
+{
+    size_t operator()(
+        const tWeldKey &key) const
+    {
+        size_t hash = 0;
+
+        for (auto value : key.values)
+        {
+            hash = hash * 31 + std::hash<float>()(value);
+        }
+
+        return hash;
+    }
+};
+
+typedef struct sPositionKey
+{
+    float values[3];
+
+    bool operator==(
+        const sPositionKey &other) const
+    {
+        return std::equal(std::begin(values), std::end(values), std::begin(other.values));
+    }
+
+} tPositionKey;
+
+struct PositionKeyHash
+{
+    size_t operator()(
+        const tPositionKey &key) const
+    {
+        size_t hash = 0;
+
+        for (auto value : key.values)
+        {
+            hash = hash * 31 + std::hash<float>()(value);
+        }
+
+        return hash;
+    }
+};
+
+static tWeldKey MakeWeldKey(
+    const valve::tVertex &vertex)
+{
+    // Adding zero turns -0 into +0, they compare equal so they must hash equal
+    return tWeldKey{{
+        vertex.position.x + 0.0f,
+        vertex.position.y + 0.0f,
+        vertex.position.z + 0.0f,
+        vertex.texcoords[0].x + 0.0f,
+        vertex.texcoords[0].y + 0.0f,
+        vertex.texcoords[1].x + 0.0f,
+        vertex.texcoords[1].y + 0.0f,
+    }};
+}
+
+void BspMesh::Clear()
+{
+    _vertices.clear();
+    _indices.clear();
+    _faceRanges.clear();
+    _drawOrder.clear();
+}
+
+int BspMesh::AddFaces(
+    std::span<const tVertex> fanVertices,
+    std::span<const tFace> faces,
+    int firstFace,
+    int faceCount)
+{
+    if (_faceRanges.size() < faces.size())
+    {
+        _faceRanges.resize(faces.size(), tFaceRange{0, 0});
+
+        auto oldSize = _drawOrder.size();
+        _drawOrder.resize(faces.size());
+        std::iota(_drawOrder.begin() + oldSize, _drawOrder.end(), int(oldSize));
+    }
+
+    int firstTriangle = TriangleCount();
+
+    if (firstFace < 0 || faceCount <= 0 || size_t(firstFace) + size_t(faceCount) > faces.size())
+    {
+        return firstTriangle;
+    }
+
+    auto order = _drawOrder.begin() + firstFace;
+
+    std::iota(order, order + faceCount, firstFace);
+    std::stable_sort(order, order + faceCount, [&faces](int a, int b) {
+        if (faces[a].texture != faces[b].texture)
+        {
+            return faces[a].texture < faces[b].texture;
+        }
+
+        return faces[a].lightmap < faces[b].lightmap;
+    });
+
+    // Welding stays within the model, brush entities do not share corners with the world
+    std::unordered_map<tWeldKey, uint32_t, WeldKeyHash> welded;
+
+    for (auto f = order; f != order + faceCount; ++f)
+    {
+        auto &face = faces[*f];
+        auto &range = _faceRanges[*f];
+
+        range.firstIndex = int(_indices.size());
+
+        if (face.vertexCount < 3 || face.firstVertex < 0 || size_t(face.firstVertex) + size_t(face.vertexCount) > fanVertices.size())
+        {
+            range.indexCount = 0;
+
+            continue;
+        }
+
+        auto corner = [&](int v) {
+            auto &vertex = fanVertices[v];
+            auto found = welded.try_emplace(MakeWeldKey(vertex), uint32_t(_vertices.size()));
+
+            if (found.second)
+            {
+                _vertices.push_back(vertex);
+            }
+
+            return found.first->second;
+        };
+
+        // Fan out from the first vertex of the face, same winding as the fans
+        auto first = corner(face.firstVertex);
+        auto previous = corner(face.firstVertex + 1);
+
+        for (int v = face.firstVertex + 2; v < face.firstVertex + face.vertexCount; v++)
+        {
+            auto current = corner(v);
+
+            _indices.push_back(first);
+            _indices.push_back(previous);
+            _indices.push_back(current);
+
+            previous = current;
+        }
+
+        range.indexCount = int(_indices.size()) - range.firstIndex;
+    }
+
+    return firstTriangle;
+}
+
+void BspMesh::AddCollisionTriangles(
+    int firstTriangle,
+    int triangleCount,
+    tCollisionMesh &collision) const
+{
+    if (firstTriangle < 0 || triangleCount <= 0 || firstTriangle + triangleCount > TriangleCount())
+    {
+        return;
+    }
+
+    // The render vertices of neighbouring faces share positions but not uvs, here
+    // they become one vertex again. Like AddFaces() this stays within the call.
+    std::unordered_map<tPositionKey, uint32_t, PositionKeyHash> welded;
+
+    collision.indices.reserve(collision.indices.size() + size_t(triangleCount) * 3);
+
+    for (size_t i = size_t(firstTriangle) * 3; i < size_t(firstTriangle + triangleCount) * 3; i++)
+    {
+        auto &position = _vertices[_indices[i]].position;
+        auto key = tPositionKey{{position.x + 0.0f, position.y + 0.0f, position.z + 0.0f}};
+        auto found = welded.try_emplace(key, uint32_t(collision.positions.size()));
+
+        if (found.second)
+        {
+            collision.positions.push_back(position);
+        }
+
+        collision.indices.push_back(found.first->second);
+    }
+}
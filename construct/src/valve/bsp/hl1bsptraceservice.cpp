@@ -0,0 +1,89 @@
+#include <valve/bsp/hl1bsptraceservice.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace valve::hl1;
+
+BspTraceService::BspTraceService(
+    const BspCollisionModel &collision,
+    WorkerPool &pool,
+    size_t batchSize)
+    : _collision(collision),
+      _pool(pool),
+      _batchSize(std::max<size_t>(batchSize, 1))
+{}
+
+void BspTraceService::Trace(
+    std::span<const glm::vec3> starts,
+    std::span<const glm::vec3> ends,
+    std::span<BspCollisionModel::tTraceResult> results,
+    int hull,
+    int model,
+    const glm::vec3 &offset) const
+{
+    auto count = std::min({starts.size(), ends.size(), results.size()});
+    auto batches = (count + _batchSize - 1) / _batchSize;
+
+    // Every batch writes its own slice of results, so they come out in input order
+    _pool.ParallelFor(batches, [&](size_t batch) {
+        auto first = batch * _batchSize;
+        auto size = std::min(_batchSize, count - first);
+
+        _collision.TraceBatch(starts.subspan(first, size), ends.subspan(first, size), results.subspan(first, size), hull, model, offset);
+    });
+}
+
+void BspTraceService::LineOfSight(
+    std::span<const glm::vec3> points,
+    std::span<uint8_t> visible) const
+{
+    auto n = points.size();
+
+    if (visible.size() < n * n)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        visible[i * n + i] = 1;
+    }
+
+    if (n < 2)
+    {
+        return;
+    }
+
+    // Only the pairs above the diagonal are traced. Row i has n - 1 - i of them, so
+    // rows i and n - 2 - i together always make n - 1 traces for one task.
+    auto traceRow = [&](size_t i, std::vector<glm::vec3> &starts, std::vector<BspCollisionModel::tTraceResult> &results) {
+        auto count = n - 1 - i;
+
+        starts.assign(count, points[i]);
+        results.resize(count);
+
+        _collision.TraceBatch(starts, points.subspan(i + 1, count), results);
+
+        for (size_t k = 0; k < count; k++)
+        {
+            auto j = i + 1 + k;
+            uint8_t clear = !results[k].startSolid && results[k].fraction >= 1.0f ? 1 : 0;
+
+            visible[i * n + j] = clear;
+            visible[j * n + i] = clear;
+        }
+    };
+
+    _pool.ParallelFor(n / 2, [&](size_t task) {
+        std::vector<glm::vec3> starts;
+        std::vector<BspCollisionModel::tTraceResult> results;
+
+        traceRow(task, starts, results);
+
+        if (n - 2 - task != task)
+        {
+            traceRow(n - 2 - task, starts, results);
+        }
+    });
+}
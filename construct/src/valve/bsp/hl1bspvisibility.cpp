@@ -0,0 +1,132 @@
+#include <valve/bsp/hl1bspvisibility.h>
+
+#include <algorithm>
+
+using namespace valve::hl1;
+
+BspVisibility::BspVisibility(
+    size_t cacheSize)
+    : _cache(std::max<size_t>(cacheSize, 1))
+{}
+
+void BspVisibility::Attach(
+    std::span<const byte> visData,
+    std::span<const tBSPLeaf> leafs,
+    int visLeafCount)
+{
+    _visData = visData;
+    _leafs = leafs;
+    _visLeafCount = std::max(visLeafCount, 0);
+    _wordCount = (size_t(_visLeafCount) + 1 + 63) / 64;
+
+    for (auto &row : _cache)
+    {
+        row.leaf = -1;
+        row.lastUse = 0;
+        row.bits.assign(_wordCount, 0);
+    }
+
+    _useCounter = 0;
+    _hits = 0;
+    _misses = 0;
+}
+
+int BspVisibility::LeafCount() const
+{
+    return _visLeafCount + 1;
+}
+
+const BspVisibility::tRow &BspVisibility::Row(
+    int fromLeaf)
+{
+    auto oldest = _cache.begin();
+
+    for (auto row = _cache.begin(); row != _cache.end(); ++row)
+    {
+        if (row->leaf == fromLeaf)
+        {
+            row->lastUse = ++_useCounter;
+            _hits++;
+
+            return *row;
+        }
+
+        if (row->lastUse < oldest->lastUse)
+        {
+            oldest = row;
+        }
+    }
+
+    _misses++;
+
+    Decompress(fromLeaf, *oldest);
+
+    oldest->leaf = fromLeaf;
+    oldest->lastUse = ++_useCounter;
+
+    return *oldest;
+}
+
+bool BspVisibility::IsVisible(
+    int fromLeaf,
+    int toLeaf)
+{
+    if (toLeaf <= 0 || toLeaf > _visLeafCount)
+    {
+        return false;
+    }
+
+    return Row(fromLeaf).IsSet(toLeaf);
+}
+
+void BspVisibility::Decompress(
+    int fromLeaf,
+    tRow &row) const
+{
+    std::fill(row.bits.begin(), row.bits.end(), 0);
+
+    auto set = [&row](int leaf) {
+        row.bits[size_t(leaf) >> 6] |= uint64_t(1) << (leaf & 63);
+    };
+
+    // Without vis data for this leaf, everything is potentially visible
+    if (fromLeaf <= 0 || size_t(fromLeaf) >= _leafs.size() || _leafs[fromLeaf].visofs < 0 || size_t(_leafs[fromLeaf].visofs) >= _visData.size())
+    {
+        for (int leaf = 1; leaf <= _visLeafCount; leaf++)
+        {
+            set(leaf);
+        }
+
+        return;
+    }
+
+    auto in = _visData.begin() + _leafs[fromLeaf].visofs;
+
+    // A zero byte is followed by the number of zero bytes it stands for
+    for (int leaf = 1; leaf <= _visLeafCount && in != _visData.end();)
+    {
+        if (*in != 0)
+        {
+            for (int bit = 0; bit < 8 && leaf + bit <= _visLeafCount; bit++)
+            {
+                if (*in & (1 << bit))
+                {
+                    set(leaf + bit);
+                }
+            }
+
+            leaf += 8;
+            ++in;
+
+            continue;
+        }
+
+        if (in + 1 == _visData.end())
+        {
+            break;
+        }
+
+        leaf += 8 * in[1];
+        in += 2;
+    }
+}
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstring>
 #include <print>
 #include <sstream>
 
@@ -18,6 +19,8 @@ WadAsset::~WadAsset()
     {
         _file->Close();
     }
+
+    delete[] _lumps;
 }
 
 bool WadAsset::Load(
@@ -65,6 +68,15 @@ bool WadAsset::Load(
 
     _loadedLumps.resize(_header.lumpsCount);
 
+    _lumpIndex.clear();
+    _lumpIndex.reserve(_header.lumpsCount);
+
+    for (int l = 0; l < _header.lumpsCount; ++l)
+    {
+        // emplace keeps the first lump when a name is used more than once
+        _lumpIndex.emplace(FoldName(_lumps[l].name, sizeof(_lumps[l].name)), l);
+    }
+
     return true;
 }
 
@@ -73,30 +85,28 @@ bool WadAsset::IsLoaded() const
     return _file != nullptr;
 }
 
-bool icasecmp(
-    const std::string &l,
-    const std::string &r)
+std::string WadAsset::FoldName(
+    const char *name,
+    size_t maxLength)
 {
-    return l.size() == r.size() &&
-           std::equal(
-               l.cbegin(),
-               l.cend(),
-               r.cbegin(),
-               [](std::string::value_type l1, std::string::value_type r1) { return std::toupper(l1) == std::toupper(r1); });
+    std::string result(name, strnlen(name, maxLength));
+
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return char(std::toupper(c)); });
+
+    return result;
 }
 
 int WadAsset::IndexOf(
     const std::string &name) const
 {
-    for (int l = 0; l < _header.lumpsCount; ++l)
+    auto found = _lumpIndex.find(FoldName(name.c_str(), name.size()));
+
+    if (found == _lumpIndex.end())
     {
-        if (icasecmp(name, _lumps[l].name))
-        {
-            return l;
-        }
+        return -1;
     }
 
-    return -1;
+    return found->second;
 }
 
 valve::byteptr WadAsset::LumpData(
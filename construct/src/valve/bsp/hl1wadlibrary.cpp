@@ -0,0 +1,132 @@
+#include <valve/bsp/hl1wadlibrary.h>
+
+#include <algorithm>
+#include <print>
+#include <sstream>
+
+using namespace valve::hl1;
+
+WadLibrary::WadLibrary(
+    IFileSystem *fs)
+    : _fs(fs)
+{}
+
+WadLibrary::~WadLibrary() = default;
+
+std::vector<WadAsset *> WadLibrary::Acquire(
+    const std::string &wads)
+{
+    std::vector<WadAsset *> result;
+
+    std::istringstream f(wads);
+    std::string s;
+    while (getline(f, s, ';'))
+    {
+        // The wad list holds the paths on the machine that compiled the map
+        std::replace(s.begin(), s.end(), '\\', '/');
+
+        auto wadFilename = std::filesystem::path(s).filename().string();
+
+        if (wadFilename.empty())
+        {
+            continue;
+        }
+
+        auto key = WadAsset::FoldName(wadFilename.c_str(), wadFilename.size());
+
+        auto found = _wads.find(key);
+        if (found != _wads.end())
+        {
+            result.push_back(found->second.get());
+
+            continue;
+        }
+
+        auto location = _fs->LocateFile(wadFilename);
+        if (location.empty())
+        {
+            continue;
+        }
+
+        auto wad = std::make_unique<WadAsset>(_fs);
+
+        auto fullWadPath = std::filesystem::path(location) / wadFilename;
+
+        if (!wad->Load(fullWadPath.string()))
+        {
+            std::println("[ERR] unable to load wad files @ {}", fullWadPath.string());
+
+            continue;
+        }
+
+        std::println("[DBG] opened {} for the wad library", fullWadPath.string());
+
+        result.push_back(wad.get());
+
+        _wads.insert(std::make_pair(key, std::move(wad)));
+    }
+
+    return result;
+}
+
+WadAsset *WadLibrary::Find(
+    const std::vector<WadAsset *> &wads,
+    const std::string &name,
+    int &lump)
+{
+    for (auto wad : wads)
+    {
+        lump = wad->IndexOf(name);
+
+        if (lump >= 0)
+        {
+            return wad;
+        }
+    }
+
+    lump = -1;
+
+    return nullptr;
+}
+
+const valve::Texture *WadLibrary::FindDecoded(
+    const WadAsset *wad,
+    int lump) const
+{
+    auto found = _decoded.find(std::make_pair(wad->Id(), lump));
+
+    if (found == _decoded.end())
+    {
+        return nullptr;
+    }
+
+    return found->second.get();
+}
+
+void WadLibrary::StoreDecoded(
+    const WadAsset *wad,
+    int lump,
+    const Texture &texture)
+{
+    auto copy = std::make_unique<Texture>();
+
+    copy->CopyFrom(texture);
+
+    _decoded.insert_or_assign(std::make_pair(wad->Id(), lump), std::move(copy));
+}
+
+size_t WadLibrary::WadCount() const
+{
+    return _wads.size();
+}
+
+size_t WadLibrary::DecodedCount() const
+{
+    return _decoded.size();
+}
+
+void WadLibrary::Clear()
+{
+    _decoded.clear();
+    _wads.clear();
+}
@@ -1,5 +1,6 @@
 #include <valve/hl1filesystem.h>
 
+#include <cstring>
 #include <print>
 
 FileSystemSearchPath::FileSystemSearchPath(
@@ -85,6 +86,15 @@ valve::IOpenFile *FileSystemSearchPath::OpenFile(
     return _openFiles[filename].get();
 }
 
+std::span<const valve::byte> FileSystemSearchPath::ViewFile(
+    const std::string &filename)
+{
+    (void)filename;
+
+    // Loose files are not mapped, callers fall back to LoadFile
+    return {};
+}
+
 void FileSystemSearchPath::CloseFile(
     FileSystemSearchPathOpenFile *file)
 {
@@ -137,10 +147,7 @@ PakSearchPath::PakSearchPath(
 
 PakSearchPath::~PakSearchPath()
 {
-    if (_pakFile.is_open())
-    {
-        _pakFile.close();
-    }
+    _pakFile.Close();
 }
 
 void PakSearchPath::OpenPakFile()
@@ -152,42 +159,101 @@ void PakSearchPath::OpenPakFile()
         return;
     }
 
-    _pakFile.open(_root.string(), std::fstream::in | std::fstream::binary);
-
-    if (!_pakFile.is_open())
+    if (!_pakFile.Open(_root))
     {
         std::println("[ERR] failed to open pak file {}", _root.string());
 
         return;
     }
 
-    _pakFile.read((char *)&_header, sizeof(valve::hl1::tPAKHeader));
+    auto headerView = _pakFile.View(0, sizeof(valve::hl1::tPAKHeader));
+
+    if (headerView.empty())
+    {
+        _pakFile.Close();
+
+        std::println("[ERR] failed to open pak file {} due to missing header", _root.string());
+
+        return;
+    }
+
+    memcpy(&_header, headerView.data(), sizeof(valve::hl1::tPAKHeader));
 
     if (_header.signature[0] != 'P' || _header.signature[1] != 'A' || _header.signature[2] != 'C' || _header.signature[3] != 'K')
     {
-        _pakFile.close();
+        _pakFile.Close();
 
         std::println("[ERR] failed to open pak file {} due to wrong header {}", _root.string(), _header.signature);
 
         return;
     }
 
+    auto lumpsView = _pakFile.View(_header.lumpsOffset, _header.lumpsSize);
+
+    if (_header.lumpsOffset < 0 || _header.lumpsSize < 0 || lumpsView.size() != size_t(_header.lumpsSize))
+    {
+        _pakFile.Close();
+
+        std::println("[ERR] failed to open pak file {} due to invalid directory", _root.string());
+
+        return;
+    }
+
     _files.resize(_header.lumpsSize / sizeof(valve::hl1::tPAKLump));
-    _pakFile.seekg(_header.lumpsOffset, std::fstream::beg);
-    _pakFile.read((char *)_files.data(), _header.lumpsSize);
+    memcpy(_files.data(), lumpsView.data(), _files.size() * sizeof(valve::hl1::tPAKLump));
+
+    // Index the directory once, lumps pointing outside the mapped file are left out
+    _fileIndex.clear();
+    _fileIndex.reserve(_files.size());
+
+    for (size_t i = 0; i < _files.size(); i++)
+    {
+        const auto &f = _files[i];
+
+        if (f.filepos < 0 || f.filelen < 0 || _pakFile.View(f.filepos, f.filelen).size() != size_t(f.filelen))
+        {
+            std::println("[WRN] skipping pak entry #{} with invalid range", i);
+
+            continue;
+        }
+
+        _fileIndex.emplace(std::string(f.name, strnlen(f.name, sizeof(f.name))), i);
+    }
 
     std::println("[DBG] loaded {} containing {} files", _root.string(), _files.size());
 }
 
+const valve::hl1::tPAKLump *PakSearchPath::FindLump(
+    const std::string &relativeFilename) const
+{
+    auto found = _fileIndex.find(relativeFilename);
+
+    if (found == _fileIndex.end())
+    {
+        return nullptr;
+    }
+
+    return &_files[found->second];
+}
+
+// filename is the full path, the pak file followed by the name of the entry
+const valve::hl1::tPAKLump *PakSearchPath::FindLumpByPath(
+    const std::string &filename) const
+{
+    if (!_pakFile.IsOpen() || filename.length() <= _root.string().length())
+    {
+        return nullptr;
+    }
+
+    return FindLump(filename.substr(_root.string().length() + 1));
+}
+
 std::string PakSearchPath::LocateFile(
     const std::string &relativeFilename)
 {
-    for (auto f : _files)
+    if (FindLump(relativeFilename) != nullptr)
     {
-        if (relativeFilename == std::string(f.name))
-        {
-            return _root.string();
-        }
+        return _root.string();
     }
 
     return "";
@@ -197,59 +263,61 @@ bool PakSearchPath::LoadFile(
     const std::string &filename,
     std::vector<valve::byte> &data)
 {
-    if (!_pakFile.is_open())
+    auto lump = FindLumpByPath(filename);
+
+    if (lump == nullptr)
     {
         return false;
     }
 
-    auto relativeFilename = filename.substr(_root.string().length() + 1);
-
-    for (auto f : _files)
-    {
-        if (relativeFilename == std::string(f.name))
-        {
-            data.resize(f.filelen);
-            _pakFile.seekg(f.filepos, std::fstream::beg);
-            _pakFile.read((char *)data.data(), f.filelen);
+    // Entries can be empty, that is not the same as missing
+    auto view = _pakFile.View(lump->filepos, lump->filelen);
 
-            return true;
-        }
-    }
+    data.assign(view.begin(), view.end());
 
-    return false;
+    return true;
 }
 
 valve::IOpenFile *PakSearchPath::OpenFile(
     const std::string &filename)
 {
-    if (!_pakFile.is_open())
+    if (!_pakFile.IsOpen() || filename.length() <= _root.string().length())
     {
         return nullptr;
     }
 
     auto relativeFilename = filename.substr(_root.string().length() + 1);
 
-    for (auto f : _files)
+    auto lump = FindLump(relativeFilename);
+
+    if (lump == nullptr)
     {
-        auto fname = std::string(f.name);
-        if (relativeFilename != fname)
-        {
-            continue;
-        }
+        return nullptr;
+    }
 
-        auto openFile = std::make_unique<PakSearchPath::PakSearchPathOpenFile>();
+    auto openFile = std::make_unique<PakSearchPath::PakSearchPathOpenFile>();
 
-        openFile->Pack = this;
-        openFile->FileName = fname;
-        openFile->OffsetInPack = f.filepos;
-        openFile->Size = f.filelen;
+    openFile->Pack = this;
+    openFile->FileName = relativeFilename;
+    openFile->OffsetInPack = lump->filepos;
+    openFile->Size = lump->filelen;
+
+    _openFiles.insert(std::make_pair(relativeFilename, std::move(openFile)));
+
+    return _openFiles[relativeFilename].get();
+}
 
-        _openFiles.insert(std::make_pair(fname, std::move(openFile)));
+std::span<const valve::byte> PakSearchPath::ViewFile(
+    const std::string &filename)
+{
+    auto lump = FindLumpByPath(filename);
 
-        return _openFiles[fname].get();
+    if (lump == nullptr)
+    {
+        return {};
     }
 
-    return nullptr;
+    return _pakFile.View(lump->filepos, lump->filelen);
 }
 
 void PakSearchPath::CloseFile(
@@ -268,15 +336,19 @@ bool PakSearchPath::PakSearchPathOpenFile::LoadBytes(
     std::vector<valve::byte> &data,
     size_t offsetFromStart)
 {
-    if (Pack == nullptr)
+    if (Pack == nullptr || offsetFromStart > Size || count > Size - offsetFromStart)
     {
         return false;
     }
 
-    data.resize(count);
+    auto view = Pack->_pakFile.View(OffsetInPack + offsetFromStart, count);
+
+    if (view.size() != count)
+    {
+        return false;
+    }
 
-    Pack->_pakFile.seekg(OffsetInPack + offsetFromStart, std::fstream::beg);
-    Pack->_pakFile.read((char *)data.data(), count);
+    data.assign(view.begin(), view.end());
 
     return true;
 }
@@ -346,6 +418,26 @@ valve::IOpenFile *FileSystem::OpenFile(
     return nullptr;
 }
 
+std::span<const valve::byte> FileSystem::ViewFile(
+    const std::string &filename)
+{
+    for (auto &searchPath : _searchPaths)
+    {
+        if (!searchPath->IsInSearchPath(filename))
+        {
+            continue;
+        }
+
+        auto view = searchPath->ViewFile(filename);
+        if (!view.empty())
+        {
+            return view;
+        }
+    }
+
+    return {};
+}
+
 void FileSystem::SetRootAndMod(
     const std::filesystem::path &root,
     const std::string &mod)
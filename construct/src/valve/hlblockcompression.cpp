@@ -0,0 +1,483 @@
+#include <valve/hlblockcompression.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <workerpool.h>
+
+namespace valve
+{
+
+    static int BlockBytes(
+        BlockFormats format)
+    {
+        switch (format)
+        {
+            case BlockFormats::BC1:
+                return 8;
+            case BlockFormats::BC3:
+                return 16;
+            default:
+                return 0;
+        }
+    }
+
+    size_t BlockCompressedSize(
+        BlockFormats format,
+        int width,
+        int height)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            return 0;
+        }
+
+        return size_t((width + 3) / 4) * size_t((height + 3) / 4) * size_t(BlockBytes(format));
+    }
+
+    static uint16_t PackColor565(
+        const float color[3])
+    {
+        int r = std::clamp(int(color[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+        int g = std::clamp(int(color[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+        int b = std::clamp(int(color[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+
+        return uint16_t((r << 11) | (g << 5) | b);
+    }
+
+    static void UnpackColor565(
+        uint16_t packed,
+        int color[3])
+    {
+        int r = (packed >> 11) & 31;
+        int g = (packed >> 5) & 63;
+        int b = packed & 31;
+
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // The 4x4 texels of a block as RGBA, clamped to the image
+    static void LoadBlock(
+        const unsigned char *data,
+        int width,
+        int height,
+        int bpp,
+        int blockX,
+        int blockY,
+        unsigned char texels[16][4])
+    {
+        for (int y = 0; y < 4; y++)
+        {
+            int sy = std::min(blockY * 4 + y, height - 1);
+
+            for (int x = 0; x < 4; x++)
+            {
+                int sx = std::min(blockX * 4 + x, width - 1);
+
+                auto texel = data + (size_t(sy) * size_t(width) + size_t(sx)) * size_t(bpp);
+                auto out = texels[y * 4 + x];
+
+                out[0] = texel[0];
+                out[1] = texel[1];
+                out[2] = texel[2];
+                out[3] = bpp == 4 ? texel[3] : 255;
+            }
+        }
+    }
+
+    static void EncodeColorBlock(
+        const unsigned char texels[16][4],
+        bool skipTransparent,
+        unsigned char out[8])
+    {
+        bool used[16];
+        int count = 0;
+
+        for (int i = 0; i < 16; i++)
+        {
+            used[i] = !skipTransparent || texels[i][3] != 0;
+            count += used[i] ? 1 : 0;
+        }
+
+        // A fully transparent block still needs some color
+        if (count == 0)
+        {
+            std::fill(std::begin(used), std::end(used), true);
+            count = 16;
+        }
+
+        float mean[3] = {0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++)
+        {
+            if (used[i])
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    mean[c] += float(texels[i][c]);
+                }
+            }
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+            mean[c] /= float(count);
+        }
+
+        // Covariance of the colors, its principal axis is where the block varies most
+        float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++)
+        {
+            if (!used[i])
+            {
+                continue;
+            }
+
+            float r = float(texels[i][0]) - mean[0];
+            float g = float(texels[i][1]) - mean[1];
+            float b = float(texels[i][2]) - mean[2];
+
+            cov[0] += r * r;
+            cov[1] += r * g;
+            cov[2] += r * b;
+            cov[3] += g * g;
+            cov[4] += g * b;
+            cov[5] += b * b;
+        }
+
+        float axis[3] = {1.0f, 1.0f, 1.0f};
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[3] = {
+                cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2],
+            };
+
+            float length = std::max({std::fabs(next[0]), std::fabs(next[1]), std::fabs(next[2])});
+
+            if (length < 1e-6f)
+            {
+                break;
+            }
+
+            for (int c = 0; c < 3; c++)
+            {
+                axis[c] = next[c] / length;
+            }
+        }
+
+        float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        for (int c = 0; c < 3; c++)
+        {
+            axis[c] /= axisLength;
+        }
+
+        float minProjection = 0.0f;
+        float maxProjection = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            if (!used[i])
+            {
+                continue;
+            }
+
+            float projection = (float(texels[i][0]) - mean[0]) * axis[0] +
+                               (float(texels[i][1]) - mean[1]) * axis[1] +
+                               (float(texels[i][2]) - mean[2]) * axis[2];
+
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+
+        // Pulling the ends in a bit puts the interpolated colors closer to the texels
+        float inset = (maxProjection - minProjection) / 16.0f;
+        minProjection += inset;
+        maxProjection -= inset;
+
+        float end0[3], end1[3];
+        for (int c = 0; c < 3; c++)
+        {
+            end0[c] = mean[c] + axis[c] * maxProjection;
+            end1[c] = mean[c] + axis[c] * minProjection;
+        }
+
+        uint16_t color0 = PackColor565(end0);
+        uint16_t color1 = PackColor565(end1);
+
+        // color0 > color1 selects the four color mode in BC1
+        if (color0 < color1)
+        {
+            std::swap(color0, color1);
+        }
+
+        int palette[4][3];
+        UnpackColor565(color0, palette[0]);
+        UnpackColor565(color1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        uint32_t indices = 0;
+        if (color0 != color1)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                int bestDistance = std::numeric_limits<int>::max();
+
+                for (int p = 0; p < 4; p++)
+                {
+                    int dr = int(texels[i][0]) - palette[p][0];
+                    int dg = int(texels[i][1]) - palette[p][1];
+                    int db = int(texels[i][2]) - palette[p][2];
+                    int distance = dr * dr + dg * dg + db * db;
+
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+
+                indices |= uint32_t(best) << (i * 2);
+            }
+        }
+
+        out[0] = uint8_t(color0 & 0xff);
+        out[1] = uint8_t(color0 >> 8);
+        out[2] = uint8_t(color1 & 0xff);
+        out[3] = uint8_t(color1 >> 8);
+        out[4] = uint8_t(indices & 0xff);
+        out[5] = uint8_t((indices >> 8) & 0xff);
+        out[6] = uint8_t((indices >> 16) & 0xff);
+        out[7] = uint8_t(indices >> 24);
+    }
+
+    static void AlphaPalette(
+        int alpha0,
+        int alpha1,
+        int palette[8])
+    {
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+
+        if (alpha0 > alpha1)
+        {
+            for (int i = 1; i < 7; i++)
+            {
+                palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+            }
+        }
+        else
+        {
+            for (int i = 1; i < 5; i++)
+            {
+                palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    static void EncodeAlphaBlock(
+        const unsigned char texels[16][4],
+        unsigned char out[8])
+    {
+        int alpha0 = 0;
+        int alpha1 = 255;
+        for (int i = 0; i < 16; i++)
+        {
+            alpha0 = std::max(alpha0, int(texels[i][3]));
+            alpha1 = std::min(alpha1, int(texels[i][3]));
+        }
+
+        uint64_t indices = 0;
+        if (alpha0 != alpha1)
+        {
+            int palette[8];
+            AlphaPalette(alpha0, alpha1, palette);
+
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                int bestDistance = 256;
+
+                for (int p = 0; p < 8; p++)
+                {
+                    int distance = std::abs(int(texels[i][3]) - palette[p]);
+
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+
+                indices |= uint64_t(best) << (i * 3);
+            }
+        }
+
+        out[0] = uint8_t(alpha0);
+        out[1] = uint8_t(alpha1);
+        for (int b = 0; b < 6; b++)
+        {
+            out[2 + b] = uint8_t((indices >> (b * 8)) & 0xff);
+        }
+    }
+
+    void CompressBlocks(
+        BlockFormats format,
+        const unsigned char *data,
+        int width,
+        int height,
+        int bpp,
+        unsigned char *blocks,
+        WorkerPool *pool)
+    {
+        int blockBytes = BlockBytes(format);
+
+        if (blockBytes == 0 || data == nullptr || width <= 0 || height <= 0 || (bpp != 3 && bpp != 4))
+        {
+            return;
+        }
+
+        int blocksX = (width + 3) / 4;
+        int blocksY = (height + 3) / 4;
+
+        auto encodeRow = [&](size_t blockY) {
+            unsigned char texels[16][4];
+            auto out = blocks + blockY * size_t(blocksX) * size_t(blockBytes);
+
+            for (int blockX = 0; blockX < blocksX; blockX++)
+            {
+                LoadBlock(data, width, height, bpp, blockX, int(blockY), texels);
+
+                if (format == BlockFormats::BC3)
+                {
+                    EncodeAlphaBlock(texels, out);
+                    EncodeColorBlock(texels, true, out + 8);
+                }
+                else
+                {
+                    EncodeColorBlock(texels, false, out);
+                }
+
+                out += blockBytes;
+            }
+        };
+
+        if (pool != nullptr)
+        {
+            pool->ParallelFor(size_t(blocksY), encodeRow);
+        }
+        else
+        {
+            for (int blockY = 0; blockY < blocksY; blockY++)
+            {
+                encodeRow(size_t(blockY));
+            }
+        }
+    }
+
+    void DecompressBlocks(
+        BlockFormats format,
+        const unsigned char *blocks,
+        int width,
+        int height,
+        unsigned char *rgba)
+    {
+        int blockBytes = BlockBytes(format);
+
+        if (blockBytes == 0 || blocks == nullptr || width <= 0 || height <= 0)
+        {
+            return;
+        }
+
+        int blocksX = (width + 3) / 4;
+        int blocksY = (height + 3) / 4;
+
+        for (int blockY = 0; blockY < blocksY; blockY++)
+        {
+            for (int blockX = 0; blockX < blocksX; blockX++)
+            {
+                auto block = blocks + (size_t(blockY) * size_t(blocksX) + size_t(blockX)) * size_t(blockBytes);
+                auto colorBlock = format == BlockFormats::BC3 ? block + 8 : block;
+
+                int alpha[16];
+                std::fill(std::begin(alpha), std::end(alpha), 255);
+
+                if (format == BlockFormats::BC3)
+                {
+                    int palette[8];
+                    AlphaPalette(block[0], block[1], palette);
+
+                    uint64_t indices = 0;
+                    for (int b = 0; b < 6; b++)
+                    {
+                        indices |= uint64_t(block[2 + b]) << (b * 8);
+                    }
+
+                    for (int i = 0; i < 16; i++)
+                    {
+                        alpha[i] = palette[(indices >> (i * 3)) & 7];
+                    }
+                }
+
+                uint16_t color0 = uint16_t(colorBlock[0] | (colorBlock[1] << 8));
+                uint16_t color1 = uint16_t(colorBlock[2] | (colorBlock[3] << 8));
+                uint32_t indices = uint32_t(colorBlock[4]) | (uint32_t(colorBlock[5]) << 8) |
+                                   (uint32_t(colorBlock[6]) << 16) | (uint32_t(colorBlock[7]) << 24);
+
+                int palette[4][4];
+                UnpackColor565(color0, palette[0]);
+                UnpackColor565(color1, palette[1]);
+                palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+
+                // BC3 always uses four colors, BC1 has a three color mode with transparent black
+                if (color0 > color1 || format == BlockFormats::BC3)
+                {
+                    for (int c = 0; c < 3; c++)
+                    {
+                        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                    }
+                }
+                else
+                {
+                    for (int c = 0; c < 3; c++)
+                    {
+                        palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                        palette[3][c] = 0;
+                    }
+                    palette[3][3] = 0;
+                }
+
+                for (int i = 0; i < 16; i++)
+                {
+                    int x = blockX * 4 + (i & 3);
+                    int y = blockY * 4 + (i >> 2);
+
+                    if (x >= width || y >= height)
+                    {
+                        continue;
+                    }
+
+                    auto &color = palette[(indices >> (i * 2)) & 3];
+                    auto out = rgba + (size_t(y) * size_t(width) + size_t(x)) * 4;
+
+                    out[0] = uint8_t(color[0]);
+                    out[1] = uint8_t(color[1]);
+                    out[2] = uint8_t(color[2]);
+                    out[3] = uint8_t(format == BlockFormats::BC3 ? alpha[i] : color[3]);
+                }
+            }
+        }
+    }
+
+} // namespace valve
@@ -1,5 +1,6 @@
 #include <valve/hltexture.h>
 
+#include <algorithm>
 #include <cstring>
 #include <glm/glm.hpp>
 
@@ -24,6 +25,10 @@ void Texture::ClearData()
         delete[] _data;
         _data = nullptr;
     }
+
+    _mips.clear();
+    _blockFormat = BlockFormats::None;
+    _blocks.clear();
 }
 
 Texture *Texture::Copy() const
@@ -41,6 +46,10 @@ void Texture::CopyFrom(
     _name = from._name;
 
     SetData(from._width, from._height, from._bpp, from._data, from._repeat);
+
+    _mips = from._mips;
+    _blockFormat = from._blockFormat;
+    _blocks = from._blocks;
 }
 
 void Texture::SetDimentions(
@@ -55,7 +64,7 @@ void Texture::SetData(
     int w,
     int h,
     int bpp,
-    unsigned char *data,
+    const unsigned char *data,
     bool repeat)
 {
     _width = w;
@@ -84,6 +93,196 @@ void Texture::SetData(
     }
 }
 
+void Texture::SetMipData(
+    int level,
+    const unsigned char *data)
+{
+    if (level < 1 || _data == nullptr)
+    {
+        return;
+    }
+
+    if (_mips.size() < size_t(level))
+    {
+        _mips.resize(size_t(level));
+    }
+
+    auto &mip = _mips[level - 1];
+
+    mip.resize(size_t(MipWidth(level)) * size_t(MipHeight(level)) * size_t(_bpp));
+
+    if (data != nullptr)
+    {
+        memcpy(mip.data(), data, mip.size());
+    }
+}
+
+int Texture::MipLevels() const
+{
+    return 1 + int(_mips.size());
+}
+
+int Texture::MipWidth(
+    int level) const
+{
+    return std::max(_width >> level, 1);
+}
+
+int Texture::MipHeight(
+    int level) const
+{
+    return std::max(_height >> level, 1);
+}
+
+unsigned char *Texture::MipData(
+    int level)
+{
+    if (level == 0)
+    {
+        return _data;
+    }
+
+    if (level < 0 || size_t(level) > _mips.size())
+    {
+        return nullptr;
+    }
+
+    return _mips[level - 1].data();
+}
+
+void Texture::Compress(
+    WorkerPool *pool)
+{
+    if (_data == nullptr || (_bpp != 3 && _bpp != 4))
+    {
+        return;
+    }
+
+    auto format = BlockFormats::BC1;
+
+    for (int level = 0; level < MipLevels() && _bpp == 4 && format == BlockFormats::BC1; level++)
+    {
+        auto data = MipData(level);
+        auto count = size_t(MipWidth(level)) * size_t(MipHeight(level));
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (data[i * 4 + 3] != 255)
+            {
+                format = BlockFormats::BC3;
+
+                break;
+            }
+        }
+    }
+
+    _blockFormat = format;
+    _blocks.resize(size_t(MipLevels()));
+
+    for (int level = 0; level < MipLevels(); level++)
+    {
+        _blocks[level].resize(BlockCompressedSize(format, MipWidth(level), MipHeight(level)));
+
+        CompressBlocks(format, MipData(level), MipWidth(level), MipHeight(level), _bpp, _blocks[level].data(), pool);
+    }
+}
+
+void Texture::SetBlockData(
+    BlockFormats format,
+    int level,
+    const unsigned char *blocks)
+{
+    if (level < 0 || level >= MipLevels() || format == BlockFormats::None)
+    {
+        return;
+    }
+
+    if (level == 0 || format != _blockFormat)
+    {
+        _blocks.clear();
+        _blockFormat = format;
+    }
+
+    if (_blocks.size() <= size_t(level))
+    {
+        _blocks.resize(size_t(level) + 1);
+    }
+
+    auto size = BlockCompressedSize(format, MipWidth(level), MipHeight(level));
+
+    _blocks[level].assign(blocks, blocks + size);
+}
+
+BlockFormats Texture::BlockFormat() const
+{
+    return _blocks.empty() ? BlockFormats::None : _blockFormat;
+}
+
+const unsigned char *Texture::BlockData(
+    int level) const
+{
+    if (level < 0 || size_t(level) >= _blocks.size())
+    {
+        return nullptr;
+    }
+
+    return _blocks[level].data();
+}
+
+size_t Texture::BlockDataSize(
+    int level) const
+{
+    if (level < 0 || size_t(level) >= _blocks.size())
+    {
+        return 0;
+    }
+
+    return _blocks[level].size();
+}
+
+void Texture::GenerateMips()
+{
+    if (_data == nullptr)
+    {
+        return;
+    }
+
+    for (int level = MipLevels(); MipWidth(level - 1) > 1 || MipHeight(level - 1) > 1; level++)
+    {
+        auto source = MipData(level - 1);
+        int sw = MipWidth(level - 1);
+        int sh = MipHeight(level - 1);
+        int w = MipWidth(level);
+        int h = MipHeight(level);
+
+        std::vector<unsigned char> mip(size_t(w) * size_t(h) * size_t(_bpp));
+
+        for (int y = 0; y < h; y++)
+        {
+            int y0 = std::min(y * 2, sh - 1);
+            int y1 = std::min(y * 2 + 1, sh - 1);
+
+            for (int x = 0; x < w; x++)
+            {
+                int x0 = std::min(x * 2, sw - 1);
+                int x1 = std::min(x * 2 + 1, sw - 1);
+
+                for (int c = 0; c < _bpp; c++)
+                {
+                    int sum = source[(size_t(y0) * sw + x0) * _bpp + c] +
+                              source[(size_t(y0) * sw + x1) * _bpp + c] +
+                              source[(size_t(y1) * sw + x0) * _bpp + c] +
+                              source[(size_t(y1) * sw + x1) * _bpp + c];
+
+                    mip[(size_t(y) * w + x) * _bpp + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+
+        SetMipData(level, mip.data());
+    }
+}
+
 void Texture::DefaultTexture()
 {
     int value;
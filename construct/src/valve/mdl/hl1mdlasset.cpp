@@ -1,6 +1,8 @@
 #include <valve/mdl/hl1mdlasset.h>
 
+#include <algorithm>
 #include <sstream>
+#include <valve/hlpalette.h>
 
 using namespace valve::hl1;
 
@@ -104,11 +106,7 @@ void MdlAsset::LoadTextures(
         ss << ptexture->name << long(*(long *)ptexture);
         t->SetName(ss.str());
 
-        // unsigned *in, int inwidth, int inheight, unsigned *out,  int outwidth, int outheight;
         int outwidth, outheight;
-        int row1[256], row2[256], col1[256], col2[256];
-        byte *pix1, *pix2, *pix3, *pix4;
-        byte *tex, *out;
 
         // convert texture to power of 2
         for (outwidth = 1; outwidth < ptexture->width; outwidth <<= 1)
@@ -123,36 +121,10 @@ void MdlAsset::LoadTextures(
         if (outheight > 256)
             outheight = 256;
 
-        tex = out = new byte[outwidth * outheight * 4];
-
-        for (int k = 0; k < outwidth; k++)
-        {
-            col1[k] = int((k + 0.25f) * (float(ptexture->width) / float(outwidth)));
-            col2[k] = int((k + 0.75f) * (float(ptexture->width) / float(outwidth)));
-        }
-
-        for (int k = 0; k < outheight; k++)
-        {
-            row1[k] = (int)((k + 0.25f) * (ptexture->height / (float)outheight)) * ptexture->width;
-            row2[k] = (int)((k + 0.75f) * (ptexture->height / (float)outheight)) * ptexture->width;
-        }
+        byte *tex = new byte[outwidth * outheight * 4];
 
         // scale down and convert to 32bit RGB
-        for (int k = 0; k < outheight; k++)
-        {
-            for (int j = 0; j < outwidth; j++, out += 4)
-            {
-                pix1 = &pal[data[row1[k] + col1[j]] * 3];
-                pix2 = &pal[data[row1[k] + col2[j]] * 3];
-                pix3 = &pal[data[row2[k] + col1[j]] * 3];
-                pix4 = &pal[data[row2[k] + col2[j]] * 3];
-
-                out[0] = (pix1[0] + pix2[0] + pix3[0] + pix4[0]) >> 2;
-                out[1] = (pix1[1] + pix2[1] + pix3[1] + pix4[1]) >> 2;
-                out[2] = (pix1[2] + pix2[2] + pix3[2] + pix4[2]) >> 2;
-                out[3] = 0xFF;
-            }
-        }
+        ResamplePalette(data, ptexture->width, ptexture->height, pal, tex, outwidth, outheight);
 
         t->SetData(outwidth, outheight, 4, tex);
         delete[] tex;
@@ -284,14 +256,129 @@ int MdlAsset::BodypartCount() const
 }
 
 tMDLAnimation *MdlAsset::GetAnimation(
-    tMDLSequenceDescription *pseqdesc)
+    const tMDLSequenceDescription *pseqdesc) const
 {
     if (pseqdesc->seqgroup == 0)
     {
-        tMDLSequenceGroup &pseqgroup = this->_sequenceGroupData[pseqdesc->seqgroup];
+        const tMDLSequenceGroup &pseqgroup = this->_sequenceGroupData[pseqdesc->seqgroup];
 
         return (tMDLAnimation *)((byte *)this->_header + pseqgroup.unused2 + pseqdesc->animindex);
     }
 
     return (tMDLAnimation *)((byte *)this->_animationHeaders[pseqdesc->seqgroup] + pseqdesc->animindex);
 }
+
+const int ChannelCount = 6;
+
+static int TrackFrameCount(
+    const tMDLSequenceDescription &pseqdesc)
+{
+    return pseqdesc.numframes > 1 ? pseqdesc.numframes : 1;
+}
+
+static int TrackBlendCount(
+    const tMDLSequenceDescription &pseqdesc)
+{
+    return pseqdesc.numblends > 1 ? pseqdesc.numblends : 1;
+}
+
+size_t MdlAsset::AnimationTrackSize() const
+{
+    size_t size = 0;
+
+    for (auto &pseqdesc : _sequenceData)
+    {
+        size += size_t(TrackBlendCount(pseqdesc)) * _boneData.size() * ChannelCount * size_t(TrackFrameCount(pseqdesc)) * sizeof(float);
+    }
+
+    return size;
+}
+
+// Expands the runs of one channel, a run has total frames of which the first valid
+// have their own value and the rest repeat the last one
+static void DecodeChannel(
+    const tMDLAnimationValue *panimvalue,
+    float value,
+    float scale,
+    float *frames,
+    int frameCount)
+{
+    int frame = 0;
+
+    while (frame < frameCount && panimvalue->num.total > 0)
+    {
+        for (int k = 0; k < panimvalue->num.total && frame < frameCount; k++, frame++)
+        {
+            auto &raw = k < panimvalue->num.valid ? panimvalue[k + 1] : panimvalue[panimvalue->num.valid];
+
+            frames[frame] = value + raw.value * scale;
+        }
+
+        panimvalue += panimvalue->num.valid + 1;
+    }
+
+    // A broken run holds the last good value
+    for (; frame < frameCount; frame++)
+    {
+        frames[frame] = frame > 0 ? frames[frame - 1] : value;
+    }
+}
+
+void MdlAsset::DecodeAnimationTracks()
+{
+    _tracks.resize(_sequenceData.size());
+
+    for (size_t sequence = 0; sequence < _sequenceData.size(); sequence++)
+    {
+        auto &pseqdesc = _sequenceData[sequence];
+        auto &tracks = _tracks[sequence];
+
+        tracks.frameCount = TrackFrameCount(pseqdesc);
+        tracks.values.resize(size_t(TrackBlendCount(pseqdesc)) * _boneData.size() * ChannelCount * size_t(tracks.frameCount));
+
+        const tMDLAnimation *panim = GetAnimation(&pseqdesc);
+        float *frames = tracks.values.data();
+
+        for (int blend = 0; blend < TrackBlendCount(pseqdesc); blend++)
+        {
+            for (size_t bone = 0; bone < _boneData.size(); bone++, panim++)
+            {
+                auto &pbone = _boneData[bone];
+
+                for (int j = 0; j < ChannelCount; j++, frames += tracks.frameCount)
+                {
+                    if (panim->offset[j] == 0)
+                    {
+                        std::fill(frames, frames + tracks.frameCount, pbone.value[j]);
+
+                        continue;
+                    }
+
+                    DecodeChannel(
+                        (const tMDLAnimationValue *)((const byte *)panim + panim->offset[j]),
+                        pbone.value[j],
+                        pbone.scale[j],
+                        frames,
+                        tracks.frameCount);
+                }
+            }
+        }
+    }
+}
+
+void MdlAsset::ClearAnimationTracks()
+{
+    _tracks.clear();
+    _tracks.shrink_to_fit();
+}
+
+const MdlAsset::tSequenceTracks *MdlAsset::AnimationTracks(
+    size_t sequence) const
+{
+    if (sequence >= _tracks.size())
+    {
+        return nullptr;
+    }
+
+    return &_tracks[sequence];
+}
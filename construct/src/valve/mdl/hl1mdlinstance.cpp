@@ -1,142 +1,161 @@
 #include <valve/mdl/hl1mdlinstance.h>
 
+#include "hl1mdlpose.h"
+
+#include <algorithm>
+#include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
 
+#if defined(__AVX__)
+#define HL1MDL_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HL1MDL_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define HL1MDL_NEON
+#include <arm_neon.h>
+#endif
+
 using namespace valve::hl1;
 
-MdlInstance::MdlInstance() = default;
+// The offsets the bone controllers add to the bones they drive, by controller
+typedef float tBoneAdjust[MAX_MDL_CONTROLLERS];
 
-MdlInstance::~MdlInstance() = default;
+// The bone arrays are padded to groups of this many bones, a whole number of lanes
+const size_t BoneLanes = 8;
 
-glm::mat4 MdlInstance::_bonetransform[MAX_MDL_BONES] = {};
+static_assert(MAX_MDL_BONES % BoneLanes == 0);
 
-float MdlInstance::Update(
-    float prevFrame,
-    std::chrono::microseconds time)
+// One register of bone lanes and the few operations the pose kernels are written
+// in, so each kernel is the same code for every instruction set
+#if defined(HL1MDL_AVX)
+struct tLanes
 {
-    Frame = prevFrame;
-
-    if (Asset == nullptr)
-    {
-        return Frame;
-    }
-
-    tMDLSequenceDescription &pseqdesc = Asset->_sequenceData[Sequence];
-
-    auto dt = float(double(time.count()) / 1000000.0);
-    if (dt > 0.1f)
-    {
-        dt = 0.1f;
-    }
-
-    if (Frame + (dt * pseqdesc.fps * Speed) < (pseqdesc.numframes - 1) || Repeat)
-    {
-        Frame += dt * pseqdesc.fps * Speed;
-
-        if (pseqdesc.numframes <= 1)
-        {
-            Frame = 0;
-        }
-        else // wrap
-        {
-            Frame -= (int)(Frame / (pseqdesc.numframes - 1)) * (pseqdesc.numframes - 1);
-        }
-    }
-
-    BuildSkeleton();
-
-    return Frame;
+    __m256 v;
+};
+const size_t LaneWidth = 8;
+
+static tLanes Load(const float *p) { return {_mm256_load_ps(p)}; }
+static void Store(float *p, tLanes a) { _mm256_store_ps(p, a.v); }
+static tLanes Splat(float f) { return {_mm256_set1_ps(f)}; }
+static tLanes operator+(tLanes a, tLanes b) { return {_mm256_add_ps(a.v, b.v)}; }
+static tLanes operator-(tLanes a, tLanes b) { return {_mm256_sub_ps(a.v, b.v)}; }
+static tLanes operator*(tLanes a, tLanes b) { return {_mm256_mul_ps(a.v, b.v)}; }
+static tLanes Abs(tLanes a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+static tLanes WithSignOf(tLanes a, tLanes sign) { return {_mm256_xor_ps(a.v, _mm256_and_ps(sign.v, _mm256_set1_ps(-0.0f)))}; }
+static tLanes InverseSqrt(tLanes a) { return {_mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(a.v))}; }
+#elif defined(HL1MDL_SSE2)
+struct tLanes
+{
+    __m128 v;
+};
+const size_t LaneWidth = 4;
+
+static tLanes Load(const float *p) { return {_mm_load_ps(p)}; }
+static void Store(float *p, tLanes a) { _mm_store_ps(p, a.v); }
+static tLanes Splat(float f) { return {_mm_set1_ps(f)}; }
+static tLanes operator+(tLanes a, tLanes b) { return {_mm_add_ps(a.v, b.v)}; }
+static tLanes operator-(tLanes a, tLanes b) { return {_mm_sub_ps(a.v, b.v)}; }
+static tLanes operator*(tLanes a, tLanes b) { return {_mm_mul_ps(a.v, b.v)}; }
+static tLanes Abs(tLanes a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+static tLanes WithSignOf(tLanes a, tLanes sign) { return {_mm_xor_ps(a.v, _mm_and_ps(sign.v, _mm_set1_ps(-0.0f)))}; }
+static tLanes InverseSqrt(tLanes a) { return {_mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a.v))}; }
+#elif defined(HL1MDL_NEON)
+struct tLanes
+{
+    float32x4_t v;
+};
+const size_t LaneWidth = 4;
+
+static tLanes Load(const float *p) { return {vld1q_f32(p)}; }
+static void Store(float *p, tLanes a) { vst1q_f32(p, a.v); }
+static tLanes Splat(float f) { return {vdupq_n_f32(f)}; }
+static tLanes operator+(tLanes a, tLanes b) { return {vaddq_f32(a.v, b.v)}; }
+static tLanes operator-(tLanes a, tLanes b) { return {vsubq_f32(a.v, b.v)}; }
+static tLanes operator*(tLanes a, tLanes b) { return {vmulq_f32(a.v, b.v)}; }
+static tLanes Abs(tLanes a) { return {vabsq_f32(a.v)}; }
+static tLanes WithSignOf(tLanes a, tLanes sign) { return {vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a.v), vandq_u32(vreinterpretq_u32_f32(sign.v), vdupq_n_u32(0x80000000u))))}; }
+static tLanes InverseSqrt(tLanes a) { return {vdivq_f32(vdupq_n_f32(1.0f), vsqrtq_f32(a.v))}; }
+#else
+struct tLanes
+{
+    float v;
+};
+const size_t LaneWidth = 1;
+
+static tLanes Load(const float *p) { return {*p}; }
+static void Store(float *p, tLanes a) { *p = a.v; }
+static tLanes Splat(float f) { return {f}; }
+static tLanes operator+(tLanes a, tLanes b) { return {a.v + b.v}; }
+static tLanes operator-(tLanes a, tLanes b) { return {a.v - b.v}; }
+static tLanes operator*(tLanes a, tLanes b) { return {a.v * b.v}; }
+static tLanes Abs(tLanes a) { return {std::fabs(a.v)}; }
+static tLanes WithSignOf(tLanes a, tLanes sign) { return {std::signbit(sign.v) ? -a.v : a.v}; }
+static tLanes InverseSqrt(tLanes a) { return {1.0f / std::sqrt(a.v)}; }
+#endif
+
+static_assert(BoneLanes % LaneWidth == 0);
+
+static size_t PaddedBoneCount(
+    size_t boneCount)
+{
+    return (boneCount + BoneLanes - 1) / BoneLanes * BoneLanes;
 }
 
-const glm::mat4 *MdlInstance::BuildSkeleton()
+// The local pose of every bone, one array per component. The lanes after the last
+// bone hold the identity so the kernels can run over whole groups of lanes.
+typedef struct sLocalPose
 {
-    static glm::vec3 pos[MAX_MDL_BONES];
-    static glm::quat q[MAX_MDL_BONES];
-
-    static glm::vec3 pos2[MAX_MDL_BONES];
-    static glm::quat q2[MAX_MDL_BONES];
-    static glm::vec3 pos3[MAX_MDL_BONES];
-    static glm::quat q3[MAX_MDL_BONES];
-    static glm::vec3 pos4[MAX_MDL_BONES];
-    static glm::quat q4[MAX_MDL_BONES];
-
-    for (int i = 0; i < MAX_MDL_BONES; i++)
-    {
-        _bonetransform[i] = glm::mat4(1.0f);
-    }
-
-    if (Asset == nullptr)
-    {
-        return _bonetransform;
-    }
-
-    if (Sequence >= Asset->_sequenceData.size())
-    {
-        Sequence = 0;
-    }
-
-    tMDLSequenceDescription *pseqdesc = &Asset->_sequenceData[Sequence];
-
-    tMDLAnimation *panim = Asset->GetAnimation(pseqdesc);
-    this->CalcRotations(pos, q, pseqdesc, panim);
-
-    if (pseqdesc->numblends > 1)
-    {
-        panim += Asset->_boneData.size();
-        this->CalcRotations(pos2, q2, pseqdesc, panim);
-        float s = Blending[0] / 255.0f;
-
-        this->SlerpBones(q, pos, q2, pos2, s);
-
-        if (pseqdesc->numblends == 4)
-        {
-            panim += Asset->_boneData.size();
-            this->CalcRotations(pos3, q3, pseqdesc, panim);
-
-            panim += Asset->_boneData.size();
-            this->CalcRotations(pos4, q4, pseqdesc, panim);
-
-            s = Blending[0] / 255.0f;
-            this->SlerpBones(q3, pos3, q4, pos4, s);
-
-            s = Blending[1] / 255.0f;
-            this->SlerpBones(q, pos, q3, pos3, s);
-        }
-    }
+    alignas(32) float x[MAX_MDL_BONES];
+    alignas(32) float y[MAX_MDL_BONES];
+    alignas(32) float z[MAX_MDL_BONES];
+    alignas(32) float qx[MAX_MDL_BONES];
+    alignas(32) float qy[MAX_MDL_BONES];
+    alignas(32) float qz[MAX_MDL_BONES];
+    alignas(32) float qw[MAX_MDL_BONES];
+
+    void Set(
+        size_t i,
+        const glm::vec3 &pos,
+        const glm::quat &q)
+    {
+        x[i] = pos.x;
+        y[i] = pos.y;
+        z[i] = pos.z;
+        qx[i] = q.x;
+        qy[i] = q.y;
+        qz[i] = q.z;
+        qw[i] = q.w;
+    }
+
+} tLocalPose;
+
+// The local 3x4 bone matrices, m[row * 4 + column] with the translation in column 3
+typedef struct sLocalMatrices
+{
+    alignas(32) float m[12][MAX_MDL_BONES];
 
-    for (size_t i = 0; i < Asset->_boneData.size(); i++)
-    {
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), pos[i]) * glm::toMat4(q[i]);
+} tLocalMatrices;
 
-        if (Asset->_boneData[i].parent == -1)
-            _bonetransform[i] = m;
-        else
-            _bonetransform[i] = _bonetransform[Asset->_boneData[i].parent] * m;
-    }
-
-    return _bonetransform;
-}
-
-void MdlInstance::CalcBoneAdj()
+static void CalcBoneAdj(
+    const MdlAsset *asset,
+    const tMDLPoseParams &pose,
+    tBoneAdjust &adj)
 {
-    if (Asset == nullptr)
-    {
-        return;
-    }
-
     float value;
-    const std::vector<tMDLBoneController> &pbonecontroller = Asset->_boneControllerData;
+    const std::vector<tMDLBoneController> &pbonecontroller = asset->_boneControllerData;
 
-    for (size_t i = 0; i < pbonecontroller.size(); i++)
+    for (size_t i = 0; i < pbonecontroller.size() && i < MAX_MDL_CONTROLLERS; i++)
     {
         if (pbonecontroller[i].index <= 3)
         {
             // check for 360% wrapping
             if (pbonecontroller[i].type & HL1_MDL_RLOOP)
-                value = Controller[pbonecontroller[i].index] * (360.0f / 256.0f) + pbonecontroller[i].start;
+                value = pose.controller[pbonecontroller[i].index] * (360.0f / 256.0f) + pbonecontroller[i].start;
             else
             {
-                value = Controller[pbonecontroller[i].index] / 255.0f;
+                value = pose.controller[pbonecontroller[i].index] / 255.0f;
                 if (value < 0) value = 0;
                 if (value > 1.0f) value = 1.0f;
                 value = (1.0f - value) * pbonecontroller[i].start + value * pbonecontroller[i].end;
@@ -144,7 +163,7 @@ void MdlInstance::CalcBoneAdj()
         }
         else
         {
-            value = float(Mouth / 64.0f);
+            value = float(pose.mouth / 64.0f);
             if (value > 1.0f) value = 1.0f;
             value = (1.0f - value) * pbonecontroller[i].start + value * pbonecontroller[i].end;
         }
@@ -154,27 +173,31 @@ void MdlInstance::CalcBoneAdj()
             case HL1_MDL_XR:
             case HL1_MDL_YR:
             case HL1_MDL_ZR:
-                this->_adj[i] = value * (glm::pi<float>() / 180.0f);
+                adj[i] = value * (glm::pi<float>() / 180.0f);
                 break;
             case HL1_MDL_X:
             case HL1_MDL_Y:
             case HL1_MDL_Z:
-                this->_adj[i] = value;
+                adj[i] = value;
                 break;
         }
     }
 }
 
-void MdlInstance::CalcBoneQuaternion(
+// lastFrame is set on the last frame of the sequence, which holds its values like the
+// decoded tracks do instead of blending into whatever follows the run
+static void CalcBoneQuaternion(
     int frame,
     float s,
+    bool lastFrame,
     const tMDLBone *pbone,
-    tMDLAnimation *panim,
+    const tMDLAnimation *panim,
+    const tBoneAdjust &adj,
     glm::quat &q)
 {
     int j, k;
     glm::vec3 angle1, angle2;
-    tMDLAnimationValue *panimvalue;
+    const tMDLAnimationValue *panimvalue;
 
     for (j = 0; j < 3; j++)
     {
@@ -184,7 +207,7 @@ void MdlInstance::CalcBoneQuaternion(
         }
         else
         {
-            panimvalue = (tMDLAnimationValue *)((byte *)panim + panim->offset[j + 3]);
+            panimvalue = (const tMDLAnimationValue *)((const valve::byte *)panim + panim->offset[j + 3]);
             k = frame;
             while (panimvalue->num.total <= k)
             {
@@ -196,7 +219,11 @@ void MdlInstance::CalcBoneQuaternion(
             {
                 angle1[j] = panimvalue[k + 1].value;
 
-                if (panimvalue->num.valid > k + 1)
+                if (lastFrame)
+                {
+                    angle2[j] = angle1[j];
+                }
+                else if (panimvalue->num.valid > k + 1)
                 {
                     angle2[j] = panimvalue[k + 2].value;
                 }
@@ -211,7 +238,7 @@ void MdlInstance::CalcBoneQuaternion(
             else
             {
                 angle1[j] = panimvalue[panimvalue->num.valid].value;
-                if (panimvalue->num.total > k + 1)
+                if (panimvalue->num.total > k + 1 || lastFrame)
                 {
                     angle2[j] = angle1[j];
                 }
@@ -226,8 +253,8 @@ void MdlInstance::CalcBoneQuaternion(
 
         if (pbone->bonecontroller[j + 3] != -1)
         {
-            angle1[j] += this->_adj[pbone->bonecontroller[j + 3]];
-            angle2[j] += this->_adj[pbone->bonecontroller[j + 3]];
+            angle1[j] += adj[pbone->bonecontroller[j + 3]];
+            angle2[j] += adj[pbone->bonecontroller[j + 3]];
         }
     }
 
@@ -241,22 +268,24 @@ void MdlInstance::CalcBoneQuaternion(
     }
 }
 
-void MdlInstance::CalcBonePosition(
+static void CalcBonePosition(
     int frame,
     float s,
+    bool lastFrame,
     const tMDLBone *pbone,
-    tMDLAnimation *panim,
+    const tMDLAnimation *panim,
+    const tBoneAdjust &adj,
     glm::vec3 &pos)
 {
     int j, k;
-    tMDLAnimationValue *panimvalue;
+    const tMDLAnimationValue *panimvalue;
 
     for (j = 0; j < 3; j++)
     {
         pos[j] = pbone->value[j]; // default;
         if (panim->offset[j] != 0)
         {
-            panimvalue = (tMDLAnimationValue *)((byte *)panim + panim->offset[j]);
+            panimvalue = (const tMDLAnimationValue *)((const valve::byte *)panim + panim->offset[j]);
 
             k = frame;
             // find span of values that includes the frame we want
@@ -269,85 +298,465 @@ void MdlInstance::CalcBonePosition(
             if (panimvalue->num.valid > k)
             {
                 // and there's more data in the span
-                if (panimvalue->num.valid > k + 1)
+                if (panimvalue->num.valid > k + 1 && !lastFrame)
                     pos[j] += (panimvalue[k + 1].value * (1.0f - s) + s * panimvalue[k + 2].value) * pbone->scale[j];
+                // or the span ends on its last value and another section follows
+                else if (panimvalue->num.total <= k + 1 && !lastFrame)
+                    pos[j] += (panimvalue[k + 1].value * (1.0f - s) + s * panimvalue[panimvalue->num.valid + 2].value) * pbone->scale[j];
                 else
                     pos[j] += panimvalue[k + 1].value * pbone->scale[j];
             }
             else
             {
                 // are we at the end of the repeating values section and there's another section with data?
-                if (panimvalue->num.total <= k + 1)
+                if (panimvalue->num.total <= k + 1 && !lastFrame)
                     pos[j] += (panimvalue[panimvalue->num.valid].value * (1.0f - s) + s * panimvalue[panimvalue->num.valid + 2].value) * pbone->scale[j];
                 else
                     pos[j] += panimvalue[panimvalue->num.valid].value * pbone->scale[j];
             }
         }
         if (pbone->bonecontroller[j] != -1)
-            pos[j] += _adj[pbone->bonecontroller[j]];
+            pos[j] += adj[pbone->bonecontroller[j]];
     }
 }
 
-void MdlInstance::CalcRotations(
-    glm::vec3 pos[],
-    glm::quat q[],
-    tMDLSequenceDescription *pseqdesc,
-    tMDLAnimation *panim)
+// The same as CalcBoneQuaternion() and CalcBonePosition() for all bones, from the
+// decoded tracks of the blend
+static void SampleTracks(
+    int frame,
+    float s,
+    const std::vector<tMDLBone> &pbone,
+    const MdlAsset::tSequenceTracks &tracks,
+    int blend,
+    const tBoneAdjust &adj,
+    tLocalPose &local)
 {
-    int frame = (int)this->Frame;
-    float s = (this->Frame - frame);
+    auto frameCount = tracks.frameCount;
+    auto frame1 = std::clamp(frame, 0, frameCount - 1);
+    auto frame2 = std::min(frame1 + 1, frameCount - 1);
 
-    // add in programatic controllers
-    this->CalcBoneAdj();
+    const float *channel = tracks.values.data() + size_t(blend) * pbone.size() * 6 * size_t(frameCount);
 
-    if (Asset == nullptr)
+    for (size_t i = 0; i < pbone.size(); i++)
     {
-        return;
+        glm::vec3 pos, angle1, angle2;
+
+        for (int j = 0; j < 3; j++, channel += frameCount)
+        {
+            pos[j] = channel[frame1] * (1.0f - s) + s * channel[frame2];
+
+            if (pbone[i].bonecontroller[j] != -1)
+                pos[j] += adj[pbone[i].bonecontroller[j]];
+        }
+
+        for (int j = 0; j < 3; j++, channel += frameCount)
+        {
+            angle1[j] = channel[frame1];
+            angle2[j] = channel[frame2];
+
+            if (pbone[i].bonecontroller[j + 3] != -1)
+            {
+                angle1[j] += adj[pbone[i].bonecontroller[j + 3]];
+                angle2[j] += adj[pbone[i].bonecontroller[j + 3]];
+            }
+        }
+
+        if (angle1 != angle2)
+        {
+            local.Set(i, pos, glm::slerp(glm::quat(angle1), glm::quat(angle2), s));
+        }
+        else
+        {
+            local.Set(i, pos, glm::quat(angle1));
+        }
+    }
+}
+
+static void CalcRotations(
+    const MdlAsset *asset,
+    const tMDLPoseParams &pose,
+    const tBoneAdjust &adj,
+    tLocalPose &local,
+    size_t sequence,
+    int blend)
+{
+    int frame = (int)pose.frame;
+    float s = (pose.frame - frame);
+
+    const tMDLSequenceDescription *pseqdesc = &asset->_sequenceData[sequence];
+    const std::vector<tMDLBone> &pbone = asset->_boneData;
+
+    // Frames past the end hold the last one, as SampleTracks() does
+    auto frameCount = std::max(pseqdesc->numframes, 1);
+    frame = std::clamp(frame, 0, frameCount - 1);
+    auto lastFrame = frame + 1 >= frameCount;
+
+    auto tracks = asset->AnimationTracks(sequence);
+
+    if (tracks != nullptr)
+    {
+        SampleTracks(frame, s, pbone, *tracks, blend, adj, local);
+    }
+    else
+    {
+        const tMDLAnimation *panim = asset->GetAnimation(pseqdesc) + size_t(blend) * pbone.size();
+
+        for (size_t i = 0; i < pbone.size(); i++, panim++)
+        {
+            glm::quat q;
+            glm::vec3 pos;
+
+            CalcBoneQuaternion(frame, s, lastFrame, &pbone[i], panim, adj, q);
+            CalcBonePosition(frame, s, lastFrame, &pbone[i], panim, adj, pos);
+
+            local.Set(i, pos, q);
+        }
     }
 
-    const std::vector<tMDLBone> &pbone = Asset->_boneData;
-    for (size_t i = 0; i < pbone.size(); i++, panim++)
+    for (size_t i = pbone.size(); i < PaddedBoneCount(pbone.size()); i++)
     {
-        this->CalcBoneQuaternion(frame, s, &pbone[i], panim, q[i]);
-        this->CalcBonePosition(frame, s, &pbone[i], panim, pos[i]);
+        local.Set(i, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
     }
 
     if (pseqdesc->motiontype & HL1_MDL_X)
-        pos[pseqdesc->motionbone][0] = 0.0;
+        local.x[pseqdesc->motionbone] = 0.0;
     if (pseqdesc->motiontype & HL1_MDL_Y)
-        pos[pseqdesc->motionbone][1] = 0.0;
+        local.y[pseqdesc->motionbone] = 0.0;
     if (pseqdesc->motiontype & HL1_MDL_Z)
-        pos[pseqdesc->motionbone][2] = 0.0;
+        local.z[pseqdesc->motionbone] = 0.0;
 }
 
-void MdlInstance::SlerpBones(
-    glm::quat q1[],
-    glm::vec3 pos1[],
-    glm::quat q2[],
-    glm::vec3 pos2[],
+// Blends b into a by s. Rotations use nlerp with the slerp correction from "Approximating
+// slerp" (Kapoulkine), within a thousandth of a radian of glm::slerp without its acos
+// and sin, so the loop has no calls or branches left
+static void BlendBones(
+    size_t boneCount,
+    tLocalPose &a,
+    const tLocalPose &b,
     float s)
 {
-    if (Asset == nullptr)
+    s = std::clamp(s, 0.0f, 1.0f);
+
+    // The parts of the correction that only depend on s
+    auto s0 = Splat(s);
+    auto s1 = Splat(1.0f - s);
+    auto kScale = Splat((s - 0.5f) * (s - 0.5f));
+    auto tScale = Splat(s * (s - 0.5f) * (s - 1.0f));
+    auto one = Splat(1.0f);
+
+    for (size_t i = 0; i < PaddedBoneCount(boneCount); i += LaneWidth)
+    {
+        auto aqx = Load(a.qx + i), aqy = Load(a.qy + i), aqz = Load(a.qz + i), aqw = Load(a.qw + i);
+        auto bqx = Load(b.qx + i), bqy = Load(b.qy + i), bqz = Load(b.qz + i), bqw = Load(b.qw + i);
+
+        auto cosAngle = aqx * bqx + aqy * bqy + aqz * bqz + aqw * bqw;
+        auto d = Abs(cosAngle);
+
+        auto ka = Splat(1.0904f) + d * (Splat(-3.2452f) + d * (Splat(3.55645f) - d * Splat(1.43519f)));
+        auto kb = Splat(0.848013f) + d * (Splat(-1.06021f) + d * Splat(0.215638f));
+        auto t = s0 + tScale * (ka * kScale + kb);
+
+        // Take the short way around
+        auto tb = WithSignOf(t, cosAngle);
+        auto ta = one - t;
+
+        auto qx = aqx * ta + bqx * tb;
+        auto qy = aqy * ta + bqy * tb;
+        auto qz = aqz * ta + bqz * tb;
+        auto qw = aqw * ta + bqw * tb;
+        auto scale = InverseSqrt(qx * qx + qy * qy + qz * qz + qw * qw);
+
+        Store(a.qx + i, qx * scale);
+        Store(a.qy + i, qy * scale);
+        Store(a.qz + i, qz * scale);
+        Store(a.qw + i, qw * scale);
+
+        Store(a.x + i, Load(a.x + i) * s1 + Load(b.x + i) * s0);
+        Store(a.y + i, Load(a.y + i) * s1 + Load(b.y + i) * s0);
+        Store(a.z + i, Load(a.z + i) * s1 + Load(b.z + i) * s0);
+    }
+}
+
+// The same as glm::translate(pos) * glm::toMat4(q), as 3x4
+static void LocalMatrices(
+    size_t boneCount,
+    const tLocalPose &local,
+    tLocalMatrices &out)
+{
+    auto m = out.m;
+    auto one = Splat(1.0f);
+    auto two = Splat(2.0f);
+
+    for (size_t i = 0; i < PaddedBoneCount(boneCount); i += LaneWidth)
+    {
+        auto qx = Load(local.qx + i), qy = Load(local.qy + i), qz = Load(local.qz + i), qw = Load(local.qw + i);
+
+        Store(m[0] + i, one - two * (qy * qy + qz * qz));
+        Store(m[1] + i, two * (qx * qy - qw * qz));
+        Store(m[2] + i, two * (qx * qz + qw * qy));
+        Store(m[3] + i, Load(local.x + i));
+        Store(m[4] + i, two * (qx * qy + qw * qz));
+        Store(m[5] + i, one - two * (qx * qx + qz * qz));
+        Store(m[6] + i, two * (qy * qz - qw * qx));
+        Store(m[7] + i, Load(local.y + i));
+        Store(m[8] + i, two * (qx * qz - qw * qy));
+        Store(m[9] + i, two * (qy * qz + qw * qx));
+        Store(m[10] + i, one - two * (qx * qx + qy * qy));
+        Store(m[11] + i, Load(local.z + i));
+    }
+}
+
+// Walks the bones in file order, a parent always comes before its children there
+static void ConcatenateParents(
+    const std::vector<tMDLBone> &pbone,
+    const tLocalMatrices &local,
+    std::span<glm::mat4> bones)
+{
+    auto m = local.m;
+
+    for (size_t i = 0; i < pbone.size(); i++)
+    {
+        auto &bone = bones[i];
+        auto parent = pbone[i].parent;
+
+        if (parent < 0 || size_t(parent) >= i)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                bone[c] = glm::vec4(m[c][i], m[4 + c][i], m[8 + c][i], c == 3 ? 1.0f : 0.0f);
+            }
+
+            continue;
+        }
+
+        // Only the rotation and translation of the parent take part, its last row is 0 0 0 1
+        auto &p = bones[parent];
+
+        for (int c = 0; c < 4; c++)
+        {
+            float lx = m[c][i], ly = m[4 + c][i], lz = m[8 + c][i];
+
+            bone[c] = p[0] * lx + p[1] * ly + p[2] * lz;
+
+            if (c == 3)
+            {
+                bone[c] = bone[c] + p[3];
+            }
+        }
+    }
+}
+
+// Samples every blend of the sequence the pose needs into local. Returns how many
+// blends there are, 0 when the asset has nothing to pose into bones.
+static int SamplePose(
+    const MdlAsset *asset,
+    const tMDLPoseParams &pose,
+    size_t boneCount,
+    tLocalPose local[4])
+{
+    if (asset == nullptr || asset->_sequenceData.empty() || boneCount < asset->_boneData.size())
+    {
+        // Without all bones the parents would be missing
+        return 0;
+    }
+
+    auto sequence = pose.sequence < asset->_sequenceData.size() ? pose.sequence : 0;
+    auto numblends = asset->_sequenceData[sequence].numblends;
+    int blends = numblends == 4 ? 4 : (numblends > 1 ? 2 : 1);
+
+    tBoneAdjust adj = {};
+    CalcBoneAdj(asset, pose, adj);
+
+    for (int blend = 0; blend < blends; blend++)
+    {
+        CalcRotations(asset, pose, adj, local[blend], sequence, blend);
+    }
+
+    return blends;
+}
+
+void valve::hl1::BuildSkeleton(
+    const MdlAsset *asset,
+    const tMDLPoseParams &pose,
+    std::span<glm::mat4> bones)
+{
+    tLocalPose local[4];
+    tLocalMatrices matrices;
+
+    std::fill(bones.begin(), bones.end(), glm::mat4(1.0f));
+
+    auto boneCount = asset != nullptr ? std::min({asset->_boneData.size(), bones.size(), size_t(MAX_MDL_BONES)}) : 0;
+    auto blends = SamplePose(asset, pose, boneCount, local);
+
+    if (blends == 0)
+    {
+        return;
+    }
+
+    if (blends > 1)
+    {
+        BlendBones(boneCount, local[0], local[1], pose.blending[0] / 255.0f);
+    }
+
+    if (blends == 4)
+    {
+        BlendBones(boneCount, local[2], local[3], pose.blending[0] / 255.0f);
+        BlendBones(boneCount, local[0], local[2], pose.blending[1] / 255.0f);
+    }
+
+    LocalMatrices(boneCount, local[0], matrices);
+    ConcatenateParents(asset->_boneData, matrices, bones);
+}
+
+int valve::hl1::SamplePoseBlends(
+    const MdlAsset *asset,
+    const tMDLPoseParams &pose,
+    size_t boneCount,
+    tMDLBonePose blends[4][MAX_MDL_BONES])
+{
+    tLocalPose local[4];
+
+    boneCount = std::min(boneCount, size_t(MAX_MDL_BONES));
+
+    auto count = SamplePose(asset, pose, boneCount, local);
+
+    for (int blend = 0; blend < count; blend++)
+    {
+        for (size_t i = 0; i < boneCount; i++)
+        {
+            blends[blend][i] = tMDLBonePose{
+                glm::vec3(local[blend].x[i], local[blend].y[i], local[blend].z[i]),
+                glm::quat(local[blend].qw[i], local[blend].qx[i], local[blend].qy[i], local[blend].qz[i])};
+        }
+    }
+
+    return count;
+}
+
+void valve::hl1::LocalBones(
+    const MdlAsset *asset,
+    std::span<const glm::mat4> bones,
+    std::span<tMDLBonePose> local)
+{
+    auto boneCount = asset != nullptr ? std::min({asset->_boneData.size(), bones.size(), local.size()}) : 0;
+
+    for (size_t i = 0; i < boneCount; i++)
+    {
+        auto &bone = bones[i];
+        auto parent = asset->_boneData[i].parent;
+
+        if (parent < 0 || size_t(parent) >= i)
+        {
+            local[i] = tMDLBonePose{glm::vec3(bone[3]), glm::quat_cast(glm::mat3(bone))};
+
+            continue;
+        }
+
+        // The parent is rigid, so its inverse rotation is the transpose
+        auto inverse = glm::transpose(glm::mat3(bones[parent]));
+
+        local[i] = tMDLBonePose{
+            inverse * (glm::vec3(bone[3]) - glm::vec3(bones[parent][3])),
+            glm::quat_cast(inverse * glm::mat3(bone))};
+    }
+}
+
+void valve::hl1::BlendSkeletons(
+    const MdlAsset *asset,
+    std::span<const tMDLBonePose> a,
+    std::span<const tMDLBonePose> b,
+    float s,
+    std::span<glm::mat4> bones)
+{
+    tLocalPose local[2];
+    tLocalMatrices matrices;
+
+    std::fill(bones.begin(), bones.end(), glm::mat4(1.0f));
+
+    auto boneCount = asset != nullptr ? std::min({asset->_boneData.size(), bones.size(), size_t(MAX_MDL_BONES)}) : 0;
+
+    if (boneCount == 0 || boneCount < asset->_boneData.size() || a.size() < boneCount || b.size() < boneCount)
     {
         return;
     }
 
-    float s1;
+    for (size_t i = 0; i < boneCount; i++)
+    {
+        local[0].Set(i, a[i].position, a[i].rotation);
+        local[1].Set(i, b[i].position, b[i].rotation);
+    }
+
+    for (size_t i = boneCount; i < PaddedBoneCount(boneCount); i++)
+    {
+        local[0].Set(i, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+        local[1].Set(i, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    }
 
-    if (s < 0)
-        s = 0;
-    else if (s > 1.0f)
-        s = 1.0f;
+    BlendBones(boneCount, local[0], local[1], s);
+    LocalMatrices(boneCount, local[0], matrices);
+    ConcatenateParents(asset->_boneData, matrices, bones);
+}
 
-    s1 = 1.0f - s;
+float valve::hl1::AdvanceFrame(
+    const MdlAsset *asset,
+    size_t sequence,
+    float frame,
+    bool repeat,
+    float speed,
+    std::chrono::microseconds time)
+{
+    if (asset == nullptr || sequence >= asset->_sequenceData.size())
+    {
+        return frame;
+    }
+
+    const tMDLSequenceDescription &pseqdesc = asset->_sequenceData[sequence];
+
+    auto dt = float(double(time.count()) / 1000000.0);
+    if (dt > 0.1f)
+    {
+        dt = 0.1f;
+    }
 
-    for (size_t i = 0; i < Asset->_boneData.size(); i++)
+    if (frame + (dt * pseqdesc.fps * speed) < (pseqdesc.numframes - 1) || repeat)
     {
-        q1[i] = glm::slerp(q1[i], q2[i], s);
-        pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s;
-        pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s;
-        pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s;
+        frame += dt * pseqdesc.fps * speed;
+
+        if (pseqdesc.numframes <= 1)
+        {
+            frame = 0;
+        }
+        else // wrap
+        {
+            frame -= (int)(frame / (pseqdesc.numframes - 1)) * (pseqdesc.numframes - 1);
+        }
     }
+
+    return frame;
+}
+
+MdlInstance::MdlInstance() = default;
+
+MdlInstance::~MdlInstance() = default;
+
+float MdlInstance::Advance(
+    float prevFrame,
+    std::chrono::microseconds time)
+{
+    _pose.frame = AdvanceFrame(Asset, _pose.sequence, prevFrame, Repeat, Speed, time);
+
+    return _pose.frame;
+}
+
+float MdlInstance::Update(
+    float prevFrame,
+    std::chrono::microseconds time)
+{
+    Advance(prevFrame, time);
+
+    BuildSkeleton(Asset, _pose, _bonetransform);
+
+    return _pose.frame;
 }
 
 size_t MdlInstance::SetSequence(
@@ -358,16 +767,16 @@ size_t MdlInstance::SetSequence(
     {
         return 0;
     }
-    if (iSequence > Asset->_sequenceData.size())
+    if (iSequence >= Asset->_sequenceData.size())
         iSequence = 0;
     if (iSequence < 0)
         iSequence = Asset->_sequenceData.size() - 1;
 
-    Sequence = iSequence;
-    Frame = 0;
+    _pose.sequence = iSequence;
+    _pose.frame = 0;
     Repeat = repeat;
 
-    return Sequence;
+    return _pose.sequence;
 }
 
 float MdlInstance::SetController(
@@ -427,7 +836,7 @@ float MdlInstance::SetController(
 
     if (setting < 0) setting = 0;
     if (setting > 255) setting = 255;
-    Controller[iController] = setting;
+    _pose.controller[iController] = setting;
 
     return setting * (1.0f / 255.0f) * (pbonecontroller->end - pbonecontroller->start) + pbonecontroller->start;
 }
@@ -484,7 +893,7 @@ float MdlInstance::SetMouth(
 
     if (setting < 0) setting = 0;
     if (setting > 64) setting = 64;
-    Mouth = setting;
+    _pose.mouth = setting;
 
     return setting * (1.0f / 64.0f) * (pbonecontroller->end - pbonecontroller->start) + pbonecontroller->start;
 }
@@ -498,7 +907,12 @@ float MdlInstance::SetBlending(
         return 0.0f;
     }
 
-    tMDLSequenceDescription &pseqdesc = Asset->_sequenceData[(int)Sequence];
+    if (iBlender < 0 || iBlender > 1)
+    {
+        return flValue;
+    }
+
+    tMDLSequenceDescription &pseqdesc = Asset->_sequenceData[_pose.sequence];
 
     if (pseqdesc.blendtype[iBlender] == 0)
         return flValue;
@@ -524,7 +938,7 @@ float MdlInstance::SetBlending(
     if (setting < 0) setting = 0;
     if (setting > 255) setting = 255;
 
-    Blending[iBlender] = setting;
+    _pose.blending[iBlender] = setting;
 
     return setting * (1.0f / 255.0f) * (pseqdesc.blendend[iBlender] - pseqdesc.blendstart[iBlender]) + pseqdesc.blendstart[iBlender];
 }
@@ -0,0 +1,28 @@
+#ifndef HL1MDLPOSE_H
+#define HL1MDLPOSE_H
+
+#include <valve/mdl/hl1mdlinstance.h>
+
+namespace valve
+{
+
+    namespace hl1
+    {
+
+        // Not part of the library API, this header is only shared with the benches that
+        // check the pose kernels against other ways of building a skeleton
+
+        // The local bones of every blend of the sequence the pose needs, before they are
+        // blended. Returns how many blends there are, 0 when the asset has nothing to
+        // pose into boneCount bones.
+        int SamplePoseBlends(
+            const MdlAsset *asset,
+            const tMDLPoseParams &pose,
+            size_t boneCount,
+            tMDLBonePose blends[4][MAX_MDL_BONES]);
+
+    } // namespace hl1
+
+} // namespace valve
+
+#endif // HL1MDLPOSE_H
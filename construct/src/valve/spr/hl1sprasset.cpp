@@ -1,5 +1,6 @@
 #include <valve/spr/hl1sprasset.h>
 
+#include <valve/hlpalette.h>
 #include <valve/hltexture.h>
 
 using namespace valve::hl1;
@@ -76,18 +77,10 @@ bool SprAsset::Load(
             tSPRFrame *frame = (tSPRFrame *)tmp;
             tmp += sizeof(tSPRFrame);
             unsigned char *textureData = new unsigned char[frame->width * frame->height * 4];
-            for (int y = 0; y < frame->height; y++)
-            {
-                for (int x = 0; x < frame->width; x++)
-                {
-                    int item = x * frame->height + y;
-                    unsigned char index = tmp[item];
-                    textureData[item * 4] = palette[index * 3];
-                    textureData[item * 4 + 1] = palette[index * 3 + 1];
-                    textureData[item * 4 + 2] = palette[index * 3 + 2];
-                    textureData[item * 4 + 3] = (item == 255 ? 0 : 255);
-                }
-            }
+
+            // Only alpha tested sprites treat the last palette entry as transparent
+            ExpandPalette(tmp, frame->width * frame->height, palette, textureData, _header->texFormat == AlphaTest ? 255 : -1, paletteColorCount);
+
             auto tex = new Texture();
             tex->SetData(frame->width, frame->height, 4, textureData);
             _textures.push_back(tex);
@@ -0,0 +1,131 @@
+#include "workerpool.h"
+
+#include <algorithm>
+#include <atomic>
+
+WorkerPool::WorkerPool(
+    size_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    _threads.reserve(threadCount);
+
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        _threads.emplace_back(&WorkerPool::WorkerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+
+    _condition.notify_all();
+
+    for (auto &thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+WorkerPool &WorkerPool::Shared()
+{
+    static WorkerPool pool;
+
+    return pool;
+}
+
+size_t WorkerPool::ThreadCount() const
+{
+    return _threads.size();
+}
+
+void WorkerPool::ParallelFor(
+    size_t count,
+    const std::function<void(size_t)> &task)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    struct State
+    {
+        std::atomic<size_t> next = 0;
+        std::atomic<size_t> done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    auto state = std::make_shared<State>();
+
+    // Every participant keeps taking the next index until all have been handed out
+    auto worker = [state, count, &task]() {
+        size_t finishedHere = 0;
+
+        for (auto i = state->next++; i < count; i = state->next++)
+        {
+            task(i);
+            finishedHere++;
+        }
+
+        if (finishedHere > 0 && (state->done += finishedHere) == count)
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->finished.notify_all();
+        }
+    };
+
+    auto helpers = std::min(_threads.size(), count - 1);
+
+    for (size_t i = 0; i < helpers; i++)
+    {
+        Enqueue(worker);
+    }
+
+    worker();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state, count]() { return state->done == count; });
+}
+
+void WorkerPool::Enqueue(
+    std::function<void()> &&task)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push(std::move(task));
+    }
+
+    _condition.notify_one();
+}
+
+void WorkerPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            _condition.wait(lock, [this]() { return _stopping || !_tasks.empty(); });
+
+            if (_stopping && _tasks.empty())
+            {
+                return;
+            }
+
+            task = std::move(_tasks.front());
+            _tasks.pop();
+        }
+
+        task();
+    }
+}
@@ -12,6 +12,9 @@
 
 bool showPhysicsDebug = false;
 
+// How long each frame may spend on loading the map, the rest of the frame keeps the game ticking
+const std::chrono::microseconds LoadBudget = std::chrono::milliseconds(8);
+
 Game::Game()
 {
     _fileSystem = std::make_unique<FileSystem>();
@@ -54,7 +57,7 @@ bool Game::Startup(
 
     _console = std::make_unique<Console>(font);
 
-    _engine->Load(_map);
+    _engine->BeginLoad(_map);
 
     return true;
 }
@@ -73,6 +76,13 @@ bool Game::Tick(
     wss << fps;
     font->Print(wss.str().c_str(), 10, 10);
 
+    if (_engine->ContinueLoad(LoadBudget))
+    {
+        std::wstringstream progress;
+        progress << L"loading " << int(_engine->GetLoadProgress().Fraction * 100.0f) << L"%";
+        font->Print(progress.str().c_str(), 10, 30);
+    }
+
     if (_console->Tick(time, inputState))
     {
         struct InputState emptyImputState = {};
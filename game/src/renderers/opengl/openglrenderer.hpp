@@ -3,6 +3,7 @@
 
 #include <filesystem>
 #include <irenderer.hpp>
+#include <vector>
 
 class OpenGlRenderer : public IRenderer
 {
@@ -22,6 +23,18 @@ public:
         bool repeat,
         unsigned char *data);
 
+    virtual unsigned int LoadTexture(
+        int bpp,
+        bool repeat,
+        std::span<const TextureLevel> levels);
+
+    virtual bool SupportsCompressedTextures() const;
+
+    virtual unsigned int LoadCompressedTexture(
+        CompressedFormats format,
+        bool repeat,
+        std::span<const CompressedTextureLevel> levels);
+
     virtual unsigned int LoadLightmap(
         int width,
         int height,
@@ -29,6 +42,19 @@ public:
         bool repeat,
         unsigned char *data);
 
+    virtual void UpdateLightmap(
+        unsigned int index,
+        int x,
+        int y,
+        int width,
+        int height,
+        int bpp,
+        int pitch,
+        const unsigned char *data);
+
+    virtual void UnloadTextures(
+        std::span<const unsigned int> indices);
+
     virtual std::unique_ptr<IShader> LoadShader(
         const std::string &shaderName);
 
@@ -46,15 +72,22 @@ public:
         int start,
         int count);
 
+    virtual void RenderIndexedTriangles(
+        std::span<const int> firstIndices,
+        std::span<const int> indexCounts);
+
 private:
     std::filesystem::path _assetFolder = std::filesystem::path("./assets");
+    std::vector<const void *> _indexOffsets;
 
+    // Only textures without mip levels of their own get them generated
     unsigned int LoadActualTexture(
         int width,
         int height,
         int bpp,
         bool repeat,
-        unsigned char *data);
+        unsigned char *data,
+        bool generateMipmaps);
 };
 
 #endif // OPENGLRENDERER_H
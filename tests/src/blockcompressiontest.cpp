@@ -0,0 +1,374 @@
+#include <valve/bsp/hl1bsptypes.h>
+#include <valve/hlblockcompression.h>
+#include <valve/hlpalette.h>
+#include <workerpool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <print>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace valve;
+
+// Round-trips images through CompressBlocks() and DecompressBlocks() and fails when
+// the decoded texels are too far from the originals. Runs on generated gradients and
+// alpha-tested textures, and on every miptex of a wad when one is given:
+//
+//   blockcompressiontest [path/to/halflife.wad]
+
+// PSNR in dB of the color channels, the encoder only fits endpoints and indices
+// so anything below these is a broken block and not a lossy one
+const double MinGradientPsnr = 34.0;
+const double MinAlphaTestedPsnr = 30.0;
+const double MinWadPsnr = 28.0;        // over all texels of the wad
+const double MinWadTexturePsnr = 20.0; // the worst single texture
+
+typedef struct sImage
+{
+    std::string name;
+    int width;
+    int height;
+    int bpp;
+    std::vector<unsigned char> data;
+
+} tImage;
+
+typedef struct sError
+{
+    double squaredError = 0.0; // summed over the color channels of the compared texels
+    size_t samples = 0;
+    size_t alphaMismatches = 0; // texels that flipped between opaque and transparent
+
+    double Rmse() const { return samples > 0 ? std::sqrt(squaredError / double(samples)) : 0.0; }
+
+    double Psnr() const
+    {
+        auto rmse = Rmse();
+
+        return rmse > 0.0 ? 20.0 * std::log10(255.0 / rmse) : 99.0;
+    }
+
+} tError;
+
+// BC3 for images with any transparent texel, the same choice Texture::Compress() makes
+static BlockFormats FormatFor(
+    const tImage &image)
+{
+    if (image.bpp == 4)
+    {
+        for (size_t i = 3; i < image.data.size(); i += 4)
+        {
+            if (image.data[i] != 255)
+            {
+                return BlockFormats::BC3;
+            }
+        }
+    }
+
+    return BlockFormats::BC1;
+}
+
+// The color of transparent texels is not compared, it never shows
+static tError RoundTrip(
+    const tImage &image,
+    BlockFormats format)
+{
+    std::vector<unsigned char> blocks(BlockCompressedSize(format, image.width, image.height));
+    std::vector<unsigned char> decoded(size_t(image.width) * size_t(image.height) * 4);
+
+    CompressBlocks(format, image.data.data(), image.width, image.height, image.bpp, blocks.data());
+    DecompressBlocks(format, blocks.data(), image.width, image.height, decoded.data());
+
+    tError error;
+
+    for (size_t i = 0; i < size_t(image.width) * size_t(image.height); i++)
+    {
+        auto original = &image.data[i * size_t(image.bpp)];
+        auto result = &decoded[i * 4];
+        auto opaque = image.bpp == 3 || original[3] >= 128;
+
+        if (image.bpp == 4 && opaque != (result[3] >= 128))
+        {
+            error.alphaMismatches++;
+        }
+
+        if (!opaque)
+        {
+            continue;
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+            double d = double(original[c]) - double(result[c]);
+            error.squaredError += d * d;
+        }
+
+        error.samples += 3;
+    }
+
+    return error;
+}
+
+static tImage Gradient(
+    int width,
+    int height,
+    int bpp)
+{
+    tImage image = {std::format("gradient {}x{}x{}", width, height, bpp), width, height, bpp, {}};
+
+    image.data.resize(size_t(width) * size_t(height) * size_t(bpp));
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            auto texel = &image.data[(size_t(y) * size_t(width) + size_t(x)) * size_t(bpp)];
+
+            texel[0] = (unsigned char)(x * 255 / std::max(width - 1, 1));
+            texel[1] = (unsigned char)(y * 255 / std::max(height - 1, 1));
+            texel[2] = (unsigned char)((x + y) * 255 / std::max(width + height - 2, 1));
+
+            if (bpp == 4)
+            {
+                texel[3] = 255;
+            }
+        }
+    }
+
+    return image;
+}
+
+// Like the '{' textures: a smooth pattern with holes of index 255 punched in it
+static tImage AlphaTested(
+    int width,
+    int height,
+    unsigned int seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> noise(-6, 6);
+
+    tImage image = {std::format("alpha tested {}x{}", width, height), width, height, 4, {}};
+
+    image.data.resize(size_t(width) * size_t(height) * 4);
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            auto texel = &image.data[(size_t(y) * size_t(width) + size_t(x)) * 4];
+            auto hole = ((x / 6) + (y / 6)) % 3 == 0;
+
+            texel[0] = (unsigned char)std::clamp(96 + x % 64 + noise(random), 0, 255);
+            texel[1] = (unsigned char)std::clamp(80 + y % 48 + noise(random), 0, 255);
+            texel[2] = (unsigned char)std::clamp(64 + noise(random), 0, 255);
+            texel[3] = hole ? 0 : 255;
+
+            if (hole)
+            {
+                texel[0] = texel[1] = texel[2] = 0;
+            }
+        }
+    }
+
+    return image;
+}
+
+static bool Check(
+    const tImage &image,
+    double minPsnr)
+{
+    auto format = FormatFor(image);
+    auto error = RoundTrip(image, format);
+
+    std::println("[INF] {:<28} BC{} rmse {:6.2f} psnr {:6.2f} dB, {} alpha mismatches",
+                 image.name, int(format), error.Rmse(), error.Psnr(), error.alphaMismatches);
+
+    if (error.Psnr() < minPsnr || error.alphaMismatches > 0)
+    {
+        std::println("[ERR] {} is under {:.1f} dB or lost its alpha test", image.name, minPsnr);
+
+        return false;
+    }
+
+    return true;
+}
+
+// Expands level 0 of every miptex lump, the same way the bsp loader does
+static std::vector<tImage> LoadWadTextures(
+    const std::string &filename)
+{
+    std::vector<tImage> images;
+
+    std::ifstream file(filename, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (data.size() < sizeof(hl1::tWADHeader))
+    {
+        return images;
+    }
+
+    // Lumps are not always 4 byte aligned, the headers are copied out
+    hl1::tWADHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    if (std::string(header.signature, 4) != HL1_WAD_SIGNATURE || header.lumpsCount < 0 || header.lumpsOffset < 0 ||
+        size_t(header.lumpsOffset) + size_t(header.lumpsCount) * sizeof(hl1::tWADLump) > data.size())
+    {
+        return images;
+    }
+
+    for (int l = 0; l < header.lumpsCount; l++)
+    {
+        hl1::tWADLump lump;
+        std::memcpy(&lump, data.data() + header.lumpsOffset + size_t(l) * sizeof(lump), sizeof(lump));
+
+        if (lump.type != 0x43 || lump.compression != 0 || lump.offset < 0 || lump.size < int(sizeof(hl1::tBSPMipTexHeader)) ||
+            size_t(lump.offset) + size_t(lump.size) > data.size())
+        {
+            continue;
+        }
+
+        auto lumpData = data.data() + lump.offset;
+
+        hl1::tBSPMipTexHeader miptex;
+        std::memcpy(&miptex, lumpData, sizeof(miptex));
+
+        if (miptex.width == 0 || miptex.height == 0 || miptex.width > 4096 || miptex.height > 4096)
+        {
+            continue;
+        }
+
+        size_t s = size_t(miptex.width) * size_t(miptex.height);
+        size_t paletteOffset = size_t(miptex.offsets[0]) + s + (s / 4) + (s / 16) + (s / 64) + sizeof(short);
+
+        if (size_t(miptex.offsets[0]) + s > size_t(lump.size) || paletteOffset + 256 * 3 > size_t(lump.size))
+        {
+            continue;
+        }
+
+        tImage image = {std::string(miptex.name, strnlen(miptex.name, sizeof(miptex.name))), int(miptex.width), int(miptex.height), 4, {}};
+        image.data.resize(s * 4);
+
+        ExpandPalette(lumpData + miptex.offsets[0], s, lumpData + paletteOffset, image.data.data(), image.name[0] == '{' ? 255 : -1);
+
+        images.push_back(std::move(image));
+    }
+
+    return images;
+}
+
+static bool CheckWad(
+    const std::string &filename)
+{
+    auto images = LoadWadTextures(filename);
+
+    if (images.empty())
+    {
+        std::println("[ERR] no miptex found in {}", filename);
+
+        return false;
+    }
+
+    tError total;
+    double worstPsnr = 99.0;
+    std::string worstName;
+    bool success = true;
+
+    for (auto &image : images)
+    {
+        auto error = RoundTrip(image, FormatFor(image));
+
+        total.squaredError += error.squaredError;
+        total.samples += error.samples;
+        total.alphaMismatches += error.alphaMismatches;
+
+        if (error.Psnr() < worstPsnr)
+        {
+            worstPsnr = error.Psnr();
+            worstName = image.name;
+        }
+
+        if (error.alphaMismatches > 0)
+        {
+            std::println("[ERR] {} lost its alpha test in {} texels", image.name, error.alphaMismatches);
+
+            success = false;
+        }
+    }
+
+    std::println("[INF] {} textures of {}: rmse {:.2f} psnr {:.2f} dB, worst {} at {:.2f} dB",
+                 images.size(), filename, total.Rmse(), total.Psnr(), worstName, worstPsnr);
+
+    if (total.Psnr() < MinWadPsnr || worstPsnr < MinWadTexturePsnr)
+    {
+        std::println("[ERR] {} is under {:.1f} dB, or a texture under {:.1f} dB", filename, MinWadPsnr, MinWadTexturePsnr);
+
+        success = false;
+    }
+
+    return success;
+}
+
+// The rows of blocks are encoded independently, so the pool has to give the same
+// bytes as one thread
+static bool CheckThreaded()
+{
+    auto image = AlphaTested(1024, 1024, 11);
+    auto size = BlockCompressedSize(BlockFormats::BC3, image.width, image.height);
+
+    std::vector<unsigned char> serial(size);
+    std::vector<unsigned char> threaded(size);
+
+    auto start = std::chrono::steady_clock::now();
+    CompressBlocks(BlockFormats::BC3, image.data.data(), image.width, image.height, image.bpp, serial.data());
+    auto serialTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    CompressBlocks(BlockFormats::BC3, image.data.data(), image.width, image.height, image.bpp, threaded.data(), &WorkerPool::Shared());
+    auto threadedTime = std::chrono::steady_clock::now() - start;
+
+    auto ms = [](auto duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+
+    std::println("[INF] {}: {:.1f} ms on one thread, {:.1f} ms on {} workers (x{:.2f})",
+                 image.name, ms(serialTime), ms(threadedTime), WorkerPool::Shared().ThreadCount(),
+                 ms(serialTime) / std::max(ms(threadedTime), 0.001));
+
+    if (serial != threaded)
+    {
+        std::println("[ERR] the pool encoded {} differently", image.name);
+
+        return false;
+    }
+
+    return true;
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    auto success = true;
+
+    // Sizes that are not a multiple of 4 cover the edge blocks
+    success = Check(Gradient(256, 256, 3), MinGradientPsnr) && success;
+    success = Check(Gradient(250, 130, 3), MinGradientPsnr) && success;
+    success = Check(Gradient(64, 16, 4), MinGradientPsnr) && success;
+    success = Check(AlphaTested(128, 128, 3), MinAlphaTestedPsnr) && success;
+    success = Check(AlphaTested(61, 35, 5), MinAlphaTestedPsnr) && success;
+
+    success = CheckThreaded() && success;
+
+    if (argc > 1)
+    {
+        success = CheckWad(argv[1]) && success;
+    }
+
+    return success ? 0 : 1;
+}
@@ -22,7 +22,82 @@ unsigned int OpenGlRenderer::LoadTexture(
 {
     glActiveTexture(GL_TEXTURE0);
 
-    return LoadActualTexture(width, height, bpp, repeat, data);
+    return LoadActualTexture(width, height, bpp, repeat, data, true);
+}
+
+unsigned int OpenGlRenderer::LoadTexture(
+    int bpp,
+    bool repeat,
+    std::span<const TextureLevel> levels)
+{
+    if (levels.empty())
+    {
+        return 0;
+    }
+
+    GLuint format = bpp == 4 ? GL_RGBA : GL_RGB;
+    GLuint glIndex = 0;
+
+    glActiveTexture(GL_TEXTURE0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glGenTextures(1, &glIndex);
+    glBindTexture(GL_TEXTURE_2D, glIndex);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, repeat ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, repeat ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+
+    // A chain that stops early is fine, the smallest level is used below it
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(levels.size() - 1));
+
+    for (size_t level = 0; level < levels.size(); level++)
+    {
+        glTexImage2D(GL_TEXTURE_2D, GLint(level), format, levels[level].width, levels[level].height, 0, format, GL_UNSIGNED_BYTE, levels[level].data);
+    }
+
+    return glIndex;
+}
+
+bool OpenGlRenderer::SupportsCompressedTextures() const
+{
+    return GLAD_GL_EXT_texture_compression_s3tc != 0;
+}
+
+unsigned int OpenGlRenderer::LoadCompressedTexture(
+    CompressedFormats format,
+    bool repeat,
+    std::span<const CompressedTextureLevel> levels)
+{
+    if (levels.empty())
+    {
+        return 0;
+    }
+
+    GLenum internalFormat = format == CompressedFormats::BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    GLuint glIndex = 0;
+
+    glActiveTexture(GL_TEXTURE0);
+
+    glGenTextures(1, &glIndex);
+    glBindTexture(GL_TEXTURE_2D, glIndex);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, repeat ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, repeat ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(levels.size() - 1));
+
+    for (size_t level = 0; level < levels.size(); level++)
+    {
+        glCompressedTexImage2D(GL_TEXTURE_2D, GLint(level), internalFormat, levels[level].width, levels[level].height, 0, GLsizei(levels[level].size), levels[level].data);
+    }
+
+    return glIndex;
 }
 
 unsigned int OpenGlRenderer::LoadLightmap(
@@ -35,7 +110,40 @@ unsigned int OpenGlRenderer::LoadLightmap(
     glActiveTexture(GL_TEXTURE1);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    return LoadActualTexture(width, height, bpp, repeat, data);
+    // Light styles update the lightmaps in place, mipmaps would go stale
+    return LoadActualTexture(width, height, bpp, repeat, data, false);
+}
+
+void OpenGlRenderer::UpdateLightmap(
+    unsigned int index,
+    int x,
+    int y,
+    int width,
+    int height,
+    int bpp,
+    int pitch,
+    const unsigned char *data)
+{
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, index);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / bpp);
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, bpp == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, data);
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void OpenGlRenderer::UnloadTextures(
+    std::span<const unsigned int> indices)
+{
+    // Names that are 0 or no texture are silently ignored
+    if (indices.empty())
+    {
+        return;
+    }
+
+    glDeleteTextures(GLsizei(indices.size()), indices.data());
 }
 
 unsigned int OpenGlRenderer::LoadActualTexture(
@@ -43,7 +151,8 @@ unsigned int OpenGlRenderer::LoadActualTexture(
     int height,
     int bpp,
     bool repeat,
-    unsigned char *data)
+    unsigned char *data,
+    bool generateMipmaps)
 {
     GLuint format = GL_RGB;
     GLuint glIndex = 0;
@@ -72,11 +181,15 @@ unsigned int OpenGlRenderer::LoadActualTexture(
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, generateMipmaps ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+
+    if (generateMipmaps)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
 
     return glIndex;
 }
@@ -144,3 +257,27 @@ void OpenGlRenderer::RenderTriangleFans(
 {
     glDrawArrays(GL_TRIANGLE_FAN, start, count);
 }
+
+void OpenGlRenderer::RenderIndexedTriangles(
+    std::span<const int> firstIndices,
+    std::span<const int> indexCounts)
+{
+    if (firstIndices.empty())
+    {
+        return;
+    }
+
+    // The offsets are in bytes into the element buffer
+    _indexOffsets.resize(firstIndices.size());
+    for (size_t i = 0; i < firstIndices.size(); i++)
+    {
+        _indexOffsets[i] = reinterpret_cast<const void *>(size_t(firstIndices[i]) * sizeof(unsigned int));
+    }
+
+    glMultiDrawElements(
+        GL_TRIANGLES,
+        indexCounts.data(),
+        GL_UNSIGNED_INT,
+        _indexOffsets.data(),
+        GLsizei(firstIndices.size()));
+}